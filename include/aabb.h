@@ -12,6 +12,34 @@ public:
     glm::vec3 min() const { return minimum; }
     glm::vec3 max() const { return maximum; }
 
+    glm::vec3 centroid() const { return 0.5f * (minimum + maximum); }
+
+    float surface_area() const
+    {
+        glm::vec3 d = maximum - minimum;
+        return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    void expand(const aabb& b)
+    {
+        minimum.x = b.minimum.x < minimum.x ? b.minimum.x : minimum.x;
+        minimum.y = b.minimum.y < minimum.y ? b.minimum.y : minimum.y;
+        minimum.z = b.minimum.z < minimum.z ? b.minimum.z : minimum.z;
+        maximum.x = b.maximum.x > maximum.x ? b.maximum.x : maximum.x;
+        maximum.y = b.maximum.y > maximum.y ? b.maximum.y : maximum.y;
+        maximum.z = b.maximum.z > maximum.z ? b.maximum.z : maximum.z;
+    }
+
+    void expand(const glm::vec3& p)
+    {
+        minimum.x = p.x < minimum.x ? p.x : minimum.x;
+        minimum.y = p.y < minimum.y ? p.y : minimum.y;
+        minimum.z = p.z < minimum.z ? p.z : minimum.z;
+        maximum.x = p.x > maximum.x ? p.x : maximum.x;
+        maximum.y = p.y > maximum.y ? p.y : maximum.y;
+        maximum.z = p.z > maximum.z ? p.z : maximum.z;
+    }
+
     /*bool hit(const ray& r, float t_min, float t_max) const {
         for (int a = 0; a < 3; a++) {
             auto t0 = fmin((minimum[a] - r.origin()[a]) / r.direction()[a],
@@ -47,6 +75,38 @@ public:
     glm::vec3 maximum;
 };
 
+// Slab test against a ray given by its origin and precomputed reciprocal direction,
+// for traversal loops that test many boxes against the same ray.
+inline bool slab_hit(const glm::vec3& box_min, const glm::vec3& box_max,
+    const glm::vec3& origin, const glm::vec3& inv_dir, float t_min, float t_max)
+{
+    float t0 = (box_min.x - origin.x) * inv_dir.x;
+    float t1 = (box_max.x - origin.x) * inv_dir.x;
+    if (inv_dir.x < 0.0f) std::swap(t0, t1);
+    t_min = t0 > t_min ? t0 : t_min;
+    t_max = t1 < t_max ? t1 : t_max;
+
+    t0 = (box_min.y - origin.y) * inv_dir.y;
+    t1 = (box_max.y - origin.y) * inv_dir.y;
+    if (inv_dir.y < 0.0f) std::swap(t0, t1);
+    t_min = t0 > t_min ? t0 : t_min;
+    t_max = t1 < t_max ? t1 : t_max;
+
+    t0 = (box_min.z - origin.z) * inv_dir.z;
+    t1 = (box_max.z - origin.z) * inv_dir.z;
+    if (inv_dir.z < 0.0f) std::swap(t0, t1);
+    t_min = t0 > t_min ? t0 : t_min;
+    t_max = t1 < t_max ? t1 : t_max;
+
+    return t_min < t_max;
+}
+
+// Inverted box that any expand() overwrites, used as the start of a bounds accumulation.
+inline aabb empty_box()
+{
+    return aabb(glm::vec3(infinity, infinity, infinity), glm::vec3(-infinity, -infinity, -infinity));
+}
+
 aabb surrounding_box(aabb box0, aabb box1)
 {
     glm::vec3 small(fmin(box0.min().x, box1.min().x),
@@ -14,6 +14,7 @@ public:
         : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual void resolve_hit(const ray& r, hit_record& rec) const override;
 
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override
     {
@@ -23,6 +24,33 @@ public:
         return true;
     }
 
+    virtual float pdf_value(const glm::vec3& origin, const glm::vec3& v) const override {
+        hit_record rec;
+        if (!this->hit(ray(origin, v), 0.001f, infinity, rec))
+            return 0;
+
+        auto area = (x1 - x0) * (y1 - y0);
+        auto distance_squared = rec.t * rec.t * glm::dot(v,v);
+        auto cosine = fabs(v.z / glm::length(v));
+
+        return distance_squared / (cosine * area);
+    }
+
+    virtual glm::vec3 random(const glm::vec3& origin) const override {
+        const glm::vec2 s = sample_2d();
+        auto random_point = glm::vec3(x0 + (x1 - x0) * s.x, y0 + (y1 - y0) * s.y, k);
+        return random_point - origin;
+    }
+
+    virtual bool emitter(emitter_surface& out) const override {
+        bounding_box(0, 1, out.box);
+        out.mat_ptr = mp.get();
+        out.area = (x1 - x0) * (y1 - y0);
+        out.axis = glm::vec3(0, 0, 1);
+        out.cos_theta = 1;
+        return true;
+    }
+
 public:
     shared_ptr<material> mp;
     float x0, x1, y0, y1, k;
@@ -37,6 +65,7 @@ public:
         : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual void resolve_hit(const ray& r, hit_record& rec) const override;
 
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override {
         // The bounding box must have non-zero width in each dimension, so pad the Y
@@ -52,16 +81,26 @@ public:
 
         auto area = (x1 - x0) * (z1 - z0);
         auto distance_squared = rec.t * rec.t * glm::dot(v,v);
-        auto cosine = fabs(glm::dot(v, rec.normal) / glm::length(v));
+        auto cosine = fabs(v.y / glm::length(v));
 
         return distance_squared / (cosine * area);
     }
 
     virtual glm::vec3 random(const glm::vec3& origin) const override {
-        auto random_point = glm::vec3(random_float(x0, x1), k, random_float(z0, z1));
+        const glm::vec2 s = sample_2d();
+        auto random_point = glm::vec3(x0 + (x1 - x0) * s.x, k, z0 + (z1 - z0) * s.y);
         return random_point - origin;
     }
 
+    virtual bool emitter(emitter_surface& out) const override {
+        bounding_box(0, 1, out.box);
+        out.mat_ptr = mp.get();
+        out.area = (x1 - x0) * (z1 - z0);
+        out.axis = glm::vec3(0, 1, 0);
+        out.cos_theta = 1;
+        return true;
+    }
+
 public:
     shared_ptr<material> mp;
     float x0, x1, z0, z1, k;
@@ -76,6 +115,7 @@ public:
         : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual void resolve_hit(const ray& r, hit_record& rec) const override;
 
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override {
         // The bounding box must have non-zero width in each dimension, so pad the X
@@ -84,6 +124,33 @@ public:
         return true;
     }
 
+    virtual float pdf_value(const glm::vec3& origin, const glm::vec3& v) const override {
+        hit_record rec;
+        if (!this->hit(ray(origin, v), 0.001f, infinity, rec))
+            return 0;
+
+        auto area = (y1 - y0) * (z1 - z0);
+        auto distance_squared = rec.t * rec.t * glm::dot(v,v);
+        auto cosine = fabs(v.x / glm::length(v));
+
+        return distance_squared / (cosine * area);
+    }
+
+    virtual glm::vec3 random(const glm::vec3& origin) const override {
+        const glm::vec2 s = sample_2d();
+        auto random_point = glm::vec3(k, y0 + (y1 - y0) * s.x, z0 + (z1 - z0) * s.y);
+        return random_point - origin;
+    }
+
+    virtual bool emitter(emitter_surface& out) const override {
+        bounding_box(0, 1, out.box);
+        out.mat_ptr = mp.get();
+        out.area = (y1 - y0) * (z1 - z0);
+        out.axis = glm::vec3(1, 0, 0);
+        out.cos_theta = 1;
+        return true;
+    }
+
 public:
     shared_ptr<material> mp;
     float y0, y1, z0, z1, k;
@@ -98,14 +165,21 @@ bool xy_rect::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
     auto y = r.origin().y + t * r.direction().y;
     if (x < x0 || x > x1 || y < y0 || y > y1)
         return false;
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (y - y0) / (y1 - y0);
     rec.t = t;
+    rec.object = this;
+    rec.b0 = x;
+    rec.b1 = y;
+    return true;
+}
+
+void xy_rect::resolve_hit(const ray& r, hit_record& rec) const
+{
+    rec.u = (rec.b0 - x0) / (x1 - x0);
+    rec.v = (rec.b1 - y0) / (y1 - y0);
     auto outward_normal = glm::vec3(0, 0, 1);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
-    return true;
+    rec.mat_ptr = mp.get();
+    rec.p = r.at(rec.t);
 }
 
 bool xz_rect::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
@@ -116,14 +190,21 @@ bool xz_rect::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
     auto z = r.origin().z + t * r.direction().z;
     if (x < x0 || x > x1 || z < z0 || z > z1)
         return false;
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (z - z0) / (z1 - z0);
     rec.t = t;
+    rec.object = this;
+    rec.b0 = x;
+    rec.b1 = z;
+    return true;
+}
+
+void xz_rect::resolve_hit(const ray& r, hit_record& rec) const
+{
+    rec.u = (rec.b0 - x0) / (x1 - x0);
+    rec.v = (rec.b1 - z0) / (z1 - z0);
     auto outward_normal = glm::vec3(0, 1, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
-    return true;
+    rec.mat_ptr = mp.get();
+    rec.p = r.at(rec.t);
 }
 
 bool yz_rect::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
@@ -134,14 +215,21 @@ bool yz_rect::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
     auto z = r.origin().z + t * r.direction().z;
     if (y < y0 || y > y1 || z < z0 || z > z1)
         return false;
-    rec.u = (y - y0) / (y1 - y0);
-    rec.v = (z - z0) / (z1 - z0);
     rec.t = t;
+    rec.object = this;
+    rec.b0 = y;
+    rec.b1 = z;
+    return true;
+}
+
+void yz_rect::resolve_hit(const ray& r, hit_record& rec) const
+{
+    rec.u = (rec.b0 - y0) / (y1 - y0);
+    rec.v = (rec.b1 - z0) / (z1 - z0);
     auto outward_normal = glm::vec3(1, 0, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
-    return true;
+    rec.mat_ptr = mp.get();
+    rec.p = r.at(rec.t);
 }
 
 #endif
\ No newline at end of file
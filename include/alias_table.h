@@ -0,0 +1,117 @@
+#ifndef ALIAS_TABLE_H
+#define ALIAS_TABLE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "common.h"
+
+// Picks index i with probability weights[i] / sum(weights) in constant time (Vose's alias
+// method). Every bin gets an equal share of the probability and holds its own index with
+// probability threshold, the index of one heavier entry otherwise.
+class alias_table
+{
+public:
+    alias_table() : total(0.f) {}
+    explicit alias_table(const std::vector<float>& weights);
+
+    bool empty() const { return pmfs.empty(); }
+    size_t size() const { return pmfs.size(); }
+
+    // Index for u in [0, 1), with the probability of picking it.
+    uint32_t sample(float u, float& pmf) const;
+
+    // Same, also returning where u fell within the choice as a fresh number in [0, 1), for
+    // continuous sampling within the picked entry.
+    uint32_t sample(float u, float& pmf, float& remapped) const;
+
+    float pmf(uint32_t i) const { return pmfs[i]; }
+
+public:
+    std::vector<float> threshold;
+    std::vector<uint32_t> alias;
+    std::vector<float> pmfs;
+    float total;
+};
+
+alias_table::alias_table(const std::vector<float>& weights)
+    : total(0.f)
+{
+    const size_t count = weights.size();
+    double sum = 0.0;
+    for (float w : weights)
+        sum += w > 0.f ? w : 0.f;
+    total = static_cast<float>(sum);
+    if (count == 0)
+        return;
+
+    threshold.assign(count, 1.f);
+    alias.resize(count);
+    pmfs.resize(count);
+    for (size_t i = 0; i < count; ++i)
+        alias[i] = static_cast<uint32_t>(i);
+
+    // All zero weights fall back to picking uniformly.
+    std::vector<double> scaled(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const double w = sum > 0.0 ? (weights[i] > 0.f ? weights[i] : 0.f) / sum : 1.0 / count;
+        pmfs[i] = static_cast<float>(w);
+        scaled[i] = w * count;
+    }
+
+    // Entries below and above an equal share, named so <windows.h>'s small macro cannot hit them.
+    std::vector<uint32_t> under, over;
+    for (size_t i = 0; i < count; ++i)
+        (scaled[i] < 1.0 ? under : over).push_back(static_cast<uint32_t>(i));
+
+    while (!under.empty() && !over.empty())
+    {
+        const uint32_t s = under.back();
+        under.pop_back();
+        const uint32_t l = over.back();
+
+        threshold[s] = static_cast<float>(scaled[s]);
+        alias[s] = l;
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0)
+        {
+            over.pop_back();
+            under.push_back(l);
+        }
+    }
+    // Whatever is left is one up to rounding and keeps its own index.
+}
+
+uint32_t alias_table::sample(float u, float& pmf) const
+{
+    float remapped;
+    return sample(u, pmf, remapped);
+}
+
+uint32_t alias_table::sample(float u, float& pmf, float& remapped) const
+{
+    const float scaled = u * pmfs.size();
+    uint32_t i = static_cast<uint32_t>(scaled);
+    if (i >= pmfs.size())
+        i = static_cast<uint32_t>(pmfs.size() - 1);
+
+    const float t = threshold[i];
+    const float fraction = scaled - i;
+    uint32_t picked;
+    if (fraction < t)
+    {
+        picked = i;
+        remapped = fraction / t;
+    }
+    else
+    {
+        picked = alias[i];
+        remapped = (fraction - t) / (1.f - t);
+    }
+    remapped = remapped < one_minus_epsilon ? remapped : one_minus_epsilon;
+    pmf = pmfs[picked];
+    return picked;
+}
+
+#endif
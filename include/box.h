@@ -13,6 +13,10 @@ public:
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
 
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override {
+        return sides.occluded(r, t_min, t_max);
+    }
+
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override {
         output_box = aabb(box_min, box_max);
         return true;
@@ -3,118 +3,935 @@
 
 #include "common.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
 #include "hittable.h"
 #include "hittable_list.h"
+#include "morton.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+enum class bvh_builder
+{
+    sah, // split planes picked with the surface area heuristic over centroid bins, for final frames
+    lbvh // primitives sorted by the Morton codes of their centroids and split where the codes
+         // differ first, several times faster to build but with somewhat worse trees, for previews
+};
+
+const char* const bvh_builder_names[] = { "sah", "lbvh" };
+
+inline bool parse_bvh_builder(const std::string& name, bvh_builder& builder)
+{
+    for (int i = 0; i < 2; ++i)
+    {
+        if (name == bvh_builder_names[i])
+        {
+            builder = static_cast<bvh_builder>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Costs are relative: a node with n primitives costs intersection_cost * n as a leaf,
+// or traversal_cost + intersection_cost * (nL * A(L) + nR * A(R)) / A(node) when split.
+struct bvh_build_options
+{
+    bvh_builder builder = bvh_builder::sah;
+    int bin_count = 16;
+    int max_leaf_size = 4;
+    float traversal_cost = 1.f;
+    float intersection_cost = 1.f;
+
+    // lbvh: code length, 30 or 63 bits. The longer codes still separate primitives in dense
+    // regions of large scenes, at twice the sort passes.
+    int morton_bits = 30;
+
+    // Rounds of treelet restructuring after the build: every node's treelet of up to
+    // bvh_treelet_size subtrees is rearranged into the shape with the least SAH cost.
+    // Recovers about half of the SAH cost the lbvh builder gives up.
+    int treelet_rounds = 0;
+
+    // Builds large trees on this pool when set, with the same result as without it.
+    thread_pool* pool = nullptr;
+};
+
+const int bvh_max_bins = 64;
+
+// With a pool, ranges of at least bvh_parallel_prims primitives are bounded and binned in
+// chunks of bvh_parallel_grain on the pool, and the subtrees below them are built as tasks.
+const size_t bvh_parallel_prims = 1 << 16;
+const size_t bvh_parallel_grain = 1 << 14;
+
+const int bvh_treelet_size = 7;
+
+// Stack of nodes still to visit in a traversal. The fixed storage holds the stack of any
+// reasonably built tree; a deeper one, from skewed centroids, long runs of equal Morton codes,
+// restructured treelets or a scene cache written elsewhere, moves the stack to the heap
+// instead of writing past the end.
+template <class T, int N>
+class traversal_stack
+{
+public:
+    traversal_stack() : data(local), size(0), capacity(N) {}
+    traversal_stack(const traversal_stack&) = delete;
+    traversal_stack& operator=(const traversal_stack&) = delete;
+
+    bool empty() const { return size == 0; }
+
+    void push(const T& entry)
+    {
+        if (size == capacity)
+            grow();
+        data[size++] = entry;
+    }
+
+    T pop() { return data[--size]; }
 
+    T& operator[](int i) { return data[i]; }
+
+public:
+    T* data;
+    int size;
+
+private:
+    void grow()
+    {
+        std::vector<T> larger(data, data + size);
+        larger.resize(static_cast<size_t>(capacity) * 2);
+        heap.swap(larger);
+        data = heap.data();
+        capacity *= 2;
+    }
+
+    int capacity;
+    T local[N];
+    std::vector<T> heap;
+};
+
+// Bounds of one primitive as seen by the builder, so meshes can be built without a hittable per triangle.
+// The builder partitions an array of these in place; index is the primitive's position in the source list.
+struct bvh_primitive
+{
+    aabb box;
+    glm::vec3 centroid;
+    uint32_t index;
+};
 
 class bvh_node : public hittable
 {
 public:
-    bvh_node();
+    bvh_node() : first_object(0), object_count(0), split_axis(0), cost(0.f), built_cost(0.f) {}
 
-    bvh_node(const hittable_list& list, float time0, float time1)
-        : bvh_node(list.objects, 0, list.objects.size(), time0, time1)
-    {}
+    bvh_node(const hittable_list& list, float time0, float time1, const bvh_build_options& options = bvh_build_options());
 
-    bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end, float time0, float time1);
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override;
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
 
-    inline bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis)
+    // Builds the subtree over prims[start, end), partitioning that range in place.
+    // Leaves refer to their primitives by position in the final order of prims.
+    // With options.pool the calling thread must not be one of the pool's workers.
+    void build(std::vector<bvh_primitive>& prims, size_t start, size_t end,
+        const bvh_build_options& options, const shared_ptr<const std::vector<shared_ptr<hittable>>>& ordered_objects);
+
+    bool is_leaf() const { return !left; }
+
+    // Recomputes the boxes bottom up from the current object bounds, after objects moved,
+    // and the SAH cost with them. The tree keeps its shape, so the cost only grows as
+    // moving objects make the old partition worse.
+    void refit(float time0, float time1, const bvh_build_options& options = bvh_build_options());
+
+    // Recomputes cost from the children's boxes and costs.
+    void update_cost(const bvh_build_options& options);
+
+private:
+    typedef std::vector<std::function<void()>> task_list;
+
+    // Bounds of a range of primitives and of their centroids.
+    struct range_bounds
+    {
+        aabb box = empty_box();
+        aabb centroid_box = empty_box();
+
+        void add(const bvh_primitive& prim)
+        {
+            box.expand(prim.box);
+            centroid_box.expand(prim.centroid);
+        }
+
+        void add(const range_bounds& other)
+        {
+            box.expand(other.box);
+            centroid_box.expand(other.centroid_box);
+        }
+    };
+
+    // Plane of a binned SAH split: after bin of bin_count bins of scale per unit along axis,
+    // from the lower side of the centroid bounds. axis is -1 when no plane separates centroids.
+    struct bin_split
     {
-        aabb box_a;
-        aabb box_b;
+        int axis;
+        int bin;
+        int bin_count;
+        float scale;
+        float cost;
+    };
+
+    // Bins prims[start, end), whose bounds are range, on all three axes and sweeps the bins for
+    // the split with the least SAH cost. Bins chunks of the range on the pool if given.
+    static bin_split find_split(const std::vector<bvh_primitive>& prims, size_t start, size_t end,
+        const range_bounds& range, const bvh_build_options& options, thread_pool* pool);
+
+    // Splits the node and builds its children. Given deferred, subtrees under
+    // bvh_parallel_prims are left there as tasks and larger nodes use the pool for their
+    // passes over the range; their boxes and costs are set by finish_top_levels once the tasks ran.
+    // bounds, if known, are those of prims[start, end), the parent finds them while it partitions.
+    void build_range(std::vector<bvh_primitive>& prims, size_t start, size_t end, const bvh_build_options& options,
+        const shared_ptr<const std::vector<shared_ptr<hittable>>>& ordered_objects, task_list* deferred,
+        const range_bounds* bounds = nullptr);
+
+    // Builds the subtree over prims[start, end) sorted by Morton code, codes[i] being the code
+    // of prims[start + i]. Defers subtrees like build_range.
+    void emit_lbvh(const std::vector<bvh_primitive>& prims, size_t start, size_t end, const uint64_t* codes,
+        const bvh_build_options& options, const shared_ptr<const std::vector<shared_ptr<hittable>>>& ordered_objects,
+        task_list* deferred);
+
+    void finish_top_levels(const bvh_build_options& options);
 
-        if (!a->bounding_box(0, 0, box_a) || !b->bounding_box(0, 0, box_b))
+    // One round of treelet restructuring, bottom up. Given deferred, subtrees under
+    // bvh_parallel_prims are left there as tasks and restructure_top_levels finishes the rest.
+    void restructure_treelets(const bvh_build_options& options, task_list* deferred);
+    void restructure_top_levels(const bvh_build_options& options);
+    void optimize_treelet(const bvh_build_options& options);
+
+    // Moves the primitives of every leaf so the leaves cover prims[start, end) in depth first
+    // order again, after restructuring broke up the ranges of interior nodes.
+    void relayout(std::vector<bvh_primitive>& prims, size_t start, size_t end);
+    void assign_ranges(const std::vector<bvh_primitive>& prims, std::vector<bvh_primitive>& ordered, size_t start, size_t& next);
+
+public:
+    shared_ptr<bvh_node> left;
+    shared_ptr<bvh_node> right;
+    aabb box;
+
+    // Every node covers (*objects)[first_object, first_object + object_count), leaves test them.
+    shared_ptr<const std::vector<shared_ptr<hittable>>> objects;
+    uint32_t first_object;
+    uint32_t object_count;
+
+    // Axis the children were partitioned along, left holds the lower centroids.
+    int split_axis;
+
+    // Expected cost of a ray that enters the node, in the terms of bvh_build_options:
+    // intersection_cost * n for a leaf, traversal_cost plus the children's costs weighted
+    // by their share of the node's area otherwise. built_cost is the cost when the subtree
+    // was built, refit() updates cost.
+    float cost;
+    float built_cost;
+};
+
+bvh_node::bvh_node(const hittable_list& list, float time0, float time1, const bvh_build_options& options)
+    : first_object(0), object_count(0), split_axis(0)
+{
+    const size_t count = list.objects.size();
+
+    std::vector<bvh_primitive> prims(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!list.objects[i]->bounding_box(time0, time1, prims[i].box))
             std::cerr << "No bounding box in bvh_node constructor.\n";
+        prims[i].centroid = prims[i].box.centroid();
+        prims[i].index = static_cast<uint32_t>(i);
+    }
+
+    auto ordered = make_shared<std::vector<shared_ptr<hittable>>>();
+    build(prims, 0, count, options, ordered);
+
+    ordered->reserve(count);
+    for (const auto& prim : prims)
+        ordered->push_back(list.objects[prim.index]);
+}
+
+// Sorts prims[start, end) by the Morton codes of their centroids, quantized in cubic cells
+// over the range's centroid bounds, and returns the sorted codes.
+void sort_by_morton_code(std::vector<bvh_primitive>& prims, size_t start, size_t end, int bits, thread_pool* pool,
+    std::vector<uint64_t>& codes)
+{
+    const size_t count = end - start;
+    std::vector<aabb> chunk_bounds(parallel_chunk_count(start, end, bvh_parallel_grain), empty_box());
+    parallel_for(pool, start, end, bvh_parallel_grain, [&](size_t chunk, size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i)
+            chunk_bounds[chunk].expand(prims[i].centroid);
+    });
+    aabb bounds = empty_box();
+    for (const aabb& b : chunk_bounds)
+        bounds.expand(b);
+
+    const glm::vec3 extent = bounds.maximum - bounds.minimum;
+    const float largest = std::max(extent.x, std::max(extent.y, extent.z));
+    const float scale = largest > 0.f ? 1.f / largest : 0.f;
+
+    std::vector<morton_key> keys(count);
+    parallel_for(pool, start, end, bvh_parallel_grain, [&](size_t, size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i)
+        {
+            keys[i - start].code = morton_code((prims[i].centroid - bounds.minimum) * scale, bits);
+            keys[i - start].index = static_cast<uint32_t>(i);
+        }
+    });
+    radix_sort(keys, bits, pool);
+
+    std::vector<bvh_primitive> sorted(count);
+    codes.resize(count);
+    parallel_for(pool, 0, count, bvh_parallel_grain, [&](size_t, size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i)
+        {
+            sorted[i] = prims[keys[i].index];
+            codes[i] = keys[i].code;
+        }
+    });
+    std::copy(sorted.begin(), sorted.end(), prims.begin() + start);
+}
+
+void bvh_node::build(std::vector<bvh_primitive>& prims, size_t start, size_t end,
+    const bvh_build_options& options, const shared_ptr<const std::vector<shared_ptr<hittable>>>& ordered_objects)
+{
+    // With a pool, the top levels are split on this thread, each with parallel passes over its
+    // range. The subtrees below them cover disjoint parts of prims, so they are built as
+    // independent tasks. Chunks do not depend on the thread count and their results merge
+    // exactly, so neither does the tree.
+    thread_pool* pool = end - start >= bvh_parallel_prims ? options.pool : nullptr;
+    task_list subtrees;
+    task_list* deferred = pool ? &subtrees : nullptr;
+    auto run_deferred = [&]()
+    {
+        if (!pool)
+            return;
+        for (auto& task : subtrees)
+            pool->submit(std::move(task));
+        pool->wait();
+        subtrees.clear();
+    };
 
-        return box_a.min().e[axis] < box_b.min().e[axis];
+    std::vector<uint64_t> codes;
+    if (options.builder == bvh_builder::lbvh)
+    {
+        sort_by_morton_code(prims, start, end, options.morton_bits == 63 ? 63 : 30, pool, codes);
+        emit_lbvh(prims, start, end, codes.data(), options, ordered_objects, deferred);
     }
+    else
+        build_range(prims, start, end, options, ordered_objects, deferred);
+    run_deferred();
+    if (pool)
+        finish_top_levels(options);
 
-    bool box_x_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
+    if (options.treelet_rounds <= 0)
+        return;
+    for (int round = 0; round < options.treelet_rounds; ++round)
     {
-        return box_compare(a, b, 0);
+        restructure_treelets(options, deferred);
+        run_deferred();
+        if (pool)
+            restructure_top_levels(options);
     }
+    relayout(prims, start, end);
+}
+
+// Kept out of build_range so the bins, several kilobytes, are not on the stack of every
+// level of the recursion.
+bvh_node::bin_split bvh_node::find_split(const std::vector<bvh_primitive>& prims, size_t start, size_t end,
+    const range_bounds& range, const bvh_build_options& options, thread_pool* pool)
+{
+    const aabb& centroid_box = range.centroid_box;
+    const uint32_t object_count = static_cast<uint32_t>(end - start);
+    const bool parallel = pool != nullptr;
+
+    // Small ranges get one bin per primitive at most, the per-node cost is dominated by the sweep there.
+    const int bin_count = std::max(2, std::min({ options.bin_count, bvh_max_bins, static_cast<int>(object_count) }));
+    const float inv_area = 1.f / std::max(range.box.surface_area(), 1e-12f);
+
+    float best_cost = infinity;
+    int best_axis = -1;
+    int best_split = 0;
 
-    bool box_y_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
+    // Bin all three axes in one streaming pass over the range.
+    float scale[3];
+    for (int axis = 0; axis < 3; ++axis)
     {
-        return box_compare(a, b, 1);
+        const float extent = centroid_box.maximum[axis] - centroid_box.minimum[axis];
+        scale[axis] = extent > 0.f ? bin_count / extent : 0.f;
     }
 
-    bool box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
+    // Bin bounds padded to four floats, so under SSE growing one is a single min and max.
+    // The fourth lane picks up whatever follows the corner in bvh_primitive and is never read.
+    struct alignas(16) bin
+    {
+        float minimum[4];
+        float maximum[4];
+    };
+
+    struct bin_set
+    {
+        bin bins[3][bvh_max_bins];
+        uint32_t counts[3][bvh_max_bins];
+
+        explicit bin_set(int bin_count)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                for (int b = 0; b < bin_count; ++b)
+                {
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        bins[axis][b].minimum[k] = infinity;
+                        bins[axis][b].maximum[k] = -infinity;
+                    }
+                    counts[axis][b] = 0;
+                }
+            }
+        }
+
+        void expand(int axis, int b, const float* minimum, const float* maximum)
+        {
+            bin& into = bins[axis][b];
+#if defined(RT_X86)
+            // Operands in this order keep expand()'s choice of the bin's value when a corner is NaN.
+            _mm_store_ps(into.minimum, _mm_min_ps(_mm_loadu_ps(minimum), _mm_load_ps(into.minimum)));
+            _mm_store_ps(into.maximum, _mm_max_ps(_mm_loadu_ps(maximum), _mm_load_ps(into.maximum)));
+#else
+            for (int k = 0; k < 3; ++k)
+            {
+                into.minimum[k] = minimum[k] < into.minimum[k] ? minimum[k] : into.minimum[k];
+                into.maximum[k] = maximum[k] > into.maximum[k] ? maximum[k] : into.maximum[k];
+            }
+#endif
+        }
+
+        aabb box(int axis, int b) const
+        {
+            const bin& from = bins[axis][b];
+            return aabb(glm::vec3(from.minimum[0], from.minimum[1], from.minimum[2]),
+                glm::vec3(from.maximum[0], from.maximum[1], from.maximum[2]));
+        }
+    };
+
+    float origin[3];
+    for (int axis = 0; axis < 3; ++axis)
+        origin[axis] = centroid_box.minimum[axis];
+    const int last_bin = bin_count - 1;
+
+    auto add_prims = [&](bin_set& set, size_t first, size_t last)
     {
-        return box_compare(a, b, 2);
+        for (size_t i = first; i < last; ++i)
+        {
+            const bvh_primitive& prim = prims[i];
+            // Reads 16 bytes from each corner, the fourth float is still inside bvh_primitive.
+            const float* minimum = &prim.box.minimum.x;
+            const float* maximum = &prim.box.maximum.x;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                const int b = std::min(last_bin, static_cast<int>((prim.centroid[axis] - origin[axis]) * scale[axis]));
+                set.expand(axis, b, minimum, maximum);
+                set.counts[axis][b]++;
+            }
+        }
+    };
+
+    bin_set binned(bin_count);
+    if (parallel)
+    {
+        std::vector<bin_set> chunks(parallel_chunk_count(start, end, bvh_parallel_grain), bin_set(bin_count));
+        parallel_for(*pool, start, end, bvh_parallel_grain, [&](size_t chunk, size_t first, size_t last) {
+            add_prims(chunks[chunk], first, last);
+        });
+        for (const bin_set& chunk : chunks)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                for (int b = 0; b < bin_count; ++b)
+                {
+                    binned.expand(axis, b, chunk.bins[axis][b].minimum, chunk.bins[axis][b].maximum);
+                    binned.counts[axis][b] += chunk.counts[axis][b];
+                }
+            }
+        }
     }
+    else
+        add_prims(binned, start, end);
 
-public:
-    shared_ptr<hittable> left;
-    shared_ptr<hittable> right;
-    aabb box;
-};
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (scale[axis] == 0.f)
+            continue;
+
+        // Sweep right to left for the area and count on the right of every plane.
+        float right_area[bvh_max_bins];
+        uint32_t right_count[bvh_max_bins];
+        aabb right_box = empty_box();
+        uint32_t right_total = 0;
+        for (int b = bin_count - 1; b > 0; --b)
+        {
+            right_box.expand(binned.box(axis, b));
+            right_total += binned.counts[axis][b];
+            right_area[b - 1] = right_total ? right_box.surface_area() : 0.f;
+            right_count[b - 1] = right_total;
+        }
+
+        aabb left_box = empty_box();
+        uint32_t left_total = 0;
+        for (int b = 0; b < bin_count - 1; ++b)
+        {
+            left_box.expand(binned.box(axis, b));
+            left_total += binned.counts[axis][b];
+            if (left_total == 0 || right_count[b] == 0)
+                continue;
+
+            float cost = options.traversal_cost + options.intersection_cost * inv_area
+                * (left_total * left_box.surface_area() + right_count[b] * right_area[b]);
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = b;
+            }
+        }
+    }
+
+    bin_split split;
+    split.axis = best_axis;
+    split.bin = best_split;
+    split.bin_count = bin_count;
+    split.scale = best_axis < 0 ? 0.f : scale[best_axis];
+    split.cost = best_cost;
+    return split;
+}
+
+void bvh_node::build_range(std::vector<bvh_primitive>& prims, size_t start, size_t end, const bvh_build_options& options,
+    const shared_ptr<const std::vector<shared_ptr<hittable>>>& ordered_objects, task_list* deferred,
+    const range_bounds* bounds)
+{
+    objects = ordered_objects;
+    first_object = static_cast<uint32_t>(start);
+    object_count = static_cast<uint32_t>(end - start);
+    left.reset();
+    right.reset();
+
+    if (deferred && object_count < bvh_parallel_prims)
+    {
+        const range_bounds known = bounds ? *bounds : range_bounds();
+        const bool have_bounds = bounds != nullptr;
+        deferred->push_back([this, &prims, start, end, &options, ordered_objects, known, have_bounds] {
+            build_range(prims, start, end, options, ordered_objects, nullptr, have_bounds ? &known : nullptr);
+        });
+        return;
+    }
+    const bool parallel = deferred != nullptr;
+
+    range_bounds range;
+    if (bounds)
+        range = *bounds;
+    else if (parallel)
+    {
+        std::vector<range_bounds> chunks(parallel_chunk_count(start, end, bvh_parallel_grain));
+        parallel_for(*options.pool, start, end, bvh_parallel_grain, [&](size_t chunk, size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i)
+                chunks[chunk].add(prims[i]);
+        });
+        for (const range_bounds& chunk : chunks)
+            range.add(chunk);
+    }
+    else
+    {
+        for (size_t i = start; i < end; ++i)
+            range.add(prims[i]);
+    }
+
+    box = range.box;
+    const aabb& centroid_box = range.centroid_box;
+    cost = built_cost = options.intersection_cost * object_count;
+
+    if (object_count <= 1)
+        return;
+
+    const bin_split split = find_split(prims, start, end, range, options, parallel ? options.pool : nullptr);
+    const int best_axis = split.axis;
+    const float best_cost = split.cost;
+
+    const float leaf_cost = options.intersection_cost * object_count;
+    if (object_count <= static_cast<uint32_t>(options.max_leaf_size) && (best_axis < 0 || leaf_cost <= best_cost))
+        return;
+
+    size_t mid;
+    range_bounds left_bounds, right_bounds;
+    const bool split_bounds = best_axis >= 0;
+    if (best_axis < 0)
+    {
+        // Every centroid coincides, no plane separates them; halve the range to respect the leaf size.
+        mid = start + object_count / 2;
+    }
+    else
+    {
+        // Partitions like std::partition, swapping from both ends, and bounds both sides on
+        // the way so the children need no pass of their own for it.
+        const float lo = centroid_box.minimum[best_axis];
+        auto goes_left = [&](const bvh_primitive& prim) {
+            int b = std::min(split.bin_count - 1, static_cast<int>((prim.centroid[best_axis] - lo) * split.scale));
+            return b <= split.bin;
+        };
+        size_t first = start;
+        size_t last = end;
+        while (true)
+        {
+            while (first < last && goes_left(prims[first]))
+                left_bounds.add(prims[first++]);
+            while (first < last && !goes_left(prims[last - 1]))
+                right_bounds.add(prims[--last]);
+            if (first == last)
+                break;
+            std::swap(prims[first], prims[last - 1]);
+            left_bounds.add(prims[first++]);
+            right_bounds.add(prims[--last]);
+        }
+        mid = first;
+    }
+
+    split_axis = best_axis < 0 ? 0 : best_axis;
+    left = make_shared<bvh_node>();
+    right = make_shared<bvh_node>();
+    left->build_range(prims, start, mid, options, ordered_objects, deferred, split_bounds ? &left_bounds : nullptr);
+    right->build_range(prims, mid, end, options, ordered_objects, deferred, split_bounds ? &right_bounds : nullptr);
+
+    if (parallel)
+        return;
+    update_cost(options);
+    built_cost = cost;
+}
+
+void bvh_node::emit_lbvh(const std::vector<bvh_primitive>& prims, size_t start, size_t end, const uint64_t* codes,
+    const bvh_build_options& options, const shared_ptr<const std::vector<shared_ptr<hittable>>>& ordered_objects,
+    task_list* deferred)
+{
+    objects = ordered_objects;
+    first_object = static_cast<uint32_t>(start);
+    object_count = static_cast<uint32_t>(end - start);
+    left.reset();
+    right.reset();
+    split_axis = 0;
+
+    if (deferred && object_count < bvh_parallel_prims)
+    {
+        deferred->push_back([this, &prims, start, end, codes, &options, ordered_objects] {
+            emit_lbvh(prims, start, end, codes, options, ordered_objects, nullptr);
+        });
+        return;
+    }
+
+    if (object_count <= static_cast<uint32_t>(std::max(options.max_leaf_size, 1)))
+    {
+        box = empty_box();
+        for (size_t i = start; i < end; ++i)
+            box.expand(prims[i].box);
+        cost = built_cost = options.intersection_cost * object_count;
+        return;
+    }
+
+    // The range splits at the highest bit where its first and last codes differ. The codes
+    // are sorted and share the bits above it, so the ones with that bit clear come first.
+    // Runs of equal codes are halved.
+    const uint64_t differ = codes[0] ^ codes[object_count - 1];
+    size_t mid = start + object_count / 2;
+    if (differ != 0)
+    {
+        int bit = 63;
+        while (!((differ >> bit) & 1))
+            --bit;
+        const uint64_t mask = uint64_t(1) << bit;
+        mid = start + static_cast<size_t>(std::partition_point(codes, codes + object_count,
+            [mask](uint64_t code) { return (code & mask) == 0; }) - codes);
+        split_axis = morton_bit_axis(bit);
+    }
+
+    left = make_shared<bvh_node>();
+    right = make_shared<bvh_node>();
+    left->emit_lbvh(prims, start, mid, codes, options, ordered_objects, deferred);
+    right->emit_lbvh(prims, mid, end, codes + (mid - start), options, ordered_objects, deferred);
+
+    if (deferred)
+        return;
+    box = surrounding_box(left->box, right->box);
+    update_cost(options);
+    built_cost = cost;
+}
+
+void bvh_node::finish_top_levels(const bvh_build_options& options)
+{
+    if (object_count < bvh_parallel_prims || is_leaf())
+        return;
+
+    left->finish_top_levels(options);
+    right->finish_top_levels(options);
+    box = surrounding_box(left->box, right->box);
+    update_cost(options);
+    built_cost = cost;
+}
+
+void bvh_node::restructure_treelets(const bvh_build_options& options, task_list* deferred)
+{
+    if (is_leaf())
+        return;
+
+    if (deferred && object_count < bvh_parallel_prims)
+    {
+        deferred->push_back([this, &options] { restructure_treelets(options, nullptr); });
+        return;
+    }
 
-bvh_node::bvh_node(std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end, float time0, float time1)
+    left->restructure_treelets(options, deferred);
+    right->restructure_treelets(options, deferred);
+    if (!deferred)
+        optimize_treelet(options);
+}
+
+void bvh_node::restructure_top_levels(const bvh_build_options& options)
 {
-    auto objects = src_objects; // Create a modifiable array of the source scene objects
+    if (object_count < bvh_parallel_prims || is_leaf())
+        return;
 
-    int axis = random_int(0, 2);
-    auto comparator = (axis == 0) ? box_x_compare
-        : (axis == 1) ? box_y_compare
-        : box_z_compare;
+    left->restructure_top_levels(options);
+    right->restructure_top_levels(options);
+    optimize_treelet(options);
+}
 
-    size_t object_span = end - start;
+// Grows a treelet from the children by repeatedly opening the subtree with the largest area,
+// then finds the binary tree over its subtrees with the least SAH cost by going through every
+// subset of them, smallest first, and every way to split it in two. In area weighted terms a
+// subset costs traversal_cost * A(subset) plus the costs of its two halves. With up to 7
+// subtrees that is about a thousand splits, and the treelet's interior nodes are reused.
+void bvh_node::optimize_treelet(const bvh_build_options& options)
+{
+    if (is_leaf())
+        return;
 
-    if (object_span == 1)
+    shared_ptr<bvh_node> leaves[bvh_treelet_size] = { left, right };
+    shared_ptr<bvh_node> interior[bvh_treelet_size];
+    int leaf_count = 2;
+    int interior_count = 0;
+    while (leaf_count < bvh_treelet_size)
     {
-        left = right = objects[start];
+        int open = -1;
+        float open_area = -1.f;
+        for (int i = 0; i < leaf_count; ++i)
+        {
+            const float area = leaves[i]->box.surface_area();
+            if (!leaves[i]->is_leaf() && area > open_area)
+            {
+                open = i;
+                open_area = area;
+            }
+        }
+        if (open < 0)
+            break;
+        interior[interior_count++] = leaves[open];
+        leaves[leaf_count++] = leaves[open]->right;
+        leaves[open] = leaves[open]->left;
     }
-    else if (object_span == 2)
+
+    // Sets up node over its two children, ordered so left holds the lower ones.
+    auto link = [&](bvh_node& node)
     {
-        if (comparator(objects[start], objects[start + 1]))
+        node.box = surrounding_box(node.left->box, node.right->box);
+        node.object_count = node.left->object_count + node.right->object_count;
+        const glm::vec3 offset = node.right->box.centroid() - node.left->box.centroid();
+        const glm::vec3 distance = glm::abs(offset);
+        node.split_axis = distance.x >= distance.y && distance.x >= distance.z ? 0 : (distance.y >= distance.z ? 1 : 2);
+        if (offset[node.split_axis] < 0.f)
+            std::swap(node.left, node.right);
+        node.update_cost(options);
+        node.built_cost = node.cost;
+    };
+
+    const int full = (1 << leaf_count) - 1;
+    aabb subset_box[1 << bvh_treelet_size];
+    float subset_cost[1 << bvh_treelet_size];
+    int subset_split[1 << bvh_treelet_size];
+    int leaf_index[1 << bvh_treelet_size];
+    for (int set = 1; set <= full; ++set)
+    {
+        const int lowest = set & -set;
+        if (set == lowest)
         {
-            left = objects[start];
-            right = objects[start + 1];
+            int i = 0;
+            while ((1 << i) != set)
+                ++i;
+            leaf_index[set] = i;
+            subset_box[set] = leaves[i]->box;
+            subset_cost[set] = leaves[i]->box.surface_area() * leaves[i]->cost;
+            continue;
         }
-        else 
+
+        subset_box[set] = subset_box[set ^ lowest];
+        subset_box[set].expand(subset_box[lowest]);
+
+        // Each split once: the part holding the lowest subtree goes left.
+        float best = infinity;
+        int best_part = lowest;
+        const int rest = set ^ lowest;
+        for (int others = (rest - 1) & rest; ; others = (others - 1) & rest)
         {
-            left = objects[start + 1];
-            right = objects[start];
+            const int part = lowest | others;
+            const float split_cost = subset_cost[part] + subset_cost[set ^ part];
+            const bool better = split_cost < best;
+            best = better ? split_cost : best;
+            best_part = better ? part : best_part;
+            if (others == 0)
+                break;
         }
+        subset_split[set] = best_part;
+        subset_cost[set] = options.traversal_cost * subset_box[set].surface_area() + best;
     }
-    else 
+
+    const float current = options.traversal_cost * box.surface_area()
+        + left->box.surface_area() * left->cost + right->box.surface_area() * right->cost;
+    if (leaf_count < 3 || !(subset_cost[full] < current * (1.f - 1e-5f)))
     {
-        std::sort(objects.begin() + start, objects.begin() + end, comparator);
+        update_cost(options);
+        built_cost = cost;
+        return;
+    }
+
+    auto assemble = [&](auto& self, bvh_node& node, int set) -> void
+    {
+        const int parts[2] = { subset_split[set], set ^ subset_split[set] };
+        shared_ptr<bvh_node> children[2];
+        for (int k = 0; k < 2; ++k)
+        {
+            if ((parts[k] & (parts[k] - 1)) == 0)
+                children[k] = leaves[leaf_index[parts[k]]];
+            else
+            {
+                children[k] = interior[--interior_count];
+                self(self, *children[k], parts[k]);
+            }
+        }
+        node.left = children[0];
+        node.right = children[1];
+        link(node);
+    };
+    assemble(assemble, *this, full);
+}
+
+void bvh_node::relayout(std::vector<bvh_primitive>& prims, size_t start, size_t end)
+{
+    std::vector<bvh_primitive> ordered(end - start);
+    size_t next = start;
+    assign_ranges(prims, ordered, start, next);
+    std::copy(ordered.begin(), ordered.end(), prims.begin() + start);
+}
 
-        auto mid = start + object_span / 2;
-        left = make_shared<bvh_node>(objects, start, mid, time0, time1);
-        right = make_shared<bvh_node>(objects, mid, end, time0, time1);
+void bvh_node::assign_ranges(const std::vector<bvh_primitive>& prims, std::vector<bvh_primitive>& ordered,
+    size_t start, size_t& next)
+{
+    if (is_leaf())
+    {
+        std::copy_n(prims.begin() + first_object, object_count, ordered.begin() + (next - start));
+        first_object = static_cast<uint32_t>(next);
+        next += object_count;
+        return;
     }
 
-    aabb box_left, box_right;
+    first_object = static_cast<uint32_t>(next);
+    left->assign_ranges(prims, ordered, start, next);
+    right->assign_ranges(prims, ordered, start, next);
+}
 
-    if (!left->bounding_box(time0, time1, box_left)
-        || !right->bounding_box(time0, time1, box_right)
-        )
-        std::cerr << "No bounding box in bvh_node constructor.\n";
+void bvh_node::update_cost(const bvh_build_options& options)
+{
+    if (is_leaf())
+    {
+        cost = options.intersection_cost * object_count;
+        return;
+    }
 
-    box = surrounding_box(box_left, box_right);
+    const float area = box.surface_area();
+    cost = options.traversal_cost;
+    if (area > 0.f)
+        cost += (left->box.surface_area() * left->cost + right->box.surface_area() * right->cost) / area;
 }
 
+void bvh_node::refit(float time0, float time1, const bvh_build_options& options)
+{
+    if (is_leaf())
+    {
+        box = empty_box();
+        for (uint32_t i = first_object; i < first_object + object_count; ++i)
+        {
+            aabb object_box;
+            if ((*objects)[i]->bounding_box(time0, time1, object_box))
+                box.expand(object_box);
+        }
+    }
+    else
+    {
+        left->refit(time0, time1, options);
+        right->refit(time0, time1, options);
+        box = surrounding_box(left->box, right->box);
+    }
+    update_cost(options);
+}
 
-bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+bool bvh_node::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
     if (!box.hit(r, t_min, t_max))
         return false;
 
+    if (is_leaf())
+    {
+        bool hit_anything = false;
+        for (uint32_t i = first_object; i < first_object + object_count; ++i)
+        {
+            if ((*objects)[i]->hit(r, t_min, t_max, rec))
+            {
+                hit_anything = true;
+                t_max = rec.t;
+            }
+        }
+        return hit_anything;
+    }
+
     bool hit_left = left->hit(r, t_min, t_max, rec);
     bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
 
     return hit_left || hit_right;
 }
 
+bool bvh_node::occluded(const ray& r, float t_min, float t_max) const
+{
+    if (!box.hit(r, t_min, t_max))
+        return false;
+
+    if (is_leaf())
+    {
+        for (uint32_t i = first_object; i < first_object + object_count; ++i)
+        {
+            if ((*objects)[i]->occluded(r, t_min, t_max))
+                return true;
+        }
+        return false;
+    }
+
+    return left->occluded(r, t_min, t_max) || right->occluded(r, t_min, t_max);
+}
+
 bool bvh_node::bounding_box(float time0, float time1, aabb& output_box) const
 {
     output_box = box;
     return true;
 }
 
-#endif
\ No newline at end of file
+#endif
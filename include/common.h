@@ -5,6 +5,8 @@
 #include <limits>
 #include <memory>
 
+#include "rng.h"
+#include "sampler.h"
 
 // Usings
 
@@ -16,6 +18,7 @@ using std::sqrt;
 
 const float infinity = std::numeric_limits<float>::infinity();
 const float pi = 3.1415926535897932385f;
+const float one_minus_epsilon = 0x1.fffffep-1f; // largest float below 1
 
 // Utility Functions
 
@@ -23,19 +26,32 @@ inline float degrees_to_radians(float degrees) {
     return degrees * pi / 180.0;
 }
 
-inline float random_float() {
+inline float random_float(pcg32& rng) {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0f);
+    return rng.next_float();
 }
 
-inline float random_float(float min, float max) {
+inline float random_float(pcg32& rng, float min, float max) {
     // Returns a random real in [min,max).
-    return min + (max - min) * random_float();
+    return min + (max - min) * random_float(rng);
 }
 
-inline int random_int(int min, int max) {
+inline int random_int(pcg32& rng, int min, int max) {
     // Returns a random integer in [min,max].
-    return static_cast<int>(random_float(min, max + 1));
+    return min + static_cast<int>(rng.next_uint() % static_cast<uint32_t>(max - min + 1));
+}
+
+inline float random_float() {
+    // Returns a random real in [0,1) from the calling thread's generator.
+    return random_float(thread_rng());
+}
+
+inline float random_float(float min, float max) {
+    return random_float(thread_rng(), min, max);
+}
+
+inline int random_int(int min, int max) {
+    return random_int(thread_rng(), min, max);
 }
 
 inline float clamp(float x, float min, float max) {
@@ -44,6 +60,10 @@ inline float clamp(float x, float min, float max) {
     return x;
 }
 
+inline float luminance(const glm::vec3& c) {
+    return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+}
+
 inline static glm::vec3 random_vec3() {
     return glm::vec3(random_float(), random_float(), random_float());
 }
@@ -52,6 +72,14 @@ inline static glm::vec3 random_vec3(float min, float max) {
     return glm::vec3(random_float(min, max), random_float(min, max), random_float(min, max));
 }
 
+inline static glm::vec3 random_vec3(pcg32& rng, float min, float max) {
+    // Draw in a fixed order, argument evaluation order differs between compilers.
+    auto x = random_float(rng, min, max);
+    auto y = random_float(rng, min, max);
+    auto z = random_float(rng, min, max);
+    return glm::vec3(x, y, z);
+}
+
 glm::vec3 random_in_unit_sphere() {
     while (true) {
         auto p = random_vec3(-1, 1);
@@ -73,8 +101,9 @@ glm::vec3 random_in_hemisphere(const glm::vec3& normal) {
 }
 
 inline glm::vec3 random_cosine_direction(){
-    auto r1 = random_float();
-    auto r2 = random_float();
+    const glm::vec2 r = sample_2d();
+    auto r1 = r.x;
+    auto r2 = r.y;
     auto z = sqrt(1 - r2);
 
     auto phi = 2 * pi * r1;
@@ -23,6 +23,7 @@ public:
 
     virtual bool hit(
         const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual void resolve_hit(const ray& r, hit_record& rec) const override;
 
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override {
         return boundary->bounding_box(time0, time1, output_box);
@@ -61,25 +62,30 @@ bool constant_medium::hit(const ray& r, float t_min, float t_max, hit_record& re
 
     const auto ray_length = r.direction().length();
     const auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
-    const auto hit_distance = neg_inv_density * log(random_float());
+    const auto hit_distance = neg_inv_density * log(sample_1d());
 
     if (hit_distance > distance_inside_boundary)
         return false;
 
     rec.t = rec1.t + hit_distance / ray_length;
-    rec.p = r.at(rec.t);
+    rec.object = this;
 
     if (debugging) {
+        const glm::vec3 p = r.at(rec.t);
         std::cerr << "hit_distance = " << hit_distance << '\n'
             << "rec.t = " << rec.t << '\n'
-            << "rec.p = " << rec.p.x << rec.p.y << rec.p.z << '\n';
+            << "rec.p = " << p.x << p.y << p.z << '\n';
     }
 
+    return true;
+}
+
+void constant_medium::resolve_hit(const ray& r, hit_record& rec) const
+{
+    rec.p = r.at(rec.t);
     rec.normal = glm::vec3(1, 0, 0);  // arbitrary
     rec.front_face = true;     // also arbitrary
-    rec.mat_ptr = phase_function;
-
-    return true;
+    rec.mat_ptr = phase_function.get();
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,163 @@
+#ifndef DYNAMIC_BVH_H
+#define DYNAMIC_BVH_H
+
+#include "common.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "simd.h"
+#include "wide_bvh.h"
+
+// Scene BVH for objects that move between frames, such as animated instances. update()
+// refits the boxes to where the objects are now, a pass over the nodes that costs a small
+// fraction of a build. Refitting keeps the old partition, whose boxes overlap more the
+// further objects drift, so it also watches the SAH cost of every subtree and rebuilds the
+// ones that got more than rebuild_threshold worse than when they were built. Rendering goes
+// through a wide BVH collapsed from the binary tree, which is refitted along with it.
+class dynamic_bvh : public hittable
+{
+public:
+    dynamic_bvh(const hittable_list& list, const bvh_build_options& build_options = bvh_build_options(),
+        simd_level requested = detect_simd_level());
+
+    // Brings the tree up to date with the objects, returns how many objects were in rebuilt
+    // subtrees: 0 after a plain refit, all of them after a full rebuild.
+    size_t update();
+
+    virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override
+    {
+        return tree->hit(r, t_min, t_max, rec);
+    }
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override
+    {
+        return tree->occluded(r, t_min, t_max);
+    }
+    virtual uint32_t hit_packet(const ray_packet& packet, float t_min, hit_record* recs) const override
+    {
+        return tree->hit_packet(packet, t_min, recs);
+    }
+    virtual uint32_t occluded_packet(const ray_packet& packet, float t_min) const override
+    {
+        return tree->occluded_packet(packet, t_min);
+    }
+    virtual bool bounding_box(float time0, float time1, aabb& output_box) const override
+    {
+        return tree->bounding_box(time0, time1, output_box);
+    }
+
+public:
+    float rebuild_threshold = 0.25f;
+    bvh_build_options options;
+    bvh_node root;
+
+private:
+    void rebuild(bvh_node& node);
+    size_t rebuild_degraded(bvh_node& node);
+    void collapse();
+    void refit_tree();
+
+    shared_ptr<std::vector<shared_ptr<hittable>>> objects;
+    std::vector<bvh_primitive> prims; // scratch for rebuilds, one per object
+    simd_level level;
+    shared_ptr<bvh4> tree4;
+    shared_ptr<bvh8> tree8;
+    hittable* tree;
+};
+
+dynamic_bvh::dynamic_bvh(const hittable_list& list, const bvh_build_options& build_options, simd_level requested)
+    : options(build_options), objects(make_shared<std::vector<shared_ptr<hittable>>>(list.objects)),
+    prims(list.objects.size()), level(requested), tree(nullptr)
+{
+    root.first_object = 0;
+    root.object_count = static_cast<uint32_t>(objects->size());
+    rebuild(root);
+    collapse();
+}
+
+size_t dynamic_bvh::update()
+{
+    root.refit(0.f, 1.f, options);
+
+    const size_t rebuilt = rebuild_degraded(root);
+    if (rebuilt > 0)
+        collapse();
+    else
+        refit_tree();
+    return rebuilt;
+}
+
+// Rebuilds the subtree under node from the current object bounds. Its objects are a
+// contiguous range of the ordered list, which gets sorted into the new leaf order.
+void dynamic_bvh::rebuild(bvh_node& node)
+{
+    const size_t start = node.first_object;
+    const size_t end = start + node.object_count;
+    for (size_t i = start; i < end; ++i)
+    {
+        bvh_primitive& prim = prims[i];
+        (*objects)[i]->bounding_box(0.f, 1.f, prim.box);
+        prim.centroid = prim.box.centroid();
+        prim.index = static_cast<uint32_t>(i);
+    }
+
+    node.build(prims, start, end, options, objects);
+
+    std::vector<shared_ptr<hittable>> ordered(end - start);
+    for (size_t i = start; i < end; ++i)
+        ordered[i - start] = (*objects)[prims[i].index];
+    std::move(ordered.begin(), ordered.end(), objects->begin() + start);
+}
+
+// Rebuilds the highest subtrees whose own partition went bad. Where a node degraded only
+// because a child did, rebuilding the child is enough and much cheaper. Healthy nodes are
+// still searched: a small subtree can degrade badly without moving the cost of a large
+// parent, whose other child may dominate its area.
+size_t dynamic_bvh::rebuild_degraded(bvh_node& node)
+{
+    if (node.is_leaf())
+        return 0;
+
+    auto degraded = [&](const bvh_node& n) { return n.cost > n.built_cost * (1.f + rebuild_threshold); };
+    if (degraded(node) && !degraded(*node.left) && !degraded(*node.right))
+    {
+        rebuild(node);
+        return node.object_count;
+    }
+
+    const size_t rebuilt = rebuild_degraded(*node.left) + rebuild_degraded(*node.right);
+    if (rebuilt > 0)
+        node.update_cost(options);
+    return rebuilt;
+}
+
+void dynamic_bvh::collapse()
+{
+    tree4.reset();
+    tree8.reset();
+    if (static_cast<int>(level) > static_cast<int>(detect_simd_level()))
+        level = detect_simd_level();
+
+    if (level == simd_level::avx)
+    {
+        tree8 = make_shared<bvh8>(root, level);
+        tree = tree8.get();
+    }
+    else
+    {
+        tree4 = make_shared<bvh4>(root, level);
+        tree = tree4.get();
+    }
+}
+
+void dynamic_bvh::refit_tree()
+{
+    if (tree8)
+        tree8->refit(0.f, 1.f);
+    else
+        tree4->refit(0.f, 1.f);
+}
+
+#endif
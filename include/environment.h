@@ -0,0 +1,154 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stb_image.h>
+
+#include "common.h"
+#include "alias_table.h"
+
+// Light arriving from infinitely far away in every direction, read from an equirectangular
+// (latitude-longitude) HDR image. Directions map to the image like sphere::get_sphere_uv, so
+// the map wraps around the y axis with its top row straight up.
+//
+// Sampling follows the image: a table over the rows, weighted by their total luminance,
+// picks a row, and a table per row picks a pixel in it, both in constant time. Rows near
+// the poles cover less of the sphere, every pixel's weight is scaled by the sine of its
+// polar angle to match.
+class environment_light
+{
+public:
+    // pixels holds width * height RGB triples, top row first.
+    environment_light(int width, int height, std::vector<float> pixels, float scale = 1.f);
+
+    glm::vec3 radiance(const glm::vec3& direction) const;
+
+    // Samples a direction with u, returns false if the map is black.
+    bool sample(const glm::vec2& u, glm::vec3& direction, float& pdf) const;
+
+    // Solid angle density of sample() for direction.
+    float pdf(const glm::vec3& direction) const;
+
+    // Luminance averaged over all directions, for weighing the map against other lights.
+    float average_luminance() const { return mean_luminance; }
+
+public:
+    int width;
+    int height;
+    std::vector<float> pixels;
+    float scale;
+    alias_table row_table;
+    std::vector<alias_table> column_tables; // one per row
+    float mean_luminance;
+
+private:
+    void pixel_of(const glm::vec3& direction, int& i, int& j) const;
+};
+
+environment_light::environment_light(int width, int height, std::vector<float> pixels, float scale)
+    : width(width), height(height), pixels(std::move(pixels)), scale(scale), mean_luminance(0.f)
+{
+    std::vector<float> row_weights(height);
+    std::vector<float> weights(width);
+    double total = 0.0;
+    for (int j = 0; j < height; ++j)
+    {
+        const float sin_theta = sin(pi * (j + 0.5f) / height);
+        double row = 0.0;
+        for (int i = 0; i < width; ++i)
+        {
+            const float* p = &this->pixels[3 * (static_cast<size_t>(j) * width + i)];
+            weights[i] = scale * luminance(glm::vec3(p[0], p[1], p[2])) * sin_theta;
+            row += weights[i];
+        }
+        column_tables.emplace_back(weights);
+        row_weights[j] = static_cast<float>(row);
+        total += row;
+    }
+    row_table = alias_table(row_weights);
+
+    // The weights integrate luminance over the sphere with pixels of 2 pi / width by
+    // pi / height radians, 2 pi^2 / (width height) steradians times sin theta each.
+    mean_luminance = static_cast<float>(total * 2.0 * pi * pi / (static_cast<double>(width) * height) / (4.0 * pi));
+}
+
+void environment_light::pixel_of(const glm::vec3& direction, int& i, int& j) const
+{
+    const glm::vec3 d = glm::normalize(direction);
+    const float u = (atan2(-d.z, d.x) + pi) / (2 * pi);
+    const float v = acos(glm::clamp(-d.y, -1.f, 1.f)) / pi;
+    i = std::min(static_cast<int>(u * width), width - 1);
+    j = std::min(static_cast<int>((1.f - v) * height), height - 1);
+    i = std::max(i, 0);
+    j = std::max(j, 0);
+}
+
+glm::vec3 environment_light::radiance(const glm::vec3& direction) const
+{
+    int i, j;
+    pixel_of(direction, i, j);
+    const float* p = &pixels[3 * (static_cast<size_t>(j) * width + i)];
+    return scale * glm::vec3(p[0], p[1], p[2]);
+}
+
+bool environment_light::sample(const glm::vec2& u, glm::vec3& direction, float& pdf) const
+{
+    if (row_table.total <= 0.f)
+        return false;
+
+    float row_pmf, column_pmf, row_offset, column_offset;
+    const uint32_t j = row_table.sample(u.y, row_pmf, row_offset);
+    const uint32_t i = column_tables[j].sample(u.x, column_pmf, column_offset);
+
+    // Uniform within the pixel in u and v, which is what the table densities are over.
+    const float theta = pi * (1.f - (j + row_offset) / height);
+    const float phi = 2.f * pi * (i + column_offset) / width;
+    const float sin_theta = sin(theta);
+    if (sin_theta <= 0.f)
+        return false;
+
+    direction = glm::vec3(-sin_theta * cos(phi), -cos(theta), sin_theta * sin(phi));
+    pdf = row_pmf * column_pmf * width * height / (2.f * pi * pi * sin_theta);
+    return true;
+}
+
+float environment_light::pdf(const glm::vec3& direction) const
+{
+    if (row_table.total <= 0.f)
+        return 0.f;
+
+    int i, j;
+    pixel_of(direction, i, j);
+    // From x and z rather than 1 - y^2, which cancels to a few bits in the rows at the poles.
+    const glm::vec3 d = glm::normalize(direction);
+    const float sin_theta = sqrt(d.x * d.x + d.z * d.z);
+    if (sin_theta <= 0.f)
+        return 0.f;
+    return row_table.pmf(j) * column_tables[j].pmf(i) * width * height / (2.f * pi * pi * sin_theta);
+}
+
+// Reads an HDR (or any stb_image format, converted to linear) equirectangular map into out.
+bool load_environment(const std::string& path, float scale, shared_ptr<environment_light>& out)
+{
+    int width = 0, height = 0, components = 0;
+    float* data = stbi_loadf(path.c_str(), &width, &height, &components, 3);
+    if (!data)
+    {
+        std::cerr << "Could not load environment map '" << path << "'\n";
+        return false;
+    }
+
+    std::vector<float> pixels(data, data + static_cast<size_t>(width) * height * 3);
+    stbi_image_free(data);
+    out = make_shared<environment_light>(width, height, std::move(pixels), scale);
+    return true;
+}
+
+#endif
@@ -4,16 +4,37 @@
 #include <glm/glm.hpp>
 
 #include "ray.h"
+#include "ray_packet.h"
 #include "common.h"
 #include "aabb.h"
 
 class material;
+class hittable;
 
+// Surface an object emits light from when its material is emissive, as seen by light
+// sampling. Emission is diffuse and leaves from the side facing each normal.
+struct emitter_surface
+{
+    const material* mat_ptr;
+    aabb box;
+    float area;
+    glm::vec3 axis;  // every normal is within acos(cos_theta) of axis
+    float cos_theta; // -1 when normals point everywhere, as on a sphere
+};
+
+// Traversal only writes t, the object that was hit and two coordinates of the hit on it,
+// since most hits are replaced by closer ones. resolve() then fills in the surface
+// attributes once, for the closest hit.
 struct hit_record {
+    float t;
+    const hittable* object;
+    uint32_t primitive; // which part of object, such as a mesh triangle
+    float b0, b1;       // where on that part, in its own terms
+
+    // Set by resolve().
     glm::vec3 p;
     glm::vec3 normal;
-    shared_ptr<material> mat_ptr;
-    float t;
+    const material* mat_ptr; // owned by the hit object
     float u;
     float v;
     bool front_face;
@@ -23,16 +44,71 @@ struct hit_record {
         front_face = glm::dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
     }
+
+    // r must be the ray the hit was found with.
+    inline void resolve(const ray& r);
 };
 
 class hittable {
 public:
+    // Closest hit in (t_min, t_max). Leaves rec untouched when there is none, so callers can
+    // pass the record of the closest hit so far.
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
+
+    // Fills in the surface attributes of a hit this object recorded. The default is for
+    // objects whose hit() sets them all right away.
+    virtual void resolve_hit(const ray& r, hit_record& rec) const {}
+
+    // Whether anything blocks r in (t_min, t_max), for shadow and visibility tests. Stops at
+    // the first hit found instead of the closest one. Aggregates override it to skip
+    // ordering and stop early; single primitives just test their hit.
+    virtual bool occluded(const ray& r, float t_min, float t_max) const
+    {
+        hit_record rec;
+        return hit(r, t_min, t_max, rec);
+    }
+
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const = 0;
     virtual float pdf_value(const glm::vec3& o, const glm::vec3& v) const { return 0.0; }
     virtual glm::vec3 random(const glm::vec3& o) const { return glm::vec3(1, 0, 0); }
+
+    // Describes the surface of shapes that can be sampled as lights, through pdf_value and
+    // random. Returns false for everything else.
+    virtual bool emitter(emitter_surface& out) const { return false; }
+
+    // Closest hit for every active lane, returns the lanes that hit. Acceleration structures
+    // override this to share node visits between the rays.
+    virtual uint32_t hit_packet(const ray_packet& packet, float t_min, hit_record* recs) const
+    {
+        uint32_t hits = 0;
+        for (int lane = 0; lane < ray_packet_size; ++lane)
+        {
+            if ((packet.active & (1u << lane)) && hit(packet.rays[lane], t_min, packet.t_max[lane], recs[lane]))
+                hits |= 1u << lane;
+        }
+        return hits;
+    }
+
+    // occluded() for every active lane, each up to its own t_max; returns the lanes that are
+    // blocked. Acceleration structures override this to share node visits between the rays,
+    // dropping each lane from the traversal at the first hit it finds.
+    virtual uint32_t occluded_packet(const ray_packet& packet, float t_min) const
+    {
+        uint32_t blocked = 0;
+        for (int lane = 0; lane < ray_packet_size; ++lane)
+        {
+            if ((packet.active & (1u << lane)) && occluded(packet.rays[lane], t_min, packet.t_max[lane]))
+                blocked |= 1u << lane;
+        }
+        return blocked;
+    }
 };
 
+inline void hit_record::resolve(const ray& r)
+{
+    object->resolve_hit(r, *this);
+}
+
 
 class translate : public hittable {
 public:
@@ -42,17 +118,44 @@ public:
     virtual bool hit( const ray& r, float t_min, float t_max, hit_record& rec) const override;
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
 
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override
+    {
+        return ptr->occluded(ray(r.origin() - offset, r.direction(), r.time()), t_min, t_max);
+    }
+
+    virtual float pdf_value(const glm::vec3& o, const glm::vec3& v) const override
+    {
+        return ptr->pdf_value(o - offset, v);
+    }
+
+    virtual glm::vec3 random(const glm::vec3& o) const override
+    {
+        return ptr->random(o - offset);
+    }
+
+    virtual bool emitter(emitter_surface& out) const override
+    {
+        if (!ptr->emitter(out))
+            return false;
+        out.box = aabb(out.box.min() + offset, out.box.max() + offset);
+        return true;
+    }
+
 public:
     shared_ptr<hittable> ptr;
     glm::vec3 offset;
 };
 
+// Wrappers resolve their hits right away, the attributes have to be moved or flipped after
+// the wrapped object has set them.
 bool translate::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
     ray moved_r(r.origin() - offset, r.direction(), r.time());
     if (!ptr->hit(moved_r, t_min, t_max, rec))
         return false;
 
+    rec.resolve(moved_r);
+    rec.object = this;
     rec.p += offset;
     rec.set_face_normal(moved_r, rec.normal);
 
@@ -81,6 +184,8 @@ public:
         if (!ptr->hit(r, t_min, t_max, rec))
             return false;
 
+        rec.resolve(r);
+        rec.object = this;
         rec.front_face = !rec.front_face;
         return true;
     }
@@ -90,6 +195,29 @@ public:
         return ptr->bounding_box(time0, time1, output_box);
     }
 
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override
+    {
+        return ptr->occluded(r, t_min, t_max);
+    }
+
+    virtual float pdf_value(const glm::vec3& o, const glm::vec3& v) const override
+    {
+        return ptr->pdf_value(o, v);
+    }
+
+    virtual glm::vec3 random(const glm::vec3& o) const override
+    {
+        return ptr->random(o);
+    }
+
+    virtual bool emitter(emitter_surface& out) const override
+    {
+        if (!ptr->emitter(out))
+            return false;
+        out.axis = -out.axis;
+        return true;
+    }
+
 public:
     shared_ptr<hittable> ptr;
 };
@@ -22,6 +22,7 @@ public:
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override;
 
 public:
     std::vector<shared_ptr<hittable>> objects;
@@ -29,21 +30,29 @@ public:
 
 bool hittable_list::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
-    hit_record temp_rec;
     bool hit_anything = false;
     auto closest_so_far = t_max;
 
+    // A miss leaves rec alone, so every object can write straight into it.
     for (const auto& object : objects) {
-        if (object->hit(r, t_min, closest_so_far, temp_rec)) {
+        if (object->hit(r, t_min, closest_so_far, rec)) {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
+            closest_so_far = rec.t;
         }
     }
 
     return hit_anything;
 }
 
+bool hittable_list::occluded(const ray& r, float t_min, float t_max) const
+{
+    for (const auto& object : objects) {
+        if (object->occluded(r, t_min, t_max))
+            return true;
+    }
+    return false;
+}
+
 bool hittable_list::bounding_box(float time0, float time1, aabb& output_box) const
 {
     if (objects.empty()) return false;
@@ -0,0 +1,82 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+// Lower case extension of path including the dot, or an empty string.
+inline std::string file_extension(const std::string& path)
+{
+    const size_t dot = path.find_last_of('.');
+    const size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return "";
+
+    std::string ext = path.substr(dot);
+    for (char& c : ext)
+        c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return ext;
+}
+
+inline bool image_format_supported(const std::string& path)
+{
+    const std::string ext = file_extension(path);
+    return ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".bmp" || ext == ".ppm";
+}
+
+// Writes 8-bit RGB pixels stored bottom row first, as render_image produces them.
+// The format follows the extension: .png, .jpg, .bmp or .ppm.
+bool write_image(const std::string& path, int width, int height, const unsigned char* rgb)
+{
+    const std::string ext = file_extension(path);
+    if (!image_format_supported(path))
+    {
+        std::cerr << "Unknown image format '" << ext << "', use .png, .jpg, .bmp or .ppm.\n";
+        return false;
+    }
+
+    // Image files start at the top row.
+    std::vector<unsigned char> flipped(static_cast<size_t>(width) * height * 3);
+    for (int j = 0; j < height; ++j)
+    {
+        const unsigned char* src = rgb + static_cast<size_t>(height - 1 - j) * width * 3;
+        std::copy(src, src + width * 3, flipped.begin() + static_cast<size_t>(j) * width * 3);
+    }
+
+    int ok = 0;
+    if (ext == ".png")
+    {
+        ok = stbi_write_png(path.c_str(), width, height, 3, flipped.data(), width * 3);
+    }
+    else if (ext == ".jpg" || ext == ".jpeg")
+    {
+        ok = stbi_write_jpg(path.c_str(), width, height, 3, flipped.data(), 95);
+    }
+    else if (ext == ".bmp")
+    {
+        ok = stbi_write_bmp(path.c_str(), width, height, 3, flipped.data());
+    }
+    else
+    {
+        FILE* file = std::fopen(path.c_str(), "wb");
+        if (file)
+        {
+            std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+            ok = std::fwrite(flipped.data(), 1, flipped.size(), file) == flipped.size();
+            ok = std::fclose(file) == 0 && ok;
+        }
+    }
+
+    if (!ok)
+        std::cerr << "Could not write image " << path << "\n";
+    return ok != 0;
+}
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "aabb.h"
+#include "hittable.h"
+
+// One placement of a shared object under a full affine transform. The object, usually a
+// triangle_mesh or a linear_bvh with its own tree, is built once in its own space; any
+// number of instances refer to it, and the scene BVH over the instances is the top level
+// of a two-level structure. Memory then grows with the unique geometry, an instance only
+// costs its transforms and bounds.
+//
+// Rays are moved into object space rather than the geometry into world space. The
+// direction is not normalized there, so distances along the ray stay the same in both.
+class instance : public hittable
+{
+public:
+    // material, if given, replaces the object's own for the hits on this instance.
+    instance(shared_ptr<hittable> object, const glm::mat4& transform, shared_ptr<material> m = nullptr);
+
+    virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override;
+    virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
+
+    // Moves the instance, for animation. Structures over it need a refit or rebuild after.
+    void set_transform(const glm::mat4& transform);
+
+    ray to_object(const ray& r) const
+    {
+        return ray(world_to_object * (r.origin() - translation), world_to_object * r.direction(), r.time());
+    }
+
+public:
+    shared_ptr<hittable> ptr;
+    shared_ptr<material> mat_ptr;
+    glm::mat3 object_to_world; // linear part
+    glm::mat3 world_to_object;
+    glm::vec3 translation;
+    aabb box;
+};
+
+instance::instance(shared_ptr<hittable> object, const glm::mat4& transform, shared_ptr<material> m)
+    : ptr(object), mat_ptr(m)
+{
+    set_transform(transform);
+}
+
+void instance::set_transform(const glm::mat4& transform)
+{
+    object_to_world = glm::mat3(transform);
+    world_to_object = glm::inverse(object_to_world);
+    translation = glm::vec3(transform[3].x, transform[3].y, transform[3].z);
+
+    // The world bounds are the bounds of the eight transformed corners.
+    box = empty_box();
+    aabb local;
+    if (!ptr->bounding_box(0.f, 1.f, local))
+        return;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        const glm::vec3 p((corner & 1) ? local.maximum.x : local.minimum.x,
+            (corner & 2) ? local.maximum.y : local.minimum.y,
+            (corner & 4) ? local.maximum.z : local.minimum.z);
+        box.expand(object_to_world * p + translation);
+    }
+}
+
+// Resolved right away like translate, so instances of instances work: the attributes are
+// found in object space and have to be brought back to world space.
+bool instance::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    const ray local_r = to_object(r);
+    if (!ptr->hit(local_r, t_min, t_max, rec))
+        return false;
+
+    rec.resolve(local_r);
+    rec.object = this;
+    rec.p = object_to_world * rec.p + translation;
+
+    // Normals go through the inverse transpose, whose rows are the columns of world_to_object.
+    // That keeps the sign of dot(direction, normal), so front_face holds in world space.
+    const glm::vec3 n = rec.normal;
+    rec.normal = glm::normalize(glm::vec3(glm::dot(world_to_object[0], n), glm::dot(world_to_object[1], n),
+        glm::dot(world_to_object[2], n)));
+
+    if (mat_ptr)
+        rec.mat_ptr = mat_ptr.get();
+    return true;
+}
+
+bool instance::occluded(const ray& r, float t_min, float t_max) const
+{
+    return ptr->occluded(to_object(r), t_min, t_max);
+}
+
+bool instance::bounding_box(float time0, float time1, aabb& output_box) const
+{
+    if (box.minimum.x > box.maximum.x)
+        return false;
+    output_box = box;
+    return true;
+}
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <type_traits>
+
+#include "common.h"
+#include "hittable.h"
+#include "light_set.h"
+#include "material.h"
+#include "pdf.h"
+
+// Bounces after which paths are cut short by Russian roulette. Earlier bounces carry most of
+// the image, so they are always traced.
+const int default_roulette_depth = 3;
+
+// Radiance arriving along r from beyond the scene: the environment map among lights if there
+// is one, background otherwise.
+inline glm::vec3 escaped_radiance(const ray& r, const glm::vec3& background, const light_set* lights)
+{
+    return lights && lights->environment ? lights->environment->radiance(r.direction()) : background;
+}
+
+// State a path carries from one bounce to the next.
+struct path_state
+{
+    // Radiance gathered so far, and the weight that light found at the next hit is scaled by.
+    glm::vec3 radiance;
+    glm::vec3 throughput;
+
+    // Where the last diffuse bounce was and the material's density for the direction it took.
+    // Emission found by that direction is weighed against the light sample taken there.
+    bool weigh_emission;
+    glm::vec3 bounce_point;
+    float bounce_pdf;
+
+    int bounce; // hits so far, counting the one being shaded
+
+    path_state()
+        : radiance(0, 0, 0), throughput(1, 1, 1), weigh_emission(false), bounce_point(0, 0, 0), bounce_pdf(0.f), bounce(1)
+    {
+    }
+};
+
+// Light from a light sample that reaches the path unless something is in the way.
+struct shadow_ray
+{
+    bool active;
+    ray r;
+    float t_max;
+    glm::vec3 contribution;
+};
+
+// Calls into the material of a hit. Code that shades a batch of hits on one kind of material
+// names its class as M, which turns the virtual calls into direct ones the compiler can
+// inline; for material itself they dispatch as usual. M must be final, or a class derived
+// from it would have its overrides skipped.
+template <class M>
+struct material_calls
+{
+    static_assert(std::is_final<M>::value, "material_calls calls M's own functions, M must be final");
+
+    static const M& of(const hit_record& rec) { return *static_cast<const M*>(rec.mat_ptr); }
+
+    static glm::vec3 emitted(const ray& r, const hit_record& rec) { return of(rec).M::emitted(r, rec, rec.u, rec.v, rec.p); }
+    static bool scatter(const ray& r, const hit_record& rec, scatter_record& srec) { return of(rec).M::scatter(r, rec, srec); }
+    static float scattering_pdf(const ray& r, const hit_record& rec, const ray& scattered) { return of(rec).M::scattering_pdf(r, rec, scattered); }
+};
+
+template <>
+struct material_calls<material>
+{
+    static glm::vec3 emitted(const ray& r, const hit_record& rec) { return rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p); }
+    static bool scatter(const ray& r, const hit_record& rec, scatter_record& srec) { return rec.mat_ptr->scatter(r, rec, srec); }
+    static float scattering_pdf(const ray& r, const hit_record& rec, const ray& scattered) { return rec.mat_ptr->scattering_pdf(r, rec, scattered); }
+};
+
+// One bounce of a path at hit, which current found and which is resolved already: adds the
+// emission there and samples where the path goes on. Returns false where the path ends,
+// otherwise sets next to the ray to trace.
+//
+// Diffuse bounces take two samples of the light arriving at them: one towards a light picked
+// from lights (next event estimation) and the material's own for the next bounce, whose hit
+// counts if it emits. Each is weighed by the power heuristic against the density the other
+// strategy had for its direction, so small lights are found by the first and glossy
+// reflections of large ones by the second without either adding its noise to the other.
+// Without lights only the material is sampled.
+//
+// The light sample's shadow ray is left for the caller, also when the path ends here: its
+// contribution belongs to the radiance if nothing blocks it.
+template <class M = material>
+bool shade_bounce(path_state& path, const ray& current, const hit_record& hit, const light_set* lights,
+    int depth, int roulette_depth, ray& next, shadow_ray& shadow)
+{
+    typedef material_calls<M> calls;
+    shadow.active = false;
+
+    scatter_record srec;
+    glm::vec3 emitted = calls::emitted(current, hit);
+    if (path.weigh_emission && (emitted.x > 0 || emitted.y > 0 || emitted.z > 0))
+        emitted *= power_heuristic(1, path.bounce_pdf, 1, lights->pdf(path.bounce_point, hit.object, current.direction()));
+    path.radiance += path.throughput * emitted;
+    if (!calls::scatter(current, hit, srec)) return false;
+
+    if (srec.is_specular)
+    {
+        next = srec.specular_ray;
+        path.throughput *= srec.attenuation;
+        path.weigh_emission = false;
+    }
+    else
+    {
+        // Light arriving from a sampled light adds to the next hit, so it is left out on the
+        // last one like the material's own sample.
+        light_sample ls;
+        if (lights && path.bounce < depth && lights->sample(hit.p, ls))
+        {
+            const ray to_light(hit.p, ls.direction, current.time());
+            const glm::vec3 f = srec.attenuation * calls::scattering_pdf(current, hit, to_light);
+
+            // The environment map shines from anywhere the shadow ray gets out. Other lights
+            // are hit alone for their radiance, the shadow ray then stops short of them as
+            // they are part of the world as well.
+            glm::vec3 light_emitted(0, 0, 0);
+            float t_max = infinity;
+            hit_record light_rec;
+            const bool reflects = f.x > 0 || f.y > 0 || f.z > 0;
+            if (reflects && ls.light == light_set::environment_index)
+                light_emitted = lights->environment->radiance(ls.direction);
+            else if (reflects && lights->lights[ls.light].object->hit(to_light, 0.001f, infinity, light_rec))
+            {
+                light_rec.resolve(to_light);
+                light_emitted = light_rec.mat_ptr->emitted(to_light, light_rec, light_rec.u, light_rec.v, light_rec.p);
+                t_max = light_rec.t * 0.999f;
+            }
+
+            if (light_emitted.x > 0 || light_emitted.y > 0 || light_emitted.z > 0)
+            {
+                const float weight = power_heuristic(1, ls.pdf, 1, srec.scatter_pdf.value(ls.direction));
+                shadow.active = true;
+                shadow.r = to_light;
+                shadow.t_max = t_max;
+                shadow.contribution = path.throughput * f * light_emitted * (weight / ls.pdf);
+            }
+        }
+
+        next = ray(hit.p, srec.scatter_pdf.generate(), current.time());
+        auto pdf_val = srec.scatter_pdf.value(next.direction());
+        path.throughput *= srec.attenuation * calls::scattering_pdf(current, hit, next) / pdf_val;
+
+        path.weigh_emission = lights != nullptr;
+        path.bounce_point = hit.p;
+        path.bounce_pdf = pdf_val;
+    }
+
+    if (path.bounce >= depth) return false;
+    const glm::vec3& throughput = path.throughput;
+    if (throughput.x == 0 && throughput.y == 0 && throughput.z == 0) return false;
+
+    // Keep a path with probability equal to its largest throughput component and divide the
+    // survivors by that probability, which leaves the expected radiance unchanged.
+    if (path.bounce >= roulette_depth)
+    {
+        float survival = std::max(throughput.x, std::max(throughput.y, throughput.z));
+        if (survival < 1.f)
+        {
+            if (sample_1d() >= survival) return false;
+            path.throughput /= survival;
+        }
+    }
+
+    ++path.bounce;
+    return true;
+}
+
+// Ends a path whose ray r left the scene.
+inline void escape_path(path_state& path, const ray& r, const glm::vec3& background, const light_set* lights)
+{
+    glm::vec3 escaped = escaped_radiance(r, background, lights);
+    if (path.weigh_emission && lights->environment)
+        escaped *= power_heuristic(1, path.bounce_pdf, 1, lights->environment_pdf(r.direction()));
+    path.radiance += path.throughput * escaped;
+}
+
+// Follows path on along next, the ray its last bounce sampled, until the path ends. Callers
+// that shade the first bounce themselves, such as to trace its shadow rays as a packet,
+// continue from there with this.
+void continue_path(path_state& path, const ray& next, const glm::vec3& background, const hittable& world, const light_set* lights, int depth, int roulette_depth)
+{
+    ray current = next;
+    hit_record hit;
+    while (world.hit(current, 0.001f, infinity, hit))
+    {
+        hit.resolve(current);
+
+        ray bounce;
+        shadow_ray shadow;
+        const bool more = shade_bounce(path, current, hit, lights, depth, roulette_depth, bounce, shadow);
+        if (shadow.active && !world.occluded(shadow.r, 0.001f, shadow.t_max))
+            path.radiance += shadow.contribution;
+        if (!more) return;
+
+        current = bounce;
+    }
+    escape_path(path, current, background, lights);
+}
+
+// Radiance leaving the surface in rec towards the origin of r, following the path iteratively
+// for up to depth hits in total. Split from ray_color so camera rays traced as a packet can
+// continue from their packet hit; rec comes straight from traversal and is resolved here.
+glm::vec3 shade_hit(const ray& r, const hit_record& rec, const glm::vec3& background, const hittable& world, const light_set* lights, int depth, int roulette_depth = default_roulette_depth)
+{
+    path_state path;
+    hit_record hit = rec;
+    hit.resolve(r);
+
+    ray next;
+    shadow_ray shadow;
+    const bool more = shade_bounce(path, r, hit, lights, depth, roulette_depth, next, shadow);
+    if (shadow.active && !world.occluded(shadow.r, 0.001f, shadow.t_max))
+        path.radiance += shadow.contribution;
+    if (more)
+        continue_path(path, next, background, world, lights, depth, roulette_depth);
+
+    return path.radiance;
+}
+
+glm::vec3 ray_color(const ray& r, const glm::vec3& background, const hittable& world, const light_set* lights, int depth, int roulette_depth = default_roulette_depth)
+{
+    hit_record rec;
+
+    if (depth <= 0) return glm::vec3(0, 0, 0);
+    if (!world.hit(r, 0.001f, infinity, rec)) return escaped_radiance(r, background, lights);
+
+    return shade_hit(r, rec, background, world, lights, depth, roulette_depth);
+}
+
+#endif
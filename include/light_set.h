@@ -0,0 +1,452 @@
+#ifndef LIGHT_SET_H
+#define LIGHT_SET_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#include "alias_table.h"
+#include "environment.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+
+// How a light_set picks the light to sample for a shading point.
+enum class light_sampling
+{
+    uniform, // every light equally often
+    power,   // in proportion to emitted power, from an alias table
+    bvh      // by estimated contribution at the shading point, from a light BVH
+};
+
+const char* const light_sampling_names[] = { "uniform", "power", "bvh" };
+
+inline bool parse_light_sampling(const std::string& name, light_sampling& sampling)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        if (name == light_sampling_names[i])
+        {
+            sampling = static_cast<light_sampling>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Node of the light BVH: bounds on where its lights are, which way they face and how much
+// they emit. Stored depth first like linear_bvh, so the first child follows its parent.
+struct light_node
+{
+    aabb box;
+    glm::vec3 axis;
+    float cos_theta;
+    float power;
+    uint32_t index; // light for leaves, second child otherwise
+    bool leaf;
+};
+
+// Bounds of the emitting normals of two cones, a cone around both.
+void merge_cones(const glm::vec3& axis_a, float cos_a, const glm::vec3& axis_b, float cos_b,
+    glm::vec3& axis, float& cos_theta)
+{
+    axis = axis_a;
+    cos_theta = -1.f;
+    if (cos_a <= -1.f || cos_b <= -1.f)
+        return;
+
+    const float theta_a = acos(std::min(cos_a, 1.f));
+    const float theta_b = acos(std::min(cos_b, 1.f));
+    const float theta_d = acos(glm::clamp(glm::dot(axis_a, axis_b), -1.f, 1.f));
+    if (std::min(theta_d + theta_b, pi) <= theta_a)
+    {
+        cos_theta = cos_a;
+        return;
+    }
+    if (std::min(theta_d + theta_a, pi) <= theta_b)
+    {
+        axis = axis_b;
+        cos_theta = cos_b;
+        return;
+    }
+
+    // The cone spanning both, its axis turned from a towards b.
+    const float theta = 0.5f * (theta_a + theta_d + theta_b);
+    const glm::vec3 w = glm::cross(axis_a, axis_b);
+    const float w_length = glm::length(w);
+    if (theta >= pi || w_length < 1e-6f)
+        return;
+
+    const glm::vec3 k = w / w_length;
+    const float turn = theta - theta_a;
+    axis = glm::normalize(axis_a * std::cos(turn) + glm::cross(k, axis_a) * std::sin(turn));
+    cos_theta = cos(theta);
+}
+
+// A light picked for a shading point and a direction towards it.
+struct light_sample
+{
+    uint32_t light;
+    glm::vec3 direction;
+    float pdf; // of picking the light and then the direction
+};
+
+// The emitting objects among the top level objects of a world, sampled as a whole: random()
+// picks one of them for the point it is given and samples a direction towards it, pdf_value()
+// is the density of that over all lights. Passed to the integrator as its lights, so diffuse
+// bounces in scenes with many emitters go where light comes from.
+//
+// An environment map, if given, is one more light. It is picked with a fixed probability,
+// its power against the power of the others, where its power is what it sends through a
+// disk the size of the scene.
+//
+// The light BVH bounds the emitted power, positions and facing of the lights under every
+// node. A point estimates a node's contribution as its power over the squared distance,
+// times the cosine of the smallest angle at which its lights can face the point, and picks a
+// light by descending into the children in proportion to their estimates.
+class light_set : public hittable
+{
+public:
+    light_set(const hittable_list& world, shared_ptr<environment_light> environment = nullptr,
+        light_sampling sampling = light_sampling::bvh);
+
+    bool empty() const { return lights.empty() && !environment; }
+
+    virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
+    virtual float pdf_value(const glm::vec3& o, const glm::vec3& v) const override;
+    virtual glm::vec3 random(const glm::vec3& o) const override;
+
+    // Picks a light to sample from p with u in [0, 1), with the probability of picking it.
+    uint32_t pick(const glm::vec3& p, float u, float& pmf) const;
+
+    // Probability that pick() returns light i for p.
+    float pick_pmf(const glm::vec3& p, uint32_t i) const;
+
+    // Picks a light for p and samples a direction towards it, for next event estimation.
+    bool sample(const glm::vec3& p, light_sample& out) const;
+
+    // Density with which sample() finds object from p along direction, the one multiple
+    // importance sampling weighs against the material's. 0 for objects that are not lights.
+    float pdf(const glm::vec3& p, const hittable* object, const glm::vec3& direction) const;
+
+    // Density with which sample() picks the environment map in direction.
+    float environment_pdf(const glm::vec3& direction) const
+    {
+        return environment ? environment_probability * environment->pdf(direction) : 0.f;
+    }
+
+    // light_sample::light of samples of the environment map.
+    static const uint32_t environment_index = 0xffffffffu;
+
+    // Estimated contribution of the lights under node to p.
+    float importance(const light_node& node, const glm::vec3& p) const;
+
+public:
+    struct light
+    {
+        shared_ptr<hittable> object;
+        emitter_surface surface;
+        float power;
+        uint64_t trail; // bit d set where the light is in the second child at depth d
+    };
+
+    std::vector<light> lights;
+    std::vector<light_node> nodes;
+    std::unordered_map<const hittable*, uint32_t> light_index; // hit_record::object to light
+    light_sampling sampling;
+    alias_table uniform_table;
+    alias_table power_table;
+    shared_ptr<environment_light> environment;
+    float environment_probability;
+
+private:
+    uint32_t build(std::vector<uint32_t>& order, size_t start, size_t end, int depth, uint64_t trail);
+    float left_probability(uint32_t node, const glm::vec3& p) const;
+};
+
+light_set::light_set(const hittable_list& world, shared_ptr<environment_light> environment, light_sampling sampling)
+    : sampling(sampling), environment(environment), environment_probability(0.f)
+{
+    for (const auto& object : world.objects)
+    {
+        light l;
+        if (!object->emitter(l.surface) || !l.surface.mat_ptr)
+            continue;
+
+        // Diffuse emitters send pi times their radiance through every unit of area.
+        l.power = pi * l.surface.area * luminance(l.surface.mat_ptr->average_radiance());
+        if (!(l.power > 0.f))
+            continue;
+        l.object = object;
+        l.trail = 0;
+        light_index[object.get()] = static_cast<uint32_t>(lights.size());
+        lights.push_back(l);
+    }
+
+    std::vector<float> powers;
+    for (const light& l : lights)
+        powers.push_back(l.power);
+    power_table = alias_table(powers);
+
+    if (environment)
+    {
+        aabb bounds;
+        float radius = 0.f;
+        if (world.bounding_box(0.f, 1.f, bounds))
+            radius = 0.5f * glm::length(bounds.maximum - bounds.minimum);
+        const float environment_power = pi * radius * radius * 4.f * pi * environment->average_luminance();
+        environment_probability = lights.empty() ? 1.f
+            : environment_power / (environment_power + power_table.total);
+    }
+    if (lights.empty())
+        return;
+
+    uniform_table = alias_table(std::vector<float>(lights.size(), 1.f));
+
+    std::vector<uint32_t> order(lights.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = static_cast<uint32_t>(i);
+    nodes.reserve(2 * lights.size());
+    build(order, 0, order.size(), 0, 0);
+}
+
+// Splits at the median of the light centers along the axis they spread most on.
+uint32_t light_set::build(std::vector<uint32_t>& order, size_t start, size_t end, int depth, uint64_t trail)
+{
+    const uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    // Median splits keep the depth at log2 of the light count, well within the trail bits.
+    if (end - start == 1)
+    {
+        light& l = lights[order[start]];
+        l.trail = trail;
+        light_node& node = nodes[index];
+        node.box = l.surface.box;
+        node.axis = l.surface.axis;
+        node.cos_theta = l.surface.cos_theta;
+        node.power = l.power;
+        node.index = order[start];
+        node.leaf = true;
+        return index;
+    }
+
+    aabb centers = empty_box();
+    for (size_t i = start; i < end; ++i)
+        centers.expand(lights[order[i]].surface.box.centroid());
+    const glm::vec3 extent = centers.maximum - centers.minimum;
+    const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+    const size_t mid = start + (end - start) / 2;
+    std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end, [&](uint32_t a, uint32_t b) {
+        return lights[a].surface.box.centroid()[axis] < lights[b].surface.box.centroid()[axis];
+    });
+
+    const uint32_t left = build(order, start, mid, depth + 1, trail);
+    const uint32_t right = build(order, mid, end, depth + 1, trail | (uint64_t(1) << depth));
+
+    light_node& node = nodes[index];
+    node.box = surrounding_box(nodes[left].box, nodes[right].box);
+    merge_cones(nodes[left].axis, nodes[left].cos_theta, nodes[right].axis, nodes[right].cos_theta, node.axis, node.cos_theta);
+    node.power = nodes[left].power + nodes[right].power;
+    node.index = right;
+    node.leaf = false;
+    return index;
+}
+
+float light_set::importance(const light_node& node, const glm::vec3& p) const
+{
+    const glm::vec3 to_p = p - node.box.centroid();
+    const glm::vec3 diagonal = node.box.maximum - node.box.minimum;
+    const float distance_squared = glm::dot(to_p, to_p);
+    const float radius_squared = 0.25f * glm::dot(diagonal, diagonal);
+
+    // Inside the bounding sphere of the lights neither the distance nor the facing is bounded.
+    if (distance_squared <= radius_squared)
+        return node.power / std::max(radius_squared, 1e-12f);
+    if (node.cos_theta <= -1.f)
+        return node.power / distance_squared;
+
+    // Smallest angle between a normal in the cone and the direction to p from anywhere in
+    // the bounding sphere. Diffuse emitters send nothing at right angles or beyond.
+    const float distance = sqrt(distance_squared);
+    const float theta_w = acos(glm::clamp(glm::dot(node.axis, to_p) / distance, -1.f, 1.f));
+    const float theta_n = acos(std::min(node.cos_theta, 1.f));
+    const float theta_b = asin(std::min(sqrt(radius_squared) / distance, 1.f));
+    const float theta = std::max(theta_w - theta_n - theta_b, 0.f);
+    if (theta >= 0.5f * pi)
+        return 0.f;
+    return node.power * cos(theta) / distance_squared;
+}
+
+// Where neither child is estimated to reach p, which the bounds of the parent do not rule
+// out, the children are weighed by power alone so every light under a picked node stays
+// reachable.
+float light_set::left_probability(uint32_t node, const glm::vec3& p) const
+{
+    const light_node& left = nodes[node + 1];
+    const light_node& right = nodes[nodes[node].index];
+    float l = importance(left, p);
+    float r = importance(right, p);
+    if (!(l + r > 0.f))
+    {
+        l = left.power;
+        r = right.power;
+    }
+    return l / (l + r);
+}
+
+uint32_t light_set::pick(const glm::vec3& p, float u, float& pmf) const
+{
+    if (sampling != light_sampling::bvh)
+        return (sampling == light_sampling::power ? power_table : uniform_table).sample(u, pmf);
+
+    pmf = 1.f;
+    uint32_t node = 0;
+    while (!nodes[node].leaf)
+    {
+        const float p_left = left_probability(node, p);
+        if (u < p_left)
+        {
+            u = std::min(u / p_left, one_minus_epsilon);
+            pmf *= p_left;
+            node = node + 1;
+        }
+        else
+        {
+            u = std::min((u - p_left) / (1.f - p_left), one_minus_epsilon);
+            pmf *= 1.f - p_left;
+            node = nodes[node].index;
+        }
+    }
+    return nodes[node].index;
+}
+
+float light_set::pick_pmf(const glm::vec3& p, uint32_t i) const
+{
+    if (sampling != light_sampling::bvh)
+        return (sampling == light_sampling::power ? power_table : uniform_table).pmf(i);
+
+    float pmf = 1.f;
+    uint32_t node = 0;
+    for (int depth = 0; !nodes[node].leaf; ++depth)
+    {
+        const float p_left = left_probability(node, p);
+        if (lights[i].trail & (uint64_t(1) << depth))
+        {
+            pmf *= 1.f - p_left;
+            node = nodes[node].index;
+        }
+        else
+        {
+            pmf *= p_left;
+            node = node + 1;
+        }
+    }
+    return nodes[node].index == i ? pmf : 0.f;
+}
+
+bool light_set::sample(const glm::vec3& p, light_sample& out) const
+{
+    if (environment && (lights.empty() || sample_1d() < environment_probability))
+    {
+        out.light = environment_index;
+        if (!environment->sample(sample_2d(), out.direction, out.pdf))
+            return false;
+        out.pdf *= environment_probability;
+        return out.pdf > 0.f;
+    }
+    if (lights.empty())
+        return false;
+
+    float pmf;
+    out.light = pick(p, sample_1d(), pmf);
+    const hittable& object = *lights[out.light].object;
+    out.direction = object.random(p);
+    out.pdf = (1.f - environment_probability) * pmf * object.pdf_value(p, out.direction);
+    return out.pdf > 0.f;
+}
+
+float light_set::pdf(const glm::vec3& p, const hittable* object, const glm::vec3& direction) const
+{
+    const auto found = light_index.find(object);
+    if (found == light_index.end())
+        return 0.f;
+    return (1.f - environment_probability) * pick_pmf(p, found->second) * object->pdf_value(p, direction);
+}
+
+glm::vec3 light_set::random(const glm::vec3& o) const
+{
+    light_sample ls;
+    return sample(o, ls) ? ls.direction : glm::vec3(1, 0, 0);
+}
+
+// Every light along the direction could have produced it, so their densities add up.
+float light_set::pdf_value(const glm::vec3& o, const glm::vec3& v) const
+{
+    if (nodes.empty())
+        return environment_pdf(v);
+
+    const ray r(o, v);
+    float density = 0.f;
+    uint32_t stack[64];
+    int stack_size = 0;
+    uint32_t node = 0;
+    while (true)
+    {
+        const light_node& n = nodes[node];
+        if (n.box.hit(r, 0.001f, infinity))
+        {
+            if (!n.leaf)
+            {
+                stack[stack_size++] = n.index;
+                node = node + 1;
+                continue;
+            }
+            const float light_pdf = lights[n.index].object->pdf_value(o, v);
+            if (light_pdf > 0.f)
+                density += pick_pmf(o, n.index) * light_pdf;
+        }
+        if (stack_size == 0)
+            break;
+        node = stack[--stack_size];
+    }
+    return (1.f - environment_probability) * density + environment_pdf(v);
+}
+
+bool light_set::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    bool hit_anything = false;
+    for (const light& l : lights)
+    {
+        if (l.object->hit(r, t_min, t_max, rec))
+        {
+            hit_anything = true;
+            t_max = rec.t;
+        }
+    }
+    return hit_anything;
+}
+
+bool light_set::bounding_box(float time0, float time1, aabb& output_box) const
+{
+    if (nodes.empty())
+        return false;
+    output_box = nodes[0].box;
+    return true;
+}
+
+// The lights of world and the environment map, null when nothing emits.
+shared_ptr<light_set> make_light_set(const hittable_list& world, shared_ptr<environment_light> environment = nullptr)
+{
+    auto lights = make_shared<light_set>(world, environment);
+    return lights->empty() ? nullptr : lights;
+}
+
+#endif
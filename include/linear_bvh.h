@@ -0,0 +1,187 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "common.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "bvh.h"
+#include "node_cache.h"
+
+// One node of the flattened tree, two per 64-byte cache line.
+// Nodes are stored depth first, so an interior node's first child is the next node and
+// only the second child needs an offset.
+struct alignas(32) linear_bvh_node
+{
+    glm::vec3 minimum;
+    union
+    {
+        uint32_t first_object; // leaf
+        uint32_t second_child; // interior
+    };
+    glm::vec3 maximum;
+    uint16_t object_count;     // 0 for interior nodes
+    uint8_t axis;
+    uint8_t pad;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should fill half a cache line");
+
+// Nodes the traversal stack holds before it moves to the heap.
+const int linear_bvh_stack_size = 64;
+
+// Visits the leaves of the flattened tree in nodes that r passes through, nearer children
+// first. leaf(first, count, t_max) tests primitives [first, first + count) and returns
+// whether one was hit, lowering t_max to the new closest hit. With any_hit the first leaf
+// that reports a hit ends the traversal. Takes plain node memory so meshes can traverse
+// trees they own or map from a scene cache without a hittable per primitive.
+template <bool any_hit, class leaf_fn>
+bool traverse_linear_bvh(const linear_bvh_node* nodes, size_t node_count, const ray& r, float t_min, float t_max, leaf_fn&& leaf)
+{
+    if (node_count == 0)
+        return false;
+
+    const glm::vec3 origin = r.origin();
+    const glm::vec3 inv_dir = 1.f / r.direction();
+    const bool dir_is_neg[3] = { inv_dir.x < 0.f, inv_dir.y < 0.f, inv_dir.z < 0.f };
+
+    traversal_stack<uint32_t, linear_bvh_stack_size> stack;
+    uint32_t current = 0;
+    bool hit_anything = false;
+
+    while (true)
+    {
+        const linear_bvh_node& node = nodes[current];
+        count_node_fetch(&node, sizeof(node));
+        if (slab_hit(node.minimum, node.maximum, origin, inv_dir, t_min, t_max))
+        {
+            if (node.object_count > 0)
+            {
+                if (leaf(node.first_object, node.object_count, t_max))
+                {
+                    if (any_hit) return true;
+                    hit_anything = true;
+                }
+                if (stack.empty()) break;
+                current = stack.pop();
+            }
+            else if (dir_is_neg[node.axis])
+            {
+                // The second child holds the higher coordinates, so it is nearer along this ray.
+                stack.push(current + 1);
+                current = node.second_child;
+            }
+            else
+            {
+                stack.push(node.second_child);
+                current = current + 1;
+            }
+        }
+        else
+        {
+            if (stack.empty()) break;
+            current = stack.pop();
+        }
+    }
+
+    return hit_anything;
+}
+
+class linear_bvh : public hittable
+{
+public:
+    linear_bvh() {}
+    linear_bvh(const bvh_node& root);
+
+    linear_bvh(const hittable_list& list, float time0, float time1, const bvh_build_options& options = bvh_build_options())
+        : linear_bvh(bvh_node(list, time0, time1, options))
+    {}
+
+    virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override;
+    virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
+
+    // Appends the subtree under node and returns its index, leaves keep the object ranges of the source tree.
+    uint32_t flatten(const bvh_node& node);
+
+    template <bool any_hit, class leaf_fn>
+    bool traverse(const ray& r, float t_min, float t_max, leaf_fn&& leaf) const
+    {
+        return traverse_linear_bvh<any_hit>(nodes.data(), nodes.size(), r, t_min, t_max, leaf);
+    }
+
+public:
+    std::vector<linear_bvh_node> nodes;
+    shared_ptr<const std::vector<shared_ptr<hittable>>> objects;
+};
+
+linear_bvh::linear_bvh(const bvh_node& root)
+    : objects(root.objects)
+{
+    if (root.is_leaf() && root.object_count == 0)
+        return;
+    flatten(root);
+}
+
+uint32_t linear_bvh::flatten(const bvh_node& node)
+{
+    const uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+    nodes[index].minimum = node.box.minimum;
+    nodes[index].maximum = node.box.maximum;
+    nodes[index].axis = static_cast<uint8_t>(node.split_axis);
+    nodes[index].pad = 0;
+
+    if (node.is_leaf())
+    {
+        nodes[index].first_object = node.first_object;
+        nodes[index].object_count = static_cast<uint16_t>(node.object_count);
+        return index;
+    }
+
+    nodes[index].object_count = 0;
+    flatten(*node.left);
+    uint32_t second = flatten(*node.right);
+    nodes[index].second_child = second;
+    return index;
+}
+
+bool linear_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    return traverse<false>(r, t_min, t_max, [&](uint32_t first, uint32_t count, float& t_closest)
+    {
+        bool hit_leaf = false;
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            if ((*objects)[i]->hit(r, t_min, t_closest, rec))
+            {
+                hit_leaf = true;
+                t_closest = rec.t;
+            }
+        }
+        return hit_leaf;
+    });
+}
+
+bool linear_bvh::occluded(const ray& r, float t_min, float t_max) const
+{
+    return traverse<true>(r, t_min, t_max, [&](uint32_t first, uint32_t count, float& t_closest)
+    {
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            if ((*objects)[i]->occluded(r, t_min, t_closest))
+                return true;
+        }
+        return false;
+    });
+}
+
+bool linear_bvh::bounding_box(float time0, float time1, aabb& output_box) const
+{
+    if (nodes.empty()) return false;
+    output_box = aabb(nodes[0].minimum, nodes[0].maximum);
+    return true;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// A whole file mapped read only into memory. Pages are loaded on first access and shared
+// with the page cache, so opening a large file costs no reading or copying. The platform
+// code lives in src/mapped_file.cpp, so no system headers leak out of this one.
+class mapped_file
+{
+public:
+    mapped_file() : data(nullptr), size(0) {}
+    ~mapped_file() { close(); }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    const unsigned char* begin() const { return static_cast<const unsigned char*>(data); }
+
+public:
+    void* data;
+    size_t size;
+};
+
+#endif
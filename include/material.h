@@ -13,28 +13,49 @@ struct scatter_record {
     ray specular_ray;
     bool is_specular;
     glm::vec3 attenuation;
-    shared_ptr<pdf> pdf_ptr;
+    pdf scatter_pdf; // none for specular scattering
 };
 
+// The material classes below, for shading hits on the same kind of material together. They
+// are final, since batches of a type call the class's own functions directly; materials
+// defined elsewhere derive from material and report other.
+enum class material_type
+{
+    lambertian,
+    metal,
+    dielectric,
+    diffuse_light,
+    other
+};
+
+const int material_type_count = 5;
+
 class material
 {
 public:
+    virtual material_type type() const { return material_type::other; }
+
     virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const { return false; }
     virtual float scattering_pdf( const ray& r_in, const hit_record& rec, const ray& scattered ) const {  return 0; }
     virtual glm::vec3 emitted(const ray& r_in, const hit_record& rec, float u, float v, const glm::vec3& p) const { return glm::vec3(0, 0, 0); }
+
+    // Rough average of what emitted() returns on the front face, for weighing lights by power.
+    virtual glm::vec3 average_radiance() const { return glm::vec3(0, 0, 0); }
 };
 
-class lambertian : public material
+class lambertian final : public material
 {
 public:
     lambertian(const glm::vec3& a) : albedo(make_shared<solid_color>(a)) {}
     lambertian(shared_ptr<rttexture> a) : albedo(a) {}
 
+    virtual material_type type() const override { return material_type::lambertian; }
+
     virtual bool scatter( const ray& r_in, const hit_record& rec, scatter_record& srec) const override
     {
         srec.is_specular = false;
         srec.attenuation = albedo->value(rec.u, rec.v, rec.p);
-        srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
+        srec.scatter_pdf = cosine_pdf(rec.normal);
         return true;
     }
 
@@ -48,18 +69,20 @@ public:
     shared_ptr<rttexture> albedo;
 };
 
-class metal : public material
+class metal final : public material
 {
 public:
     metal(const glm::vec3& a, float f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
+    virtual material_type type() const override { return material_type::metal; }
+
     virtual bool scatter( const ray& r_in, const hit_record& rec, scatter_record& srec ) const override
     {
         glm::vec3 reflected = reflect(glm::normalize(r_in.direction()), rec.normal);
         srec.specular_ray = ray(rec.p, reflected + fuzz * random_in_unit_sphere(), r_in.time());
         srec.attenuation = albedo;
         srec.is_specular = true;
-        srec.pdf_ptr = nullptr;
+        srec.scatter_pdf = pdf();
         return true;
     }
 
@@ -68,14 +91,16 @@ public:
     float fuzz;
 };
 
-class dielectric : public material {
+class dielectric final : public material {
 public:
     dielectric(float index_of_refraction) : ir(index_of_refraction) {}
 
+    virtual material_type type() const override { return material_type::dielectric; }
+
     virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
     {
         srec.is_specular = true;
-        srec.pdf_ptr = nullptr;
+        srec.scatter_pdf = pdf();
         srec.attenuation = glm::vec3(1.0, 1.0, 1.0);
         double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
 
@@ -86,7 +111,7 @@ public:
         bool cannot_refract = refraction_ratio * sin_theta > 1.0;
         glm::vec3 direction;
 
-        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_float())
+        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > sample_1d())
             direction = reflect(unit_direction, rec.normal);
         else
             direction = refract(unit_direction, rec.normal, refraction_ratio);
@@ -107,11 +132,13 @@ private:
     }
 };
 
-class diffuse_light : public material {
+class diffuse_light final : public material {
 public:
     diffuse_light(shared_ptr<rttexture> a) : emit(a) {}
     diffuse_light(glm::vec3 c) : emit(make_shared<solid_color>(c)) {}
 
+    virtual material_type type() const override { return material_type::diffuse_light; }
+
     virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
     {
         return false;
@@ -125,6 +152,12 @@ public:
             return glm::vec3(0, 0, 0);
     }
 
+    // Textured lights are taken at the center of their texture.
+    virtual glm::vec3 average_radiance() const override
+    {
+        return emit->value(0.5f, 0.5f, glm::vec3(0, 0, 0));
+    }
+
 public:
     shared_ptr<rttexture> emit;
 };
@@ -0,0 +1,129 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "thread_pool.h"
+
+// Morton codes interleave the bits of quantized x, y and z coordinates, x highest, so
+// sorting by them orders points along a Z-order curve and points sharing a prefix of their
+// codes share an octree cell.
+
+// Spreads the low 10 bits of v two bits apart.
+inline uint64_t morton_spread10(uint64_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// Spreads the low 21 bits of v two bits apart.
+inline uint64_t morton_spread21(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x001f00000000ffffull;
+    v = (v | (v << 16)) & 0x001f0000ff0000ffull;
+    v = (v | (v << 8)) & 0x100f00f00f00f00full;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+    v = (v | (v << 2)) & 0x1249249249249249ull;
+    return v;
+}
+
+// Code of p, given in [0, 1] on every axis, with bits = 30 or 63.
+inline uint64_t morton_code(const glm::vec3& p, int bits)
+{
+    const int axis_bits = bits / 3;
+    const float cells = static_cast<float>(uint64_t(1) << axis_bits);
+    uint64_t q[3];
+    for (int axis = 0; axis < 3; ++axis)
+        q[axis] = static_cast<uint64_t>(std::min(std::max(p[axis] * cells, 0.f), cells - 1.f));
+
+    if (axis_bits == 10)
+        return (morton_spread10(q[0]) << 2) | (morton_spread10(q[1]) << 1) | morton_spread10(q[2]);
+    return (morton_spread21(q[0]) << 2) | (morton_spread21(q[1]) << 1) | morton_spread21(q[2]);
+}
+
+// Axis whose coordinate bit lands at bit of a code.
+inline int morton_bit_axis(int bit)
+{
+    return 2 - bit % 3;
+}
+
+struct morton_key
+{
+    uint64_t code;
+    uint32_t index;
+};
+
+const size_t radix_sort_grain = 1 << 14;
+
+// Working memory of radix_sort, for callers that sort again and again and would rather not
+// allocate it every time.
+struct radix_sort_buffers
+{
+    std::vector<morton_key> sorted;
+    std::vector<size_t> offsets;
+};
+
+// Stable LSD radix sort of keys by the low bits of their codes, one pass per 8-bit digit.
+// Each pass counts the digits of fixed size chunks, on the pool if given, and then scatters
+// every chunk behind the keys of the chunks before it, so the order never depends on the
+// thread count. Passes where all keys share the digit are skipped. Passes swap keys with
+// buffers.sorted, so both keep their capacity for the next sort.
+void radix_sort(std::vector<morton_key>& keys, int bits, thread_pool* pool, radix_sort_buffers& buffers)
+{
+    const size_t count = keys.size();
+    const size_t chunks = parallel_chunk_count(0, count, radix_sort_grain);
+    std::vector<morton_key>& sorted = buffers.sorted;
+    std::vector<size_t>& offsets = buffers.offsets;
+    sorted.resize(count);
+    offsets.resize(chunks * 256);
+
+    for (int shift = 0; shift < bits; shift += 8)
+    {
+        parallel_for(pool, 0, count, radix_sort_grain, [&](size_t chunk, size_t first, size_t last) {
+            size_t* histogram = &offsets[chunk * 256];
+            std::fill_n(histogram, 256, 0);
+            for (size_t i = first; i < last; ++i)
+                histogram[(keys[i].code >> shift) & 0xff]++;
+        });
+
+        size_t total = 0;
+        bool one_digit = false;
+        for (int digit = 0; digit < 256; ++digit)
+        {
+            const size_t digit_start = total;
+            for (size_t chunk = 0; chunk < chunks; ++chunk)
+            {
+                const size_t n = offsets[chunk * 256 + digit];
+                offsets[chunk * 256 + digit] = total;
+                total += n;
+            }
+            one_digit = one_digit || (total - digit_start == count);
+        }
+        if (one_digit)
+            continue;
+
+        parallel_for(pool, 0, count, radix_sort_grain, [&](size_t chunk, size_t first, size_t last) {
+            size_t* next = &offsets[chunk * 256];
+            for (size_t i = first; i < last; ++i)
+                sorted[next[(keys[i].code >> shift) & 0xff]++] = keys[i];
+        });
+        keys.swap(sorted);
+    }
+}
+
+void radix_sort(std::vector<morton_key>& keys, int bits, thread_pool* pool)
+{
+    radix_sort_buffers buffers;
+    radix_sort(keys, bits, pool, buffers);
+}
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef NODE_CACHE_H
+#define NODE_CACHE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Instrumentation for how well the BVH's nodes stay cached while rays are traced. When it is
+// on, every node a traversal reads is looked up in a simulated set associative LRU cache of
+// the calling thread, so rays traced one after another that walk the same nodes show up as
+// hits. Hardware counters would need a profiler; the model gives the same answer for the
+// question that matters here, whether the order rays are traced in lets them reuse nodes.
+//
+// Traversals only call into the model in builds with RAYTRACE_NODE_CACHE_MODEL defined
+// (the CMake option of the same name); elsewhere count_node_fetch compiles to nothing.
+
+const size_t node_cache_line_bytes = 64;
+const int node_cache_ways = 8;
+
+class node_cache_model
+{
+public:
+    explicit node_cache_model(size_t bytes);
+
+    // Looks up the cache lines of size bytes at address, loading those that miss.
+    void touch(const void* address, size_t size);
+
+public:
+    uint64_t fetches; // cache lines read
+    uint64_t misses;
+
+private:
+    size_t set_count;
+    std::vector<uint64_t> tags;     // node_cache_ways per set, line address + 1, 0 when empty
+    std::vector<uint64_t> last_use; // for each tag
+    uint64_t clock;
+};
+
+node_cache_model::node_cache_model(size_t bytes)
+    : fetches(0), misses(0), clock(0)
+{
+    set_count = std::max<size_t>(1, bytes / (node_cache_line_bytes * node_cache_ways));
+    tags.assign(set_count * node_cache_ways, 0);
+    last_use.assign(set_count * node_cache_ways, 0);
+}
+
+void node_cache_model::touch(const void* address, size_t size)
+{
+    const uint64_t first = reinterpret_cast<uintptr_t>(address) / node_cache_line_bytes;
+    const uint64_t last = (reinterpret_cast<uintptr_t>(address) + size - 1) / node_cache_line_bytes;
+    for (uint64_t line = first; line <= last; ++line)
+    {
+        ++fetches;
+        ++clock;
+        const size_t set = static_cast<size_t>(line % set_count) * node_cache_ways;
+        int oldest = 0;
+        bool hit = false;
+        for (int way = 0; way < node_cache_ways; ++way)
+        {
+            if (tags[set + way] == line + 1)
+            {
+                last_use[set + way] = clock;
+                hit = true;
+                break;
+            }
+            if (last_use[set + way] < last_use[set + oldest])
+                oldest = way;
+        }
+        if (!hit)
+        {
+            ++misses;
+            tags[set + oldest] = line + 1;
+            last_use[set + oldest] = clock;
+        }
+    }
+}
+
+// Simulated cache size per thread, 0 while the instrumentation is off.
+inline size_t& node_cache_model_bytes()
+{
+    static size_t bytes = 0;
+    return bytes;
+}
+
+// Models of all threads that traced rays while the instrumentation was on.
+struct node_cache_registry
+{
+    std::mutex lock;
+    std::vector<std::unique_ptr<node_cache_model>> models;
+};
+
+inline node_cache_registry& node_cache_models()
+{
+    static node_cache_registry registry;
+    return registry;
+}
+
+// Turns the instrumentation on with a cache of bytes per thread, before rendering starts.
+inline void enable_node_cache_model(size_t bytes)
+{
+    node_cache_model_bytes() = bytes;
+}
+
+// Model of the calling thread, null while the instrumentation is off.
+inline node_cache_model* thread_node_cache()
+{
+    static thread_local node_cache_model* model = nullptr;
+    if (!model && node_cache_model_bytes() > 0)
+    {
+        node_cache_registry& registry = node_cache_models();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        registry.models.push_back(std::unique_ptr<node_cache_model>(new node_cache_model(node_cache_model_bytes())));
+        model = registry.models.back().get();
+    }
+    return model;
+}
+
+// Called by traversals for every node they read.
+inline void count_node_fetch(const void* node, size_t size)
+{
+#if defined(RAYTRACE_NODE_CACHE_MODEL)
+    if (node_cache_model* model = thread_node_cache())
+        model->touch(node, size);
+#else
+    (void)node;
+    (void)size;
+#endif
+}
+
+// Sums of all threads, to be read while no rays are traced.
+inline void node_cache_totals(uint64_t& fetches, uint64_t& misses)
+{
+    node_cache_registry& registry = node_cache_models();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    fetches = misses = 0;
+    for (const auto& model : registry.models)
+    {
+        fetches += model->fetches;
+        misses += model->misses;
+    }
+}
+
+#endif
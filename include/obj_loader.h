@@ -0,0 +1,303 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "triangle_mesh.h"
+
+// Streaming Wavefront OBJ reader for the geometry of a single mesh: v, vn, vt and f lines.
+// Polygons become triangle fans, negative indices count back from the latest vertex.
+// Faces that leave out normals or texture coordinates drop them for the whole mesh;
+// groups, smoothing and materials are ignored.
+
+inline bool obj_is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline const char* obj_skip_space(const char* p, const char* end)
+{
+    while (p < end && obj_is_space(*p)) ++p;
+    return p;
+}
+
+// Parses a decimal float at p, returns the end of it or nullptr if there is none. Much
+// faster than strtod, which has to honour the locale and round exactly; the digits are
+// collected in a double, so ordinary OBJ values come out within an ulp of a float.
+inline const char* obj_parse_float(const char* p, const char* end, float& value)
+{
+    static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    double mantissa = 0.0;
+    int exponent = 0;
+    bool digits = false;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, digits = true)
+        mantissa = mantissa * 10.0 + (*p - '0');
+    if (p < end && *p == '.')
+    {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p, digits = true)
+        {
+            mantissa = mantissa * 10.0 + (*p - '0');
+            --exponent;
+        }
+    }
+    if (!digits)
+        return nullptr;
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* q = p + 1;
+        bool negative_exponent = false;
+        if (q < end && (*q == '-' || *q == '+'))
+            negative_exponent = *q++ == '-';
+        if (q < end && *q >= '0' && *q <= '9')
+        {
+            int e = 0;
+            for (; q < end && *q >= '0' && *q <= '9'; ++q)
+                e = std::min(e * 10 + (*q - '0'), 1000);
+            exponent += negative_exponent ? -e : e;
+            p = q;
+        }
+    }
+
+    const int magnitude = exponent < 0 ? -exponent : exponent;
+    const double scale = magnitude <= 22 ? powers[magnitude] : std::pow(10.0, magnitude);
+    const double result = exponent < 0 ? mantissa / scale : mantissa * scale;
+    value = static_cast<float>(negative ? -result : result);
+    return p;
+}
+
+inline const char* obj_parse_int(const char* p, const char* end, long long& value)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    if (p >= end || *p < '0' || *p > '9')
+        return nullptr;
+
+    long long v = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p)
+        v = std::min(v * 10 + (*p - '0'), 1LL << 40);
+    value = negative ? -v : v;
+    return p;
+}
+
+class obj_reader
+{
+public:
+    explicit obj_reader(mesh_data& out) : mesh(out), line_number(0), missing_normals(false), missing_uvs(false) {}
+
+    bool read(const std::string& path);
+
+private:
+    bool parse_line(const char* p, const char* end);
+    bool parse_face(const char* p, const char* end);
+
+    // Turns a 1-based or negative OBJ index into an array index, false if out of range.
+    bool resolve_index(long long index, size_t count, uint32_t& out) const
+    {
+        const long long resolved = index < 0 ? static_cast<long long>(count) + index : index - 1;
+        if (index == 0 || resolved < 0 || resolved >= static_cast<long long>(count))
+            return false;
+        out = static_cast<uint32_t>(resolved);
+        return true;
+    }
+
+    bool fail(const std::string& message) const
+    {
+        std::cerr << "OBJ line " << line_number << ": " << message << "\n";
+        return false;
+    }
+
+    mesh_data& mesh;
+    size_t line_number;
+    bool missing_normals;
+    bool missing_uvs;
+
+    // Corners of the face being parsed, reused between faces.
+    std::vector<uint32_t> corner_positions, corner_normals, corner_uvs;
+};
+
+bool obj_reader::read(const std::string& path)
+{
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        std::cerr << "Could not open OBJ file " << path << "\n";
+        return false;
+    }
+
+    // Reads the file in large chunks and parses every complete line in place; a line cut
+    // off by the end of a chunk moves to the front of the buffer for the next read.
+    const size_t chunk_size = 1 << 22;
+    std::vector<char> buffer(chunk_size);
+    size_t carried = 0;
+    bool ok = true;
+
+    while (ok)
+    {
+        if (carried == buffer.size())
+            buffer.resize(buffer.size() * 2); // a line longer than the buffer
+
+        const size_t read = std::fread(buffer.data() + carried, 1, buffer.size() - carried, file);
+        const size_t filled = carried + read;
+        const bool at_end = read == 0;
+
+        const char* p = buffer.data();
+        const char* end = buffer.data() + filled;
+        while (ok && p < end)
+        {
+            const char* line_end = static_cast<const char*>(memchr(p, '\n', end - p));
+            if (!line_end)
+            {
+                if (!at_end) break;
+                line_end = end;
+            }
+
+            ++line_number;
+            ok = parse_line(p, line_end);
+            p = line_end < end ? line_end + 1 : end;
+        }
+
+        carried = end - p;
+        if (carried > 0)
+            std::memmove(buffer.data(), p, carried);
+        if (at_end)
+            break;
+    }
+
+    if (std::ferror(file))
+    {
+        std::cerr << "Could not read OBJ file " << path << "\n";
+        ok = false;
+    }
+    std::fclose(file);
+    if (!ok)
+        return false;
+
+    if (missing_normals) mesh.normal_indices.clear();
+    if (missing_uvs) mesh.uv_indices.clear();
+    return true;
+}
+
+bool obj_reader::parse_line(const char* p, const char* end)
+{
+    p = obj_skip_space(p, end);
+    if (p >= end || *p == '#')
+        return true;
+
+    if (*p == 'v')
+    {
+        const char kind = p + 1 < end ? p[1] : ' ';
+        const int components = kind == 'n' ? 3 : kind == 't' ? 2 : obj_is_space(kind) ? 3 : 0;
+        if (components == 0)
+            return true; // vp and others
+
+        p += kind == 'n' || kind == 't' ? 2 : 1;
+        float c[3] = { 0.f, 0.f, 0.f };
+        for (int i = 0; i < components; ++i)
+        {
+            p = obj_parse_float(obj_skip_space(p, end), end, c[i]);
+            if (!p)
+            {
+                // A texture coordinate may leave out v.
+                if (kind == 't' && i == 1) break;
+                return fail("expected a number");
+            }
+        }
+
+        if (kind == 'n') mesh.add_normal(glm::vec3(c[0], c[1], c[2]));
+        else if (kind == 't') mesh.add_uv(c[0], c[1]);
+        else mesh.add_position(glm::vec3(c[0], c[1], c[2]));
+        return true;
+    }
+
+    if (*p == 'f' && p + 1 < end && obj_is_space(p[1]))
+        return parse_face(p + 1, end);
+
+    return true;
+}
+
+bool obj_reader::parse_face(const char* p, const char* end)
+{
+    corner_positions.clear();
+    corner_normals.clear();
+    corner_uvs.clear();
+    bool has_normals = true;
+    bool has_uvs = true;
+
+    // Corners are v, v/vt, v//vn or v/vt/vn.
+    while ((p = obj_skip_space(p, end)) < end)
+    {
+        long long index;
+        uint32_t resolved;
+        p = obj_parse_int(p, end, index);
+        if (!p || !resolve_index(index, mesh.vertex_count(), resolved))
+            return fail("bad vertex index");
+        corner_positions.push_back(resolved);
+
+        bool corner_uv = false;
+        bool corner_normal = false;
+        if (p < end && *p == '/')
+        {
+            ++p;
+            if (p < end && *p != '/')
+            {
+                p = obj_parse_int(p, end, index);
+                if (!p || !resolve_index(index, mesh.tu.size(), resolved))
+                    return fail("bad texture coordinate index");
+                corner_uvs.push_back(resolved);
+                corner_uv = true;
+            }
+            if (p < end && *p == '/')
+            {
+                p = obj_parse_int(p + 1, end, index);
+                if (!p || !resolve_index(index, mesh.nx.size(), resolved))
+                    return fail("bad normal index");
+                corner_normals.push_back(resolved);
+                corner_normal = true;
+            }
+        }
+        has_uvs = has_uvs && corner_uv;
+        has_normals = has_normals && corner_normal;
+
+        if (p < end && !obj_is_space(*p))
+            return fail("unexpected character in face");
+    }
+
+    if (corner_positions.size() < 3)
+        return fail("face with fewer than three corners");
+
+    missing_uvs = missing_uvs || !has_uvs;
+    missing_normals = missing_normals || !has_normals;
+
+    for (size_t k = 1; k + 1 < corner_positions.size(); ++k)
+    {
+        const size_t fan[3] = { 0, k, k + 1 };
+        for (size_t c : fan)
+        {
+            mesh.position_indices.push_back(corner_positions[c]);
+            if (!missing_normals) mesh.normal_indices.push_back(corner_normals[c]);
+            if (!missing_uvs) mesh.uv_indices.push_back(corner_uvs[c]);
+        }
+    }
+    return true;
+}
+
+// Appends the triangles of the OBJ file at path to out. Reports problems on std::cerr.
+bool load_obj(const std::string& path, mesh_data& out)
+{
+    obj_reader reader(out);
+    return reader.read(path);
+}
+
+#endif
@@ -3,27 +3,26 @@
 
 #include "common.h"
 
-class pdf 
-{
-public:
-    virtual ~pdf() {}
+#include "hittable.h"
+#include "onb.h"
 
-    virtual float value(const glm::vec3& direction) const = 0;
-    virtual glm::vec3 generate() const = 0;
-};
+// Sampling densities are small value types built on the stack for every bounce, so shading
+// never allocates. They refer to the geometry they sample by raw pointer; the scene owns it
+// for as long as any ray is in flight.
 
-class cosine_pdf : public pdf 
+class cosine_pdf
 {
 public:
+    cosine_pdf() {}
     cosine_pdf(const glm::vec3& w) { uvw.build_from_w(w); }
 
-    virtual float value(const glm::vec3& direction) const override 
+    float value(const glm::vec3& direction) const
     {
         auto cosine = glm::dot(glm::normalize(direction), uvw.w());
         return (cosine <= 0) ? 0 : cosine / pi;
     }
 
-    virtual glm::vec3 generate() const override
+    glm::vec3 generate() const
     {
         return uvw.local(random_cosine_direction());
     }
@@ -32,44 +31,105 @@ public:
     onb uvw;
 };
 
-class hittable_pdf : public pdf 
+class hittable_pdf
 {
 public:
-    hittable_pdf(shared_ptr<hittable> p, const glm::vec3& origin) : ptr(p), o(origin) {}
+    hittable_pdf() : ptr(nullptr) {}
+    hittable_pdf(const hittable* p, const glm::vec3& origin) : o(origin), ptr(p) {}
 
-    virtual float value(const glm::vec3& direction) const override {
+    float value(const glm::vec3& direction) const {
         return ptr->pdf_value(o, direction);
     }
 
-    virtual glm::vec3 generate() const override {
+    glm::vec3 generate() const {
         return ptr->random(o);
     }
 
 public:
     glm::vec3 o;
-    shared_ptr<hittable> ptr;
+    const hittable* ptr;
+};
+
+enum class pdf_kind
+{
+    none,
+    cosine,
+    hittable
+};
+
+// One of the densities above, tagged with which one it holds. none stands for scattering
+// that is not sampled from a density, such as specular reflection.
+class pdf
+{
+public:
+    pdf() : kind(pdf_kind::none) {}
+    pdf(const cosine_pdf& p) : kind(pdf_kind::cosine), cosine(p) {}
+    pdf(const hittable_pdf& p) : kind(pdf_kind::hittable), target(p) {}
+
+    float value(const glm::vec3& direction) const
+    {
+        switch (kind)
+        {
+        case pdf_kind::cosine: return cosine.value(direction);
+        case pdf_kind::hittable: return target.value(direction);
+        default: return 0;
+        }
+    }
+
+    glm::vec3 generate() const
+    {
+        switch (kind)
+        {
+        case pdf_kind::cosine: return cosine.generate();
+        case pdf_kind::hittable: return target.generate();
+        default: return glm::vec3(1, 0, 0);
+        }
+    }
+
+public:
+    pdf_kind kind;
+    cosine_pdf cosine;
+    hittable_pdf target;
 };
 
-class mixture_pdf : public pdf {
+class mixture_pdf {
 public:
-    mixture_pdf(shared_ptr<pdf> p0, shared_ptr<pdf> p1) {
+    mixture_pdf(const pdf& p0, const pdf& p1) {
         p[0] = p0;
         p[1] = p1;
     }
 
-    virtual float value(const glm::vec3& direction) const override {
-        return 0.5 * p[0]->value(direction) + 0.5 * p[1]->value(direction);
+    float value(const glm::vec3& direction) const {
+        return 0.5 * p[0].value(direction) + 0.5 * p[1].value(direction);
     }
 
-    virtual glm::vec3 generate() const override {
-        if (random_float() < 0.5)
-            return p[0]->generate();
+    glm::vec3 generate() const {
+        if (sample_1d() < 0.5)
+            return p[0].generate();
         else
-            return p[1]->generate();
+            return p[1].generate();
     }
 
 public:
-    shared_ptr<pdf> p[2];
+    pdf p[2];
 };
 
-#endif
\ No newline at end of file
+// Weights for multiple importance sampling: how much of a sample drawn nf times from the
+// density f counts, when g with ng samples could have drawn it as well. The weights of all
+// strategies add up to one for any direction. The power heuristic leans further towards the
+// strategy more likely to produce the sample, which is almost always the better one.
+inline float balance_heuristic(int nf, float f_pdf, int ng, float g_pdf)
+{
+    const float f = nf * f_pdf;
+    const float g = ng * g_pdf;
+    return f > 0.f ? f / (f + g) : 0.f;
+}
+
+inline float power_heuristic(int nf, float f_pdf, int ng, float g_pdf)
+{
+    const float f = nf * f_pdf;
+    const float g = ng * g_pdf;
+    return f > 0.f ? (f * f) / (f * f + g * g) : 0.f;
+}
+
+#endif
@@ -5,15 +5,18 @@
 
 class perlin {
 public:
-    perlin() {
+    perlin(uint64_t seed = 0) {
+        // Own generator so the noise pattern depends only on the seed.
+        pcg32 rng(mix_bits(seed));
+
         ranvec = new glm::vec3[point_count];
         for (int i = 0; i < point_count; ++i) {
-            ranvec[i] = glm::normalize(random_vec3(-1, 1));
+            ranvec[i] = glm::normalize(random_vec3(rng, -1, 1));
         }
 
-        perm_x = perlin_generate_perm();
-        perm_y = perlin_generate_perm();
-        perm_z = perlin_generate_perm();
+        perm_x = perlin_generate_perm(rng);
+        perm_y = perlin_generate_perm(rng);
+        perm_z = perlin_generate_perm(rng);
     }
 
     ~perlin() {
@@ -58,20 +61,20 @@ private:
     int* perm_y;
     int* perm_z;
 
-    static int* perlin_generate_perm() {
+    static int* perlin_generate_perm(pcg32& rng) {
         auto p = new int[point_count];
 
         for (int i = 0; i < perlin::point_count; i++)
             p[i] = i;
 
-        permute(p, point_count);
+        permute(rng, p, point_count);
 
         return p;
     }
 
-    static void permute(int* p, int n) {
+    static void permute(pcg32& rng, int* p, int n) {
         for (int i = n - 1; i > 0; i--) {
-            int target = random_int(0, i);
+            int target = random_int(rng, 0, i);
             int tmp = p[i];
             p[i] = p[target];
             p[target] = tmp;
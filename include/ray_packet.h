@@ -0,0 +1,100 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "ray.h"
+
+// Rays traced together through an acceleration structure. Lanes whose bit is clear in
+// active are ignored, which lets partially filled packets cover tile edges.
+const int ray_packet_size = 8;
+
+struct ray_packet
+{
+    ray rays[ray_packet_size];
+    float t_max[ray_packet_size];
+    uint32_t active;
+};
+
+// Conservative bounds of every active ray in a packet, for rejecting a box for the whole
+// packet with interval arithmetic before testing rays one by one. Only usable when all
+// active rays point the same way along every axis, which holds for camera rays of
+// neighbouring pixels except where the view crosses an axis.
+struct packet_frustum
+{
+    glm::vec3 origin_min, origin_max;
+    glm::vec3 inv_dir_min, inv_dir_max;
+    int dir_is_neg[3];
+    bool valid;
+
+    packet_frustum(const ray_packet& packet)
+        : valid(packet.active != 0)
+    {
+        bool first = true;
+        for (int lane = 0; lane < ray_packet_size && valid; ++lane)
+        {
+            if (!(packet.active & (1u << lane))) continue;
+
+            const glm::vec3 o = packet.rays[lane].origin();
+            const glm::vec3 d = packet.rays[lane].direction();
+            for (int a = 0; a < 3; ++a)
+            {
+                // Axis-parallel rays would need inf * 0 in the interval products.
+                const float inv = 1.f / d[a];
+                if (!std::isfinite(inv)) valid = false;
+
+                const int neg = inv < 0.f;
+                if (first)
+                {
+                    origin_min[a] = origin_max[a] = o[a];
+                    inv_dir_min[a] = inv_dir_max[a] = inv;
+                    dir_is_neg[a] = neg;
+                }
+                else
+                {
+                    if (neg != dir_is_neg[a]) valid = false;
+                    origin_min[a] = o[a] < origin_min[a] ? o[a] : origin_min[a];
+                    origin_max[a] = o[a] > origin_max[a] ? o[a] : origin_max[a];
+                    inv_dir_min[a] = inv < inv_dir_min[a] ? inv : inv_dir_min[a];
+                    inv_dir_max[a] = inv > inv_dir_max[a] ? inv : inv_dir_max[a];
+                }
+            }
+            first = false;
+        }
+    }
+
+    // False only if no ray of the packet can enter [box_min, box_max] within [t_min, t_max].
+    bool may_hit(const glm::vec3& box_min, const glm::vec3& box_max, float t_min, float t_max) const
+    {
+        if (!valid) return true;
+
+        float enter = t_min;
+        float exit = t_max;
+        for (int a = 0; a < 3; ++a)
+        {
+            const float near_plane = dir_is_neg[a] ? box_max[a] : box_min[a];
+            const float far_plane = dir_is_neg[a] ? box_min[a] : box_max[a];
+
+            // Smallest possible entry and largest possible exit distance over the packet.
+            float n0 = (near_plane - origin_min[a]) * inv_dir_min[a];
+            float n1 = (near_plane - origin_min[a]) * inv_dir_max[a];
+            float n2 = (near_plane - origin_max[a]) * inv_dir_min[a];
+            float n3 = (near_plane - origin_max[a]) * inv_dir_max[a];
+            float f0 = (far_plane - origin_min[a]) * inv_dir_min[a];
+            float f1 = (far_plane - origin_min[a]) * inv_dir_max[a];
+            float f2 = (far_plane - origin_max[a]) * inv_dir_min[a];
+            float f3 = (far_plane - origin_max[a]) * inv_dir_max[a];
+
+            float near_lo = std::min(std::min(n0, n1), std::min(n2, n3));
+            float far_hi = std::max(std::max(f0, f1), std::max(f2, f3));
+
+            enter = near_lo > enter ? near_lo : enter;
+            exit = far_hi < exit ? far_hi : exit;
+        }
+        return enter <= exit;
+    }
+};
+
+#endif
@@ -0,0 +1,551 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "common.h"
+#include "camera.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "ray_packet.h"
+#include "scheduler.h"
+#include "wavefront.h"
+
+struct render_settings
+{
+    int width = 800;
+    int height = 600;
+    int samples_per_pixel = 10;
+    int max_depth = 10;
+    int roulette_depth = default_roulette_depth;
+    int tile_size = 32;
+    uint64_t seed = 0;
+    sampler_type sampler = sampler_type::random;
+
+    // Progressive rendering adds this many samples per pixel per pass, and stops early once
+    // the time budget is spent. A budget of 0 renders all samples_per_pixel.
+    int samples_per_pass = 1;
+    double time_budget_ms = 0.0;
+
+    // Adaptive sampling keeps samples_per_pixel as the average budget, but stops sampling a
+    // pixel once the relative standard error of its mean luminance falls below the threshold
+    // and gives the rest to noisy pixels, up to adaptive_max_samples each (0 for four times
+    // samples_per_pixel). No pixel is judged before adaptive_min_samples.
+    bool adaptive = false;
+    float adaptive_threshold = 0.02f;
+    int adaptive_min_samples = 8;
+    int adaptive_max_samples = 0;
+
+    // The wavefront integrator traces the samples of a tile in queues of paths whose state
+    // takes up to wavefront_queue_bytes, sized to stay in the L2 cache. With sort_rays it
+    // reorders bounce rays by direction and origin before tracing them.
+    integrator_type integrator = integrator_type::path;
+    size_t wavefront_queue_bytes = default_wavefront_queue_bytes;
+    bool sort_rays = true;
+};
+
+// Camera rays of a packet come from a packet_width x packet_height block of pixels.
+const int packet_width = 4;
+const int packet_height = ray_packet_size / packet_width;
+
+// Adaptive sampling pools the variance of each pixel with its neighbours this far away.
+const int adaptive_window_radius = 2;
+
+// Running float sums of radiance per pixel, bottom row first, along with how many samples
+// each pixel has and the sum of their squared luminance to estimate its variance.
+class accumulation_buffer
+{
+public:
+    accumulation_buffer(int width, int height)
+        : width(width), height(height), total_samples(0), max_samples(0),
+        sum(static_cast<size_t>(width) * height, glm::vec3(0, 0, 0)),
+        luminance_sq_sum(sum.size(), 0.f), samples(sum.size(), 0)
+    {}
+
+    void clear();
+
+    size_t pixel_count() const { return sum.size(); }
+    double average_samples() const { return sum.empty() ? 0.0 : double(total_samples) / sum.size(); }
+
+    // Relative standard error of the mean luminance of every pixel. The variance is pooled
+    // over the (2 * radius + 1)^2 pixels around it, since a pixel alone can show nothing but
+    // black for many samples next to fireflies. Infinite where there are under two samples.
+    void relative_errors(int radius, std::vector<float>& error) const;
+
+    // Averages, gamma corrects and clamps the sums into 8-bit RGB, laid out like sum.
+    void resolve(unsigned char* rgb) const;
+
+    // Sample count AOV, laid out like resolve: pixels ramp from dark blue through green to
+    // red as their share of max_samples grows.
+    void resolve_sample_heatmap(unsigned char* rgb) const;
+
+public:
+    int width;
+    int height;
+    uint64_t total_samples;
+    int max_samples; // most samples any one pixel has
+    std::vector<glm::vec3> sum;
+    std::vector<float> luminance_sq_sum;
+    std::vector<int> samples;
+};
+
+void accumulation_buffer::clear()
+{
+    std::fill(sum.begin(), sum.end(), glm::vec3(0, 0, 0));
+    std::fill(luminance_sq_sum.begin(), luminance_sq_sum.end(), 0.f);
+    std::fill(samples.begin(), samples.end(), 0);
+    total_samples = 0;
+    max_samples = 0;
+}
+
+void accumulation_buffer::relative_errors(int radius, std::vector<float>& error) const
+{
+    // Window sums of sample count, luminance and squared luminance, as two box filters.
+    // A NaN sample would stick in the running sums for the rest of the row, so pixels
+    // holding one are left out.
+    const size_t count = sum.size();
+    std::vector<glm::dvec3> pixel(count), rows(count), window(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const float l = luminance(sum[i]);
+        if (std::isfinite(l) && std::isfinite(luminance_sq_sum[i]))
+            pixel[i] = glm::dvec3(samples[i], l, luminance_sq_sum[i]);
+    }
+
+    for (int j = 0; j < height; ++j)
+    {
+        const size_t row = static_cast<size_t>(j) * width;
+        glm::dvec3 running(0, 0, 0);
+        for (int i = -radius; i < width; ++i)
+        {
+            const int add = i + radius;
+            const int drop = i - radius - 1;
+            if (add < width) running += pixel[row + add];
+            if (drop >= 0) running -= pixel[row + drop];
+            if (i >= 0) rows[row + i] = running;
+        }
+    }
+    for (int i = 0; i < width; ++i)
+    {
+        glm::dvec3 running(0, 0, 0);
+        for (int j = -radius; j < height; ++j)
+        {
+            const int add = j + radius;
+            const int drop = j - radius - 1;
+            if (add < height) running += rows[i + static_cast<size_t>(add) * width];
+            if (drop >= 0) running -= rows[i + static_cast<size_t>(drop) * width];
+            if (j >= 0) window[i + static_cast<size_t>(j) * width] = running;
+        }
+    }
+
+    error.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const double n = window[i].x;
+        if (samples[i] < 2 || n < 2)
+        {
+            error[i] = infinity;
+            continue;
+        }
+
+        const double mean = window[i].y / n;
+        const double variance = std::max(0.0, (window[i].z - mean * window[i].y) / (n - 1));
+
+        // Black regions that stay black are converged; the floor keeps near black ones from
+        // demanding samples for noise nobody can see.
+        error[i] = static_cast<float>(sqrt(variance / samples[i]) / std::max(mean, 1e-3));
+    }
+}
+
+void accumulation_buffer::resolve(unsigned char* rgb) const
+{
+    for (size_t i = 0; i < sum.size(); ++i)
+    {
+        const int pixel_samples = std::max(1, samples[i]);
+        glm::vec3 pixel_color = sum[i];
+
+        // A NaN sample poisons the whole channel, drop it rather than show garbage.
+        if (pixel_color.r != pixel_color.r) pixel_color.r = 0.0;
+        if (pixel_color.g != pixel_color.g) pixel_color.g = 0.0;
+        if (pixel_color.b != pixel_color.b) pixel_color.b = 0.0;
+
+        pixel_color.r = sqrt(pixel_color.r / pixel_samples);
+        pixel_color.g = sqrt(pixel_color.g / pixel_samples);
+        pixel_color.b = sqrt(pixel_color.b / pixel_samples);
+
+        pixel_color.r = clamp(pixel_color.r, 0.f, 0.999f);
+        pixel_color.g = clamp(pixel_color.g, 0.f, 0.999f);
+        pixel_color.b = clamp(pixel_color.b, 0.f, 0.999f);
+
+        unsigned char* pixel = &rgb[i * 3];
+        pixel[0] = pixel_color.r * 256;
+        pixel[1] = pixel_color.g * 256;
+        pixel[2] = pixel_color.b * 256;
+    }
+}
+
+void accumulation_buffer::resolve_sample_heatmap(unsigned char* rgb) const
+{
+    static const glm::vec3 ramp[] = {
+        glm::vec3(0.f, 0.f, 0.3f), glm::vec3(0.f, 0.5f, 1.f), glm::vec3(0.f, 0.8f, 0.f),
+        glm::vec3(1.f, 0.9f, 0.f), glm::vec3(1.f, 0.f, 0.f) };
+    const int stops = sizeof(ramp) / sizeof(ramp[0]);
+
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        const float t = max_samples > 0 ? float(samples[i]) / max_samples * (stops - 1) : 0.f;
+        const int k = std::min(static_cast<int>(t), stops - 2);
+        const glm::vec3 c = ramp[k] + (ramp[k + 1] - ramp[k]) * (t - k);
+
+        unsigned char* pixel = &rgb[i * 3];
+        pixel[0] = clamp(c.r, 0.f, 0.999f) * 256;
+        pixel[1] = clamp(c.g, 0.f, 0.999f) * 256;
+        pixel[2] = clamp(c.b, 0.f, 0.999f) * 256;
+    }
+}
+
+// Samples each pixel may still take: the rest of samples_per_pixel without adaptive
+// sampling, otherwise none once the pixel has converged.
+void pixel_sample_limits(const render_settings& settings, const accumulation_buffer& accum, std::vector<int>& limits)
+{
+    limits.resize(accum.pixel_count());
+    if (!settings.adaptive)
+    {
+        for (size_t i = 0; i < limits.size(); ++i)
+            limits[i] = settings.samples_per_pixel - accum.samples[i];
+        return;
+    }
+
+    const int max_samples = settings.adaptive_max_samples > 0
+        ? settings.adaptive_max_samples : 4 * settings.samples_per_pixel;
+    const int min_samples = std::max(2, settings.adaptive_min_samples);
+
+    std::vector<float> error;
+    accum.relative_errors(adaptive_window_radius, error);
+    for (size_t i = 0; i < limits.size(); ++i)
+    {
+        const int n = accum.samples[i];
+        const bool converged = n >= min_samples && !(error[i] > settings.adaptive_threshold);
+        limits[i] = converged ? 0 : max_samples - n;
+    }
+}
+
+// Adds up to sample_count more samples to every pixel that still takes them, continuing
+// each pixel's sample sequence. Samples are seeded by index, so any split into passes gives
+// the same sums. Returns the number of pixels sampled.
+size_t render_pass(const render_settings& settings, const hittable& world, const light_set* lights,
+    const Camera& camera, const glm::vec3& background, thread_pool& pool, tile_scheduler& scheduler,
+    accumulation_buffer& accum, int sample_count)
+{
+    const int image_width = settings.width;
+    const int image_height = settings.height;
+    std::atomic<size_t> pixels_sampled(0);
+    std::atomic<uint64_t> samples_taken(0);
+
+    // Decided for the whole image up front, as the error estimates read pixels of other tiles.
+    std::vector<int> limits;
+    pixel_sample_limits(settings, accum, limits);
+    const size_t queue_capacity = wavefront_queue::capacity_for(settings.wavefront_queue_bytes);
+
+    scheduler.render(pool, [&](const render_tile& tile)
+    {
+        // Each tile sums into a private buffer and adds it to the image row by row, so workers
+        // never write to cache lines of the shared buffer while they are still sampling.
+        const int tile_width = tile.x1 - tile.x0;
+        const int tile_height = tile.y1 - tile.y0;
+        std::vector<glm::vec3> tile_color(tile_width * tile_height, glm::vec3(0, 0, 0));
+        std::vector<float> tile_luminance_sq(tile_width * tile_height, 0.f);
+
+        // Samples each pixel takes in this pass. Only this tile touches its pixels, so the
+        // shared counts are safe to read until the tile adds its sums.
+        std::vector<int> tile_samples(tile_width * tile_height);
+        int tile_max_samples = 0;
+        for (int j = tile.y0; j < tile.y1; ++j)
+        {
+            for (int i = tile.x0; i < tile.x1; ++i)
+            {
+                const size_t pixel = i + static_cast<size_t>(j) * image_width;
+                const int n = std::max(0, std::min(sample_count, limits[pixel]));
+                tile_samples[(i - tile.x0) + (j - tile.y0) * tile_width] = n;
+                tile_max_samples = std::max(tile_max_samples, n);
+            }
+        }
+
+        // Starts the sample_index-th sample of pixel (i, j), continuing the pixel's sequence,
+        // and returns its camera ray. Shading picks up the sample's random sequence and sampler
+        // dimensions where the jitter left them.
+        auto start_sample = [&](int i, int j, int s)
+        {
+            const size_t pixel = i + static_cast<size_t>(j) * image_width;
+            const int sample_index = accum.samples[pixel] + s;
+            seed_sample_rng(settings.seed, pixel, sample_index);
+            thread_sampler().start_sample(settings.sampler, settings.seed, i, j, pixel, sample_index, settings.samples_per_pixel);
+
+            const glm::vec2 jitter = sample_2d();
+            auto u = (i + jitter.x) / (image_width - 1);
+            auto v = (j + jitter.y) / (image_height - 1);
+            return camera.GetRay(u, v);
+        };
+
+        auto add_sample = [&](int local, const glm::vec3& color)
+        {
+            const float l = luminance(color);
+            tile_color[local] += color;
+            tile_luminance_sq[local] += l * l;
+        };
+
+        if (settings.integrator == integrator_type::wavefront)
+        {
+            // Queued one sample of every pixel after another, so each pixel adds up its
+            // samples in the same order as with packets and the sums come out the same.
+            wavefront_queue& queue = thread_wavefront_queue();
+            queue.reset(queue_capacity);
+            queue.sort_rays = settings.sort_rays;
+            std::vector<int> queued_pixels;
+            queued_pixels.reserve(queue_capacity);
+
+            auto flush = [&]()
+            {
+                queue.run(world, lights, background, settings.max_depth, settings.roulette_depth);
+                for (size_t k = 0; k < queue.size(); ++k)
+                    add_sample(queued_pixels[k], queue.radiance(k));
+                queue.reset(queue_capacity);
+                queued_pixels.clear();
+            };
+
+            for (int s = 0; s < tile_max_samples; ++s)
+            {
+                for (int j = tile.y0; j < tile.y1; ++j)
+                {
+                    for (int i = tile.x0; i < tile.x1; ++i)
+                    {
+                        const int local = (i - tile.x0) + (j - tile.y0) * tile_width;
+                        if (s >= tile_samples[local]) continue;
+
+                        queue.push(start_sample(i, j, s));
+                        queued_pixels.push_back(local);
+                        if (queue.full())
+                            flush();
+                    }
+                }
+            }
+            if (queue.size() > 0)
+                flush();
+        }
+        else
+        {
+            // Camera rays of neighbouring pixels are traced as one packet, and so are the
+            // shadow rays of their first bounce. Each path then continues on its own.
+            ray_packet packet;
+            hit_record recs[ray_packet_size];
+            pcg32 lane_rng[ray_packet_size];
+            sampler lane_sampler[ray_packet_size];
+            int lane_pixel[ray_packet_size];
+            path_state lane_path[ray_packet_size];
+            ray lane_next[ray_packet_size];
+            ray_packet shadows;
+            glm::vec3 shadow_contribution[ray_packet_size];
+
+            for (int s = 0; s < tile_max_samples; ++s)
+            {
+                for (int y = tile.y0; y < tile.y1; y += packet_height)
+                {
+                    for (int x = tile.x0; x < tile.x1; x += packet_width)
+                    {
+                        packet.active = 0;
+                        for (int lane = 0; lane < ray_packet_size; ++lane)
+                        {
+                            const int i = x + lane % packet_width;
+                            const int j = y + lane / packet_width;
+                            if (i >= tile.x1 || j >= tile.y1) continue;
+
+                            const int local = (i - tile.x0) + (j - tile.y0) * tile_width;
+                            if (s >= tile_samples[local]) continue;
+
+                            packet.rays[lane] = start_sample(i, j, s);
+                            packet.t_max[lane] = infinity;
+                            packet.active |= 1u << lane;
+
+                            lane_rng[lane] = thread_rng();
+                            lane_sampler[lane] = thread_sampler();
+                            lane_pixel[lane] = local;
+                        }
+                        if (!packet.active) continue;
+
+                        const uint32_t hits = world.hit_packet(packet, 0.001f, recs);
+
+                        // First bounce of every lane that hit, as shade_hit would shade it but
+                        // with the shadow rays collected.
+                        shadows.active = 0;
+                        uint32_t more = 0;
+                        for (int lane = 0; lane < ray_packet_size; ++lane)
+                        {
+                            if (!(packet.active & (1u << lane))) continue;
+                            if (!(hits & (1u << lane)))
+                            {
+                                add_sample(lane_pixel[lane], escaped_radiance(packet.rays[lane], background, lights));
+                                continue;
+                            }
+
+                            thread_rng() = lane_rng[lane];
+                            thread_sampler() = lane_sampler[lane];
+                            lane_path[lane] = path_state();
+                            recs[lane].resolve(packet.rays[lane]);
+
+                            shadow_ray shadow;
+                            if (shade_bounce(lane_path[lane], packet.rays[lane], recs[lane], lights, settings.max_depth, settings.roulette_depth, lane_next[lane], shadow))
+                                more |= 1u << lane;
+                            if (shadow.active)
+                            {
+                                shadows.rays[lane] = shadow.r;
+                                shadows.t_max[lane] = shadow.t_max;
+                                shadow_contribution[lane] = shadow.contribution;
+                                shadows.active |= 1u << lane;
+                            }
+
+                            lane_rng[lane] = thread_rng();
+                            lane_sampler[lane] = thread_sampler();
+                        }
+
+                        const uint32_t blocked = shadows.active ? world.occluded_packet(shadows, 0.001f) : 0;
+                        for (int lane = 0; lane < ray_packet_size; ++lane)
+                        {
+                            if (!(packet.active & hits & (1u << lane))) continue;
+
+                            path_state& path = lane_path[lane];
+                            if ((shadows.active & ~blocked) & (1u << lane))
+                                path.radiance += shadow_contribution[lane];
+                            if (more & (1u << lane))
+                            {
+                                thread_rng() = lane_rng[lane];
+                                thread_sampler() = lane_sampler[lane];
+                                continue_path(path, lane_next[lane], background, world, lights, settings.max_depth, settings.roulette_depth);
+                            }
+                            add_sample(lane_pixel[lane], path.radiance);
+                        }
+                    }
+                }
+            }
+        }
+
+        size_t tile_pixels = 0;
+        uint64_t tile_total = 0;
+        for (int j = tile.y0; j < tile.y1; ++j)
+        {
+            const size_t row = tile.x0 + static_cast<size_t>(j) * image_width;
+            const int local_row = (j - tile.y0) * tile_width;
+            for (int i = 0; i < tile_width; ++i)
+            {
+                const int n = tile_samples[local_row + i];
+                if (n == 0) continue;
+
+                accum.sum[row + i] += tile_color[local_row + i];
+                accum.luminance_sq_sum[row + i] += tile_luminance_sq[local_row + i];
+                accum.samples[row + i] += n;
+                ++tile_pixels;
+                tile_total += n;
+            }
+        }
+        pixels_sampled += tile_pixels;
+        samples_taken += tile_total;
+    });
+
+    accum.total_samples += samples_taken;
+    accum.max_samples = *std::max_element(accum.samples.begin(), accum.samples.end());
+    return pixels_sampled;
+}
+
+// Renders all samples_per_pixel samples in one pass into rgb, settings.width * settings.height
+// gamma corrected 8-bit RGB pixels with the bottom row first as OpenGL textures expect.
+// The scheduler must cover the same size.
+void render_image(const render_settings& settings, const hittable& world, const light_set* lights,
+    const Camera& camera, const glm::vec3& background, thread_pool& pool, tile_scheduler& scheduler, unsigned char* rgb)
+{
+    accumulation_buffer accum(settings.width, settings.height);
+    render_pass(settings, world, lights, camera, background, pool, scheduler, accum, settings.samples_per_pixel);
+    accum.resolve(rgb);
+}
+
+// Refines an image pass by pass, so a preview is available after the first pass and the
+// render can stop at the spp target, when adaptive sampling has converged every pixel or
+// when the time budget runs out.
+class progressive_render
+{
+public:
+    progressive_render(const render_settings& settings, const hittable& world, const light_set* lights,
+        const Camera& camera, const glm::vec3& background, thread_pool& pool);
+
+    // Adds one pass of up to settings.samples_per_pass samples to every pixel that still
+    // takes them. Returns false without rendering once the target is reached or the next
+    // pass would overrun the time budget.
+    bool step();
+    bool finished() const;
+
+    const accumulation_buffer& get_buffer() const { return accum; }
+    const tile_scheduler& get_scheduler() const { return scheduler; } // timings of the last pass
+    int get_pass_count() const { return pass_count; }
+    double get_elapsed_ms() const { return elapsed_ms; }
+    size_t get_active_pixels() const { return active_pixels; } // pixels sampled by the last pass
+
+private:
+    render_settings settings;
+    const hittable& world;
+    const light_set* lights;
+    const Camera& camera;
+    glm::vec3 background;
+    thread_pool& pool;
+    tile_scheduler scheduler;
+    accumulation_buffer accum;
+    int pass_count;
+    double elapsed_ms;
+    size_t active_pixels;
+    bool converged;
+};
+
+progressive_render::progressive_render(const render_settings& settings, const hittable& world, const light_set* lights,
+    const Camera& camera, const glm::vec3& background, thread_pool& pool)
+    : settings(settings), world(world), lights(lights), camera(camera), background(background), pool(pool),
+    scheduler(settings.width, settings.height, settings.tile_size), accum(settings.width, settings.height),
+    pass_count(0), elapsed_ms(0.0), active_pixels(accum.pixel_count()), converged(false)
+{}
+
+bool progressive_render::finished() const
+{
+    // Adaptive sampling moves samples between pixels, so the target is the image total.
+    if (converged || accum.total_samples >= static_cast<uint64_t>(settings.samples_per_pixel) * accum.pixel_count())
+        return true;
+
+    // Stop early if another pass of average length would not fit the budget, the first pass
+    // always runs so there is something to show.
+    if (settings.time_budget_ms > 0.0 && pass_count > 0)
+        return elapsed_ms + elapsed_ms / pass_count > settings.time_budget_ms;
+
+    return false;
+}
+
+bool progressive_render::step()
+{
+    if (finished())
+        return false;
+
+    const size_t sampled = render_pass(settings, world, lights, camera, background, pool, scheduler, accum,
+        std::max(1, settings.samples_per_pass));
+    if (sampled == 0)
+    {
+        converged = true;
+        return false;
+    }
+
+    active_pixels = sampled;
+    ++pass_count;
+    elapsed_ms += scheduler.get_total_ms();
+    return true;
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// PCG32 (O'Neill, pcg-random.org): 64 bits of state, 32-bit output, cheap to copy and reseed.
+class pcg32
+{
+public:
+    pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+    explicit pcg32(uint64_t init_state, uint64_t init_seq = 0xda3e39cb94b95bdbULL) { seed(init_state, init_seq); }
+
+    void seed(uint64_t init_state, uint64_t init_seq = 0xda3e39cb94b95bdbULL)
+    {
+        state = 0u;
+        inc = (init_seq << 1u) | 1u;
+        next_uint();
+        state += init_state;
+        next_uint();
+    }
+
+    uint32_t next_uint()
+    {
+        uint64_t old_state = state;
+        state = old_state * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = static_cast<uint32_t>(((old_state >> 18u) ^ old_state) >> 27u);
+        uint32_t rot = static_cast<uint32_t>(old_state >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31u));
+    }
+
+    float next_float()
+    {
+        // Top 24 bits so the result is exactly representable and strictly below 1.
+        return (next_uint() >> 8) * (1.0f / 16777216.0f);
+    }
+
+private:
+    uint64_t state;
+    uint64_t inc;
+};
+
+// splitmix64 finalizer, used to turn (seed, pixel, sample) counters into decorrelated states.
+inline uint64_t mix_bits(uint64_t v)
+{
+    v ^= v >> 30;
+    v *= 0xbf58476d1ce4e5b9ULL;
+    v ^= v >> 27;
+    v *= 0x94d049bb133111ebULL;
+    v ^= v >> 31;
+    return v;
+}
+
+inline uint64_t hash_counters(uint64_t seed, uint64_t a, uint64_t b = 0)
+{
+    return mix_bits(seed ^ mix_bits(a ^ mix_bits(b + 0x9e3779b97f4a7c15ULL)));
+}
+
+// Generator behind random_float() and friends. Every thread owns one, so there is no
+// shared state between workers.
+inline pcg32& thread_rng()
+{
+    static thread_local pcg32 rng;
+    return rng;
+}
+
+// Restarts the calling thread's generator for one camera sample. The image only depends on
+// (seed, pixel, sample), not on which thread or in which order the samples are taken.
+inline void seed_sample_rng(uint64_t seed, uint64_t pixel_index, uint64_t sample_index)
+{
+    thread_rng().seed(hash_counters(seed, pixel_index, sample_index), pixel_index);
+}
+
+#endif
@@ -116,7 +116,7 @@ private:
 class noise_texture : public rttexture {
 public:
     noise_texture(): scale(1.f) {}
-    noise_texture(float sc) : scale(sc) {}
+    noise_texture(float sc, uint64_t seed = 0) : noise(seed), scale(sc) {}
 
     virtual glm::vec3 value(float u, float v, const glm::vec3& p) const override 
     {
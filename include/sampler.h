@@ -0,0 +1,389 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "rng.h"
+
+// Where the sample values of a path come from. random draws every dimension independently
+// from the thread's generator; the others spread the samples of a pixel evenly over each
+// dimension so images converge with fewer samples.
+enum class sampler_type
+{
+    random,
+    stratified, // jittered strata, shuffled per pixel and dimension
+    sobol,      // Owen scrambled Sobol points, scrambled per pixel and dimension
+    blue_noise  // one Sobol sequence for all pixels, shifted by a blue noise mask
+};
+
+const char* const sampler_names[] = { "random", "stratified", "sobol", "blue_noise" };
+
+inline bool parse_sampler_type(const std::string& name, sampler_type& type)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        if (name == sampler_names[i])
+        {
+            type = static_cast<sampler_type>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+inline uint32_t reverse_bits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Owen scrambling by hashing, after Burley, "Practical Hash-based Owen Scrambling" (JCGT 2020).
+// The hash only lets higher bits affect lower ones, so on reversed bits it scrambles each
+// level of the binary subdivision without breaking the stratification of the points.
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed)
+{
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1u;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return x;
+}
+
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+// First two dimensions of the Sobol sequence as 32-bit fractions: the van der Corput
+// sequence and the dimension with primitive polynomial x + 1.
+inline uint32_t sobol_sample(uint32_t index, int dimension)
+{
+    if (dimension == 0)
+        return reverse_bits(index);
+
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+    {
+        if (index & 1u)
+            result ^= v;
+    }
+    return result;
+}
+
+// Element i of a random permutation of [0, n) chosen by seed, without storing it.
+// Kensler, "Correlated Multi-Jittered Sampling" (Pixar 2013).
+inline uint32_t permute_index(uint32_t i, uint32_t n, uint32_t seed)
+{
+    uint32_t w = n - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do
+    {
+        i ^= seed;
+        i *= 0xe170893du;
+        i ^= seed >> 16;
+        i ^= (i & w) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929eb3fu;
+        i ^= seed >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1u | seed >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= n);
+    return (i + seed) % n;
+}
+
+// Top 24 bits of a 32-bit fraction, exactly representable and strictly below 1.
+inline float bits_to_float(uint32_t bits)
+{
+    return (bits >> 8) * (1.0f / 16777216.0f);
+}
+
+const int blue_noise_size = 64;
+
+// Tileable size x size threshold mask by void and cluster (Ulichney 1993): every value in
+// [0, 1) appears once, and the pixels below any threshold are spread out evenly.
+std::vector<float> make_blue_noise_mask(int size, uint64_t seed)
+{
+    const int n = size * size;
+    const float sigma = 1.5f;
+
+    // Gaussian of the wrapped distance to every offset, so the mask tiles without seams.
+    std::vector<float> kernel(n);
+    for (int dy = 0; dy < size; ++dy)
+    {
+        for (int dx = 0; dx < size; ++dx)
+        {
+            const int wx = std::min(dx, size - dx);
+            const int wy = std::min(dy, size - dy);
+            kernel[dy * size + dx] = std::exp(-(wx * wx + wy * wy) / (2 * sigma * sigma));
+        }
+    }
+
+    // Energy is how crowded each pixel's neighbourhood is by the set pixels.
+    auto splat = [&](std::vector<float>& energy, int p, float sign)
+    {
+        const int px = p % size;
+        const int py = p / size;
+        for (int y = 0; y < size; ++y)
+        {
+            const float* row = &kernel[((y - py + size) % size) * size];
+            for (int x = 0; x < size; ++x)
+                energy[y * size + x] += sign * row[(x - px + size) % size];
+        }
+    };
+    auto tightest_cluster = [&](const std::vector<float>& energy, const std::vector<char>& set)
+    {
+        int best = -1;
+        for (int i = 0; i < n; ++i)
+            if (set[i] && (best < 0 || energy[i] > energy[best])) best = i;
+        return best;
+    };
+    auto largest_void = [&](const std::vector<float>& energy, const std::vector<char>& set)
+    {
+        int best = -1;
+        for (int i = 0; i < n; ++i)
+            if (!set[i] && (best < 0 || energy[i] < energy[best])) best = i;
+        return best;
+    };
+
+    // Random initial pattern of a tenth of the pixels, relaxed by moving the point in the
+    // tightest cluster to the largest void until that puts it back where it was.
+    pcg32 rng(seed);
+    std::vector<char> initial(n, 0);
+    std::vector<float> initial_energy(n, 0.f);
+    const int ones = std::max(1, n / 10);
+    for (int placed = 0; placed < ones; )
+    {
+        const int p = static_cast<int>(rng.next_uint() % n);
+        if (initial[p]) continue;
+        initial[p] = 1;
+        splat(initial_energy, p, 1.f);
+        ++placed;
+    }
+    for (int iteration = 0; iteration < n; ++iteration)
+    {
+        const int cluster = tightest_cluster(initial_energy, initial);
+        initial[cluster] = 0;
+        splat(initial_energy, cluster, -1.f);
+
+        const int hole = largest_void(initial_energy, initial);
+        initial[hole] = 1;
+        splat(initial_energy, hole, 1.f);
+        if (hole == cluster) break;
+    }
+
+    std::vector<int> rank(n, 0);
+
+    // Ranks below the initial pattern: take points out of the tightest clusters.
+    std::vector<char> set = initial;
+    std::vector<float> energy = initial_energy;
+    for (int r = ones - 1; r >= 0; --r)
+    {
+        const int p = tightest_cluster(energy, set);
+        set[p] = 0;
+        splat(energy, p, -1.f);
+        rank[p] = r;
+    }
+
+    // Up to half full: fill the largest voids.
+    set = initial;
+    energy = initial_energy;
+    int r = ones;
+    for (; r < n / 2; ++r)
+    {
+        const int p = largest_void(energy, set);
+        set[p] = 1;
+        splat(energy, p, 1.f);
+        rank[p] = r;
+    }
+
+    // Past half, the unset pixels are the minority; fill the tightest clusters among them.
+    std::fill(energy.begin(), energy.end(), 0.f);
+    for (int i = 0; i < n; ++i)
+        if (!set[i]) splat(energy, i, 1.f);
+    for (; r < n; ++r)
+    {
+        int p = -1;
+        for (int i = 0; i < n; ++i)
+            if (!set[i] && (p < 0 || energy[i] > energy[p])) p = i;
+        set[p] = 1;
+        splat(energy, p, -1.f);
+        rank[p] = r;
+    }
+
+    std::vector<float> mask(n);
+    for (int i = 0; i < n; ++i)
+        mask[i] = (rank[i] + 0.5f) / n;
+    return mask;
+}
+
+// Built on first use, the static local makes that safe across workers.
+inline const std::vector<float>& blue_noise_mask()
+{
+    static const std::vector<float> mask = make_blue_noise_mask(blue_noise_size, 0x2545f4914f6cdd1dULL);
+    return mask;
+}
+
+// Hands out the sample values of one camera sample, one dimension after another. Every
+// call to get_1d or get_2d moves to the next dimension, so a path asks for them in the
+// same order as long as it takes the same decisions.
+class sampler
+{
+public:
+    sampler() : type(sampler_type::random), seed(0), x(0), y(0), pixel_index(0), sample_index(0), samples_per_pixel(1), dimension(0) {}
+
+    // samples_per_pixel sets the number of strata for the stratified sampler.
+    void start_sample(sampler_type type, uint64_t seed, int x, int y, uint64_t pixel_index, uint32_t sample_index, int samples_per_pixel)
+    {
+        this->type = type;
+        this->seed = seed;
+        this->x = x;
+        this->y = y;
+        this->pixel_index = pixel_index;
+        this->sample_index = sample_index;
+        this->samples_per_pixel = samples_per_pixel > 0 ? samples_per_pixel : 1;
+        dimension = 0;
+    }
+
+    float get_1d();
+    glm::vec2 get_2d();
+
+private:
+    static float random_jitter()
+    {
+        return thread_rng().next_float();
+    }
+
+    uint32_t dimension_hash(uint32_t d, uint64_t salt, bool per_pixel) const
+    {
+        return static_cast<uint32_t>(hash_counters(seed, per_pixel ? pixel_index : ~0ULL, (static_cast<uint64_t>(d) << 8) | salt));
+    }
+
+    float blue_noise_shift(uint32_t d, uint64_t salt) const
+    {
+        // Every dimension reads the mask at its own wrapped offset, so they don't correlate.
+        const uint32_t offset = dimension_hash(d, salt, false);
+        const int mx = (x + static_cast<int>(offset & 0xffffu)) % blue_noise_size;
+        const int my = (y + static_cast<int>(offset >> 16)) % blue_noise_size;
+        return blue_noise_mask()[my * blue_noise_size + mx];
+    }
+
+public:
+    sampler_type type;
+    uint64_t seed;
+    int x, y;
+    uint64_t pixel_index;
+    uint32_t sample_index;
+    int samples_per_pixel;
+    uint32_t dimension;
+};
+
+float sampler::get_1d()
+{
+    const uint32_t d = dimension++;
+    switch (type)
+    {
+    case sampler_type::stratified:
+    {
+        // Samples past samples_per_pixel start another shuffled round of strata.
+        const uint32_t n = static_cast<uint32_t>(samples_per_pixel);
+        const uint32_t stratum = permute_index(sample_index % n, n, dimension_hash(d, sample_index / n, true));
+        return (stratum + random_jitter()) / n;
+    }
+    case sampler_type::sobol:
+    {
+        const uint32_t index = nested_uniform_scramble(sample_index, dimension_hash(d, 0, true));
+        return bits_to_float(nested_uniform_scramble(sobol_sample(index, 0), dimension_hash(d, 1, true)));
+    }
+    case sampler_type::blue_noise:
+    {
+        const uint32_t index = nested_uniform_scramble(sample_index, dimension_hash(d, 0, false));
+        const float value = bits_to_float(nested_uniform_scramble(sobol_sample(index, 0), dimension_hash(d, 1, false)));
+        const float shifted = value + blue_noise_shift(d, 2);
+        return shifted < 1.f ? shifted : shifted - 1.f;
+    }
+    default:
+        return thread_rng().next_float();
+    }
+}
+
+glm::vec2 sampler::get_2d()
+{
+    const uint32_t d = dimension++;
+    switch (type)
+    {
+    case sampler_type::stratified:
+    {
+        // A grid of at least samples_per_pixel cells, each sample in a different one.
+        const uint32_t n = static_cast<uint32_t>(samples_per_pixel);
+        const uint32_t columns = std::max(1u, static_cast<uint32_t>(std::sqrt(float(n))));
+        const uint32_t rows = (n + columns - 1) / columns;
+        const uint32_t cell = permute_index(sample_index % n, columns * rows, dimension_hash(d, sample_index / n, true));
+        const float jitter_x = random_jitter();
+        const float jitter_y = random_jitter();
+        return glm::vec2((cell % columns + jitter_x) / columns, (cell / columns + jitter_y) / rows);
+    }
+    case sampler_type::sobol:
+    {
+        const uint32_t index = nested_uniform_scramble(sample_index, dimension_hash(d, 0, true));
+        return glm::vec2(bits_to_float(nested_uniform_scramble(sobol_sample(index, 0), dimension_hash(d, 1, true))),
+            bits_to_float(nested_uniform_scramble(sobol_sample(index, 1), dimension_hash(d, 2, true))));
+    }
+    case sampler_type::blue_noise:
+    {
+        const uint32_t index = nested_uniform_scramble(sample_index, dimension_hash(d, 0, false));
+        float u = bits_to_float(nested_uniform_scramble(sobol_sample(index, 0), dimension_hash(d, 1, false))) + blue_noise_shift(d, 3);
+        float v = bits_to_float(nested_uniform_scramble(sobol_sample(index, 1), dimension_hash(d, 2, false))) + blue_noise_shift(d, 4);
+        return glm::vec2(u < 1.f ? u : u - 1.f, v < 1.f ? v : v - 1.f);
+    }
+    default:
+    {
+        const float u = thread_rng().next_float();
+        const float v = thread_rng().next_float();
+        return glm::vec2(u, v);
+    }
+    }
+}
+
+// Sampler of the camera sample the calling thread is working on. Like thread_rng() it is
+// per thread; the renderer restarts it for every camera sample.
+inline sampler& thread_sampler()
+{
+    static thread_local sampler s;
+    return s;
+}
+
+inline float sample_1d()
+{
+    return thread_sampler().get_1d();
+}
+
+inline glm::vec2 sample_2d()
+{
+    return thread_sampler().get_2d();
+}
+
+#endif
@@ -0,0 +1,459 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "common.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "rttexture.h"
+#include "triangle_mesh.h"
+
+// Binary scene cache: triangle meshes with their flattened BVHs and materials, laid out so
+// that a mapped file is rendered in place. Every array starts on a 64-byte boundary of the
+// file and holds exactly what mesh_view and linear_bvh_node point at, so loading is
+// checking the header and taking pointers. The layout is native: a cache only loads on
+// machines with the byte order and node size it was written with.
+//
+//   scene_cache_header
+//   scene_cache_mesh[mesh_count]
+//   scene_cache_material[material_count]
+//   string table, NUL terminated texture paths
+//   per mesh: px py pz nx ny nz tu tv, position, normal and uv indices, BVH nodes
+
+const char scene_cache_magic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+const uint32_t scene_cache_version = 1;
+const uint32_t scene_cache_byte_order = 0x01020304;
+const uint32_t scene_cache_no_texture = 0xffffffffu;
+const size_t scene_cache_alignment = 64;
+
+enum class scene_cache_material_type : uint32_t
+{
+    lambertian,
+    metal,
+    dielectric,
+    diffuse_light
+};
+
+struct scene_cache_material
+{
+    uint32_t type;    // scene_cache_material_type
+    float color[3];   // albedo or emitted light
+    float parameter;  // fuzz of metal, index of refraction of dielectric
+    uint32_t texture; // offset of the image path in the string table or scene_cache_no_texture
+};
+
+// Offset from the start of the file and element count.
+struct scene_cache_array
+{
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct scene_cache_mesh
+{
+    scene_cache_array px, py, pz;
+    scene_cache_array nx, ny, nz;
+    scene_cache_array tu, tv;
+    scene_cache_array position_indices, normal_indices, uv_indices;
+    scene_cache_array nodes;
+    float box_minimum[3];
+    float box_maximum[3];
+    uint32_t material;
+    uint32_t pad;
+};
+
+struct scene_cache_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t node_size;
+    uint32_t pad;
+    uint64_t file_size;
+    uint64_t checksum; // of every byte after the header
+    scene_cache_array meshes;
+    scene_cache_array materials;
+    scene_cache_array strings;
+};
+
+// 64-bit hash of a byte stream with the rounds of xxHash64 over four lanes, so that
+// checking a cache of gigabytes at startup runs near memory bandwidth.
+class scene_cache_hasher
+{
+public:
+    scene_cache_hasher() : pending_size(0), total(0)
+    {
+        lanes[0] = prime1 + prime2;
+        lanes[1] = prime2;
+        lanes[2] = 0;
+        lanes[3] = 0 - prime1;
+    }
+
+    void update(const void* data, size_t size);
+    uint64_t finish() const;
+
+private:
+    static const uint64_t prime1 = 0x9E3779B185EBCA87ull;
+    static const uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+    static const uint64_t prime3 = 0x165667B19E3779F9ull;
+    static const uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    static uint64_t round(uint64_t lane, uint64_t word) { return rotl(lane + word * prime2, 31) * prime1; }
+    static uint64_t read64(const unsigned char* p) { uint64_t w; std::memcpy(&w, p, 8); return w; }
+
+    void block(const unsigned char* p)
+    {
+        lanes[0] = round(lanes[0], read64(p));
+        lanes[1] = round(lanes[1], read64(p + 8));
+        lanes[2] = round(lanes[2], read64(p + 16));
+        lanes[3] = round(lanes[3], read64(p + 24));
+    }
+
+    uint64_t lanes[4];
+    unsigned char pending[32];
+    size_t pending_size;
+    uint64_t total;
+};
+
+void scene_cache_hasher::update(const void* data, size_t size)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    total += size;
+
+    if (pending_size > 0)
+    {
+        const size_t take = std::min(size, sizeof(pending) - pending_size);
+        std::memcpy(pending + pending_size, p, take);
+        pending_size += take;
+        p += take;
+        size -= take;
+        if (pending_size < sizeof(pending))
+            return;
+        block(pending);
+        pending_size = 0;
+    }
+
+    for (; size >= 32; p += 32, size -= 32)
+        block(p);
+
+    std::memcpy(pending, p, size);
+    pending_size = size;
+}
+
+uint64_t scene_cache_hasher::finish() const
+{
+    uint64_t h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+    for (int i = 0; i < 4; ++i)
+        h = (h ^ round(0, lanes[i])) * prime1 + prime4;
+    h += total;
+
+    size_t i = 0;
+    for (; i + 8 <= pending_size; i += 8)
+        h = rotl(h ^ round(0, read64(pending + i)), 27) * prime1 + prime4;
+    for (; i < pending_size; ++i)
+        h = rotl(h ^ (pending[i] * (prime1 >> 32)), 11) * prime1;
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+// A mesh to store and its material; the texture path replaces material.texture.
+struct scene_cache_source
+{
+    const triangle_mesh* mesh;
+    scene_cache_material material;
+    std::string texture;
+};
+
+inline uint64_t scene_cache_align(uint64_t offset)
+{
+    return (offset + scene_cache_alignment - 1) / scene_cache_alignment * scene_cache_alignment;
+}
+
+// Writes sections in file order, hashing everything after the header and filling the
+// alignment gaps with zeros.
+class scene_cache_writer
+{
+public:
+    scene_cache_writer(FILE* f) : file(f), offset(0), ok(true) {}
+
+    void write(const void* data, size_t size, bool hash = true)
+    {
+        if (size == 0) return;
+        ok = ok && std::fwrite(data, 1, size, file) == size;
+        if (hash) hasher.update(data, size);
+        offset += size;
+    }
+
+    void pad_to(uint64_t target)
+    {
+        static const unsigned char zeros[scene_cache_alignment] = {};
+        while (offset < target)
+            write(zeros, static_cast<size_t>(std::min<uint64_t>(target - offset, sizeof(zeros))));
+    }
+
+    FILE* file;
+    uint64_t offset;
+    bool ok;
+    scene_cache_hasher hasher;
+};
+
+bool write_scene_cache(const std::string& path, const std::vector<scene_cache_source>& sources)
+{
+    scene_cache_header header = {};
+    std::memcpy(header.magic, scene_cache_magic, sizeof(header.magic));
+    header.version = scene_cache_version;
+    header.byte_order = scene_cache_byte_order;
+    header.node_size = sizeof(linear_bvh_node);
+
+    std::vector<scene_cache_mesh> meshes(sources.size());
+    std::vector<scene_cache_material> materials(sources.size());
+    std::string strings;
+
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        materials[i] = sources[i].material;
+        materials[i].texture = scene_cache_no_texture;
+        if (!sources[i].texture.empty())
+        {
+            materials[i].texture = static_cast<uint32_t>(strings.size());
+            strings += sources[i].texture;
+            strings += '\0';
+        }
+    }
+
+    // Lay the file out before writing any of it.
+    uint64_t offset = sizeof(scene_cache_header);
+    auto place = [&](scene_cache_array& a, uint64_t count, size_t element_size)
+    {
+        offset = scene_cache_align(offset);
+        a.offset = offset;
+        a.count = count;
+        offset += count * element_size;
+    };
+
+    place(header.meshes, meshes.size(), sizeof(scene_cache_mesh));
+    place(header.materials, materials.size(), sizeof(scene_cache_material));
+    place(header.strings, strings.size(), 1);
+
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        const triangle_mesh& source = *sources[i].mesh;
+        const mesh_view& v = source.view;
+        scene_cache_mesh& m = meshes[i];
+
+        place(m.px, v.vertex_count, sizeof(float));
+        place(m.py, v.vertex_count, sizeof(float));
+        place(m.pz, v.vertex_count, sizeof(float));
+        place(m.nx, v.normal_count, sizeof(float));
+        place(m.ny, v.normal_count, sizeof(float));
+        place(m.nz, v.normal_count, sizeof(float));
+        place(m.tu, v.uv_count, sizeof(float));
+        place(m.tv, v.uv_count, sizeof(float));
+        place(m.position_indices, 3ull * v.triangle_count, sizeof(uint32_t));
+        place(m.normal_indices, v.normal_indices ? 3ull * v.triangle_count : 0, sizeof(uint32_t));
+        place(m.uv_indices, v.uv_indices ? 3ull * v.triangle_count : 0, sizeof(uint32_t));
+        place(m.nodes, source.node_count, sizeof(linear_bvh_node));
+
+        for (int k = 0; k < 3; ++k)
+        {
+            m.box_minimum[k] = source.box.minimum[k];
+            m.box_maximum[k] = source.box.maximum[k];
+        }
+        m.material = static_cast<uint32_t>(i);
+        m.pad = 0;
+    }
+    header.file_size = offset;
+
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        std::cerr << "Could not create " << path << "\n";
+        return false;
+    }
+
+    // The header goes in twice, the second time with the checksum of the rest.
+    scene_cache_writer out(file);
+    out.write(&header, sizeof(header), false);
+
+    auto write_array = [&](const scene_cache_array& a, const void* data, size_t element_size)
+    {
+        out.pad_to(a.offset);
+        out.write(data, static_cast<size_t>(a.count * element_size));
+    };
+
+    write_array(header.meshes, meshes.data(), sizeof(scene_cache_mesh));
+    write_array(header.materials, materials.data(), sizeof(scene_cache_material));
+    write_array(header.strings, strings.data(), 1);
+
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        const triangle_mesh& source = *sources[i].mesh;
+        const mesh_view& v = source.view;
+        const scene_cache_mesh& m = meshes[i];
+
+        write_array(m.px, v.px, sizeof(float));
+        write_array(m.py, v.py, sizeof(float));
+        write_array(m.pz, v.pz, sizeof(float));
+        write_array(m.nx, v.nx, sizeof(float));
+        write_array(m.ny, v.ny, sizeof(float));
+        write_array(m.nz, v.nz, sizeof(float));
+        write_array(m.tu, v.tu, sizeof(float));
+        write_array(m.tv, v.tv, sizeof(float));
+        write_array(m.position_indices, v.position_indices, sizeof(uint32_t));
+        write_array(m.normal_indices, v.normal_indices, sizeof(uint32_t));
+        write_array(m.uv_indices, v.uv_indices, sizeof(uint32_t));
+        write_array(m.nodes, source.nodes, sizeof(linear_bvh_node));
+    }
+
+    header.checksum = out.hasher.finish();
+    out.ok = out.ok && std::fseek(file, 0, SEEK_SET) == 0
+        && std::fwrite(&header, sizeof(header), 1, file) == 1;
+    out.ok = (std::fclose(file) == 0) && out.ok;
+
+    if (!out.ok)
+        std::cerr << "Could not write " << path << "\n";
+    return out.ok;
+}
+
+shared_ptr<material> make_cached_material(const scene_cache_material& m, const char* texture)
+{
+    const glm::vec3 color(m.color[0], m.color[1], m.color[2]);
+    switch (static_cast<scene_cache_material_type>(m.type))
+    {
+    case scene_cache_material_type::metal:
+        return make_shared<metal>(color, m.parameter);
+    case scene_cache_material_type::dielectric:
+        return make_shared<dielectric>(m.parameter);
+    case scene_cache_material_type::diffuse_light:
+        if (texture) return make_shared<diffuse_light>(make_shared<image_texture>(texture));
+        return make_shared<diffuse_light>(color);
+    default:
+        if (texture) return make_shared<lambertian>(make_shared<image_texture>(texture));
+        return make_shared<lambertian>(color);
+    }
+}
+
+// Maps the cache at path and adds its meshes to out. The meshes keep the file mapped and
+// use its arrays in place. With verify the checksum is recomputed, which reads every page.
+bool load_scene_cache(const std::string& path, hittable_list& out, bool verify = true)
+{
+    auto file = make_shared<mapped_file>();
+    if (!file->open(path))
+        return false;
+
+    auto fail = [&](const char* message)
+    {
+        std::cerr << path << ": " << message << "\n";
+        return false;
+    };
+
+    if (file->size < sizeof(scene_cache_header))
+        return fail("too small for a scene cache");
+
+    const unsigned char* base = file->begin();
+    scene_cache_header header;
+    std::memcpy(&header, base, sizeof(header));
+
+    if (std::memcmp(header.magic, scene_cache_magic, sizeof(header.magic)) != 0)
+        return fail("not a scene cache");
+    if (header.version != scene_cache_version)
+        return fail("scene cache version differs, convert the scene again");
+    if (header.byte_order != scene_cache_byte_order || header.node_size != sizeof(linear_bvh_node))
+        return fail("scene cache written for another architecture, convert the scene again");
+    if (header.file_size != file->size)
+        return fail("scene cache is truncated");
+
+    if (verify)
+    {
+        scene_cache_hasher hasher;
+        hasher.update(base + sizeof(header), file->size - sizeof(header));
+        if (hasher.finish() != header.checksum)
+            return fail("scene cache checksum mismatch, the file is damaged");
+    }
+
+    // The checksum catches damage, these checks keep a bad table from pointing outside the
+    // file. Index and node contents are trusted.
+    auto valid = [&](const scene_cache_array& a, size_t element_size)
+    {
+        return a.offset % scene_cache_alignment == 0 && a.offset <= file->size
+            && a.count <= (file->size - a.offset) / element_size;
+    };
+
+    if (!valid(header.meshes, sizeof(scene_cache_mesh)) || !valid(header.materials, sizeof(scene_cache_material))
+        || !valid(header.strings, 1))
+        return fail("scene cache has a bad section");
+
+    const auto* meshes = reinterpret_cast<const scene_cache_mesh*>(base + header.meshes.offset);
+    const auto* materials = reinterpret_cast<const scene_cache_material*>(base + header.materials.offset);
+    const char* strings = reinterpret_cast<const char*>(base + header.strings.offset);
+
+    std::vector<shared_ptr<material>> material_ptrs(static_cast<size_t>(header.materials.count));
+    for (size_t i = 0; i < material_ptrs.size(); ++i)
+    {
+        const uint32_t texture = materials[i].texture;
+        if (texture != scene_cache_no_texture
+            && (texture >= header.strings.count || !std::memchr(strings + texture, '\0', header.strings.count - texture)))
+            return fail("scene cache has a bad texture path");
+        material_ptrs[i] = make_cached_material(materials[i], texture == scene_cache_no_texture ? nullptr : strings + texture);
+    }
+
+    for (size_t i = 0; i < header.meshes.count; ++i)
+    {
+        const scene_cache_mesh& m = meshes[i];
+        const uint64_t index_count = m.position_indices.count;
+        const bool sizes_match = m.py.count == m.px.count && m.pz.count == m.px.count
+            && m.ny.count == m.nx.count && m.nz.count == m.nx.count && m.tv.count == m.tu.count
+            && index_count % 3 == 0 && index_count / 3 <= UINT32_MAX && m.px.count <= UINT32_MAX
+            && (m.normal_indices.count == 0 || m.normal_indices.count == index_count)
+            && (m.uv_indices.count == 0 || m.uv_indices.count == index_count);
+        const bool arrays_valid = valid(m.px, 4) && valid(m.py, 4) && valid(m.pz, 4)
+            && valid(m.nx, 4) && valid(m.ny, 4) && valid(m.nz, 4) && valid(m.tu, 4) && valid(m.tv, 4)
+            && valid(m.position_indices, 4) && valid(m.normal_indices, 4) && valid(m.uv_indices, 4)
+            && valid(m.nodes, sizeof(linear_bvh_node));
+        if (!sizes_match || !arrays_valid || m.material >= header.materials.count)
+            return fail("scene cache has a bad mesh");
+
+        auto floats = [&](const scene_cache_array& a) { return reinterpret_cast<const float*>(base + a.offset); };
+        auto indices = [&](const scene_cache_array& a)
+        {
+            return a.count ? reinterpret_cast<const uint32_t*>(base + a.offset) : nullptr;
+        };
+
+        mesh_view v;
+        v.px = floats(m.px); v.py = floats(m.py); v.pz = floats(m.pz);
+        v.nx = floats(m.nx); v.ny = floats(m.ny); v.nz = floats(m.nz);
+        v.tu = floats(m.tu); v.tv = floats(m.tv);
+        v.position_indices = indices(m.position_indices);
+        v.normal_indices = indices(m.normal_indices);
+        v.uv_indices = indices(m.uv_indices);
+        v.vertex_count = static_cast<uint32_t>(m.px.count);
+        v.normal_count = static_cast<uint32_t>(m.nx.count);
+        v.uv_count = static_cast<uint32_t>(m.tu.count);
+        v.triangle_count = static_cast<uint32_t>(index_count / 3);
+
+        const aabb box(glm::vec3(m.box_minimum[0], m.box_minimum[1], m.box_minimum[2]),
+            glm::vec3(m.box_maximum[0], m.box_maximum[1], m.box_maximum[2]));
+        const auto* nodes = reinterpret_cast<const linear_bvh_node*>(base + m.nodes.offset);
+
+        out.add(make_shared<triangle_mesh>(v, nodes, static_cast<uint32_t>(m.nodes.count), box,
+            material_ptrs[m.material], file));
+    }
+    return true;
+}
+
+#endif
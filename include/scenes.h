@@ -0,0 +1,423 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "material.h"
+#include "hittable_list.h"
+#include "sphere.h"
+#include "aarect.h"
+#include "box.h"
+#include "constant_medium.h"
+#include "rttexture.h"
+#include "instance.h"
+#include "triangle_mesh.h"
+#include "obj_loader.h"
+#include "scene_cache.h"
+#include "light_set.h"
+
+hittable_list earth()
+{
+    auto earth_texture = make_shared<image_texture>("./assets/earthmap.jpg");
+    auto earth_surface = make_shared<lambertian>(earth_texture);
+    auto globe = make_shared<sphere>(glm::vec3(0, 0, 0), 2, earth_surface);
+
+    return hittable_list(globe);
+}
+
+hittable_list simple_light()
+{
+    hittable_list objects;
+
+    //auto pertext = make_shared<noise_texture>(4);
+    auto pertext = glm::vec3(0.8, 0.8, 0.0);
+    
+    objects.add(make_shared<sphere>(glm::vec3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
+    objects.add(make_shared<sphere>(glm::vec3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
+
+    auto difflight = make_shared<diffuse_light>(glm::vec3(4, 4, 4));
+    objects.add(make_shared<xy_rect>(3, 5, 1, 3, -2, difflight));
+
+    return objects;
+}
+
+hittable_list first_scene()
+{
+    hittable_list objects;
+
+    auto material_ground = make_shared<lambertian>(glm::vec3(0.8, 0.8, 0.0));
+    auto material_center = make_shared<lambertian>(glm::vec3(0.1, 0.2, 0.5));
+    auto material_left = make_shared<dielectric>(1.5);
+    auto material_right = make_shared<metal>(glm::vec3(0.8, 0.6, 0.2), 0.0);
+    auto checker = make_shared<checker_texture>(glm::vec3(0.2, 0.3, 0.1), glm::vec3(0.9, 0.9, 0.9));
+
+    objects.add(make_shared<sphere>(glm::vec3(0.0, -100.5, -1.0), 100.0, make_shared<lambertian>(checker)));
+    objects.add(make_shared<sphere>(glm::vec3(0.0, 0.0, -1.0), 0.5, material_center));
+    objects.add(make_shared<sphere>(glm::vec3(-1.0, 0.0, -1.0), 0.5, material_left));
+    objects.add(make_shared<sphere>(glm::vec3(-1.0, 0.0, -1.0), -0.4, material_left));
+    objects.add(make_shared<sphere>(glm::vec3(1.0, 0.0, -1.0), 0.5, material_right));
+
+    //objects.add(make_shared<sphere>(glm::vec3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
+
+    return objects;
+}
+
+hittable_list cornell_box()
+{
+    hittable_list objects;
+
+    auto red = make_shared<lambertian>(glm::vec3(.65, .05, .05));
+    auto white = make_shared<lambertian>(glm::vec3(.73, .73, .73));
+    auto green = make_shared<lambertian>(glm::vec3(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(glm::vec3(15, 15, 15));
+
+    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
+    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+    //objects.add(make_shared<xz_rect>(213, 343, 227, 332, 554, light));
+    objects.add(make_shared<flip_face>(make_shared<xz_rect>(213, 343, 227, 332, 554, light)));
+    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
+    objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+
+    shared_ptr<hittable> box1 = make_shared<box>(glm::vec3(0, 0, 0), glm::vec3(165, 330, 165), white);
+    //box1 = make_shared<rotate_y>(box1, 15);
+    box1 = make_shared<translate>(box1, glm::vec3(265, 0, 295));
+
+    shared_ptr<hittable> box2 = make_shared<box>(glm::vec3(0, 0, 0), glm::vec3(165, 165, 165), white);
+    //box2 = make_shared<rotate_y>(box2, -18);
+    box2 = make_shared<translate>(box2, glm::vec3(130, 0, 65));
+
+    objects.add(box1);
+    //objects.add(box2);
+
+    auto glass = make_shared<dielectric>(1.5);
+    objects.add(make_shared<sphere>(glm::vec3(190, 90, 190), 90, glass));
+
+    //objects.add(make_shared<constant_medium>(box1, 0.01, glm::vec3(0, 0, 0)));
+    //objects.add(make_shared<constant_medium>(box2, 0.01, glm::vec3(1, 1, 1)));
+
+    return objects;
+}
+
+// Torus around the y axis with normals and texture coordinates.
+mesh_data torus_mesh(float major_radius, float minor_radius, int rings, int sides)
+{
+    mesh_data mesh;
+    for (int i = 0; i <= rings; ++i)
+    {
+        const float phi = 2.f * pi * i / rings;
+        for (int j = 0; j <= sides; ++j)
+        {
+            const float theta = 2.f * pi * j / sides;
+            const glm::vec3 n(cos(theta) * cos(phi), sin(theta), cos(theta) * sin(phi));
+            mesh.add_position(glm::vec3(major_radius * cos(phi), 0.f, major_radius * sin(phi)) + minor_radius * n);
+            mesh.add_normal(n);
+            mesh.add_uv(float(i) / rings, float(j) / sides);
+        }
+    }
+
+    for (int i = 0; i < rings; ++i)
+    {
+        for (int j = 0; j < sides; ++j)
+        {
+            const uint32_t a = i * (sides + 1) + j;
+            const uint32_t b = a + sides + 1;
+            const uint32_t quad[6] = { a, a + 1, b + 1, a, b + 1, b };
+            for (uint32_t k : quad)
+            {
+                mesh.position_indices.push_back(k);
+                mesh.normal_indices.push_back(k);
+                mesh.uv_indices.push_back(k);
+            }
+        }
+    }
+    return mesh;
+}
+
+// A field of 4096 tori in random orientations and sizes that all share one mesh and its
+// BVH, with the per instance materials picked from a few. animate moves every torus along
+// a circle of its own while it spins, from where it is at time 0.
+hittable_list torus_field(std::function<void(float)>& animate)
+{
+    hittable_list objects;
+
+    auto ground = make_shared<lambertian>(make_shared<checker_texture>(glm::vec3(0.2, 0.3, 0.1), glm::vec3(0.9, 0.9, 0.9)));
+    objects.add(make_shared<sphere>(glm::vec3(0, -1000, 0), 1000, ground));
+
+    const shared_ptr<material> materials[] = {
+        make_shared<lambertian>(glm::vec3(0.8, 0.3, 0.2)),
+        make_shared<lambertian>(glm::vec3(0.2, 0.4, 0.8)),
+        make_shared<metal>(glm::vec3(0.8, 0.8, 0.8), 0.1f),
+        make_shared<metal>(glm::vec3(0.9, 0.7, 0.3), 0.3f),
+    };
+
+    auto torus = make_shared<triangle_mesh>(torus_mesh(1.f, 0.35f, 48, 24), materials[0]);
+
+    struct torus_motion
+    {
+        shared_ptr<instance> object;
+        glm::vec3 position;
+        glm::vec3 axis;
+        float angle;
+        float size;
+        float spin;   // radians per second
+        float orbit;  // radius of the circle it moves along
+        float speed;  // radians per second along the circle
+    };
+    auto motions = make_shared<std::vector<torus_motion>>();
+
+    auto place = [](const torus_motion& m, float time)
+    {
+        const float phase = m.speed * time;
+        const glm::vec3 offset(m.orbit * (cos(phase) - 1.f), 0.f, m.orbit * sin(phase));
+        glm::mat4 transform = glm::translate(glm::mat4(1.f), m.position + offset);
+        transform = glm::rotate(transform, m.angle + m.spin * time, m.axis);
+        return glm::scale(transform, glm::vec3(m.size, m.size, m.size));
+    };
+
+    // Motion comes from a generator of its own, the still scene stays as it was.
+    pcg32 rng(7);
+    pcg32 motion_rng(11);
+    const int grid = 64;
+    for (int i = 0; i < grid; ++i)
+    {
+        for (int k = 0; k < grid; ++k)
+        {
+            const float size = random_float(rng, 0.25f, 0.45f);
+            const glm::vec3 position(i - grid / 2 + random_float(rng, 0.f, 0.2f), 1.35f * size,
+                k - grid / 2 + random_float(rng, 0.f, 0.2f));
+            const glm::vec3 axis(random_float(rng, -1.f, 1.f), random_float(rng, -1.f, 1.f), random_float(rng, -1.f, 1.f));
+
+            torus_motion m;
+            m.position = position;
+            m.axis = axis;
+            m.angle = random_float(rng, 0.f, 2.f * pi);
+            m.size = size;
+            m.spin = random_float(motion_rng, -3.f, 3.f);
+            m.orbit = random_float(motion_rng, 0.f, 2.f);
+            m.speed = random_float(motion_rng, 0.5f, 1.5f) * (random_int(motion_rng, 0, 1) ? 1.f : -1.f);
+            m.object = make_shared<instance>(torus, place(m, 0.f), materials[random_int(rng, 0, 3)]);
+
+            objects.add(m.object);
+            motions->push_back(m);
+        }
+    }
+
+    animate = [motions, place](float time)
+    {
+        for (const torus_motion& m : *motions)
+            m.object->set_transform(place(m, time));
+    };
+    return objects;
+}
+
+// A plaza lit only by 400 small glowing spheres of very different brightness, between
+// columns and boulders that hide most of them from any one point. Hard for samplers that
+// spread their light samples evenly, most of which go to dim or far away lights.
+hittable_list many_lights()
+{
+    hittable_list objects;
+
+    auto ground = make_shared<lambertian>(glm::vec3(0.6, 0.6, 0.6));
+    objects.add(make_shared<sphere>(glm::vec3(0, -1000, 0), 1000, ground));
+
+    pcg32 rng(5);
+    auto stone = make_shared<lambertian>(glm::vec3(0.5, 0.45, 0.4));
+    for (int i = 0; i < 24; ++i)
+    {
+        const glm::vec3 base(random_float(rng, -14.f, 14.f), 0.f, random_float(rng, -14.f, 14.f));
+        if (random_int(rng, 0, 1))
+        {
+            shared_ptr<hittable> column = make_shared<box>(glm::vec3(0, 0, 0), glm::vec3(0.8f, random_float(rng, 2.f, 5.f), 0.8f), stone);
+            objects.add(make_shared<translate>(column, base));
+        }
+        else
+        {
+            const float radius = random_float(rng, 0.6f, 1.5f);
+            objects.add(make_shared<sphere>(base + glm::vec3(0, radius * 0.7f, 0), radius, stone));
+        }
+    }
+
+    for (int i = 0; i < 400; ++i)
+    {
+        const glm::vec3 center(random_float(rng, -15.f, 15.f), random_float(rng, 0.3f, 3.f), random_float(rng, -15.f, 15.f));
+        const glm::vec3 tint(random_float(rng, 0.3f, 1.f), random_float(rng, 0.3f, 1.f), random_float(rng, 0.3f, 1.f));
+
+        // Brightness spread over three orders of magnitude, a few lights dominate.
+        const float strength = pow(10.f, random_float(rng, -1.f, 2.f));
+        objects.add(make_shared<sphere>(center, random_float(rng, 0.05f, 0.15f), make_shared<diffuse_light>(tint * strength)));
+    }
+    return objects;
+}
+
+// Everything needed to render one of the scenes above besides the render settings.
+struct scene_description
+{
+    hittable_list world;
+    shared_ptr<light_set> lights; // the emitters of world, sampled by diffuse bounces, null without any
+    glm::vec3 lookfrom;
+    glm::vec3 lookat;
+    glm::vec3 vup;
+    float vfov;
+    glm::vec3 background;
+    std::function<void(float)> animate; // moves the objects to a time in seconds, empty for still scenes
+};
+
+const char* const scene_names[] = { "cornell_box", "first_scene", "simple_light", "earth", "torus_field", "many_lights" };
+
+// Fills out the scene called name, returns false for unknown names. Every emitter among the
+// top level objects of the world becomes one of its lights.
+bool make_scene(const std::string& name, scene_description& out)
+{
+    out.vup = glm::vec3(0, 1, 0);
+    out.lights = nullptr;
+    out.animate = nullptr;
+
+    if (name == "cornell_box")
+    {
+        out.world = cornell_box();
+        out.lookfrom = glm::vec3(278, 278, -800);
+        out.lookat = glm::vec3(278, 278, 0);
+        out.vfov = 40;
+        out.background = glm::vec3(0, 0, 0);
+    }
+    else if (name == "first_scene")
+    {
+        out.world = first_scene();
+        out.lookfrom = glm::vec3(-2, 2, 1);
+        out.lookat = glm::vec3(0, 0, -1);
+        out.vfov = 90;
+        out.background = glm::vec3(0.7f, 0.8f, 1.0f);
+    }
+    else if (name == "simple_light")
+    {
+        out.world = simple_light();
+        out.lookfrom = glm::vec3(26, 3, 6);
+        out.lookat = glm::vec3(0, 2, 0);
+        out.vfov = 20;
+        out.background = glm::vec3(0, 0, 0);
+    }
+    else if (name == "earth")
+    {
+        out.world = earth();
+        out.lookfrom = glm::vec3(13, 2, 3);
+        out.lookat = glm::vec3(0, 0, 0);
+        out.vfov = 20;
+        out.background = glm::vec3(0.7f, 0.8f, 1.0f);
+    }
+    else if (name == "torus_field")
+    {
+        out.world = torus_field(out.animate);
+        out.lookfrom = glm::vec3(-30, 9, -30);
+        out.lookat = glm::vec3(0, 0, 0);
+        out.vfov = 30;
+        out.background = glm::vec3(0.7f, 0.8f, 1.0f);
+    }
+    else if (name == "many_lights")
+    {
+        out.world = many_lights();
+        out.lookfrom = glm::vec3(0, 6, -22);
+        out.lookat = glm::vec3(0, 1, 0);
+        out.vfov = 45;
+        out.background = glm::vec3(0, 0, 0);
+    }
+    else
+    {
+        return false;
+    }
+
+    out.lights = make_light_set(out.world);
+    return true;
+}
+
+// Scales and moves meshes together so the largest side of their bounds is 330 units and
+// they stand on the middle of the Cornell box floor.
+void fit_to_cornell_box(std::vector<mesh_data>& meshes)
+{
+    glm::vec3 lo(infinity, infinity, infinity);
+    glm::vec3 hi(-infinity, -infinity, -infinity);
+    for (const mesh_data& mesh : meshes)
+    {
+        for (size_t i = 0; i < mesh.vertex_count(); ++i)
+        {
+            lo = glm::min(lo, mesh.position(static_cast<uint32_t>(i)));
+            hi = glm::max(hi, mesh.position(static_cast<uint32_t>(i)));
+        }
+    }
+    if (!(lo.x <= hi.x))
+        return;
+
+    const glm::vec3 extent = hi - lo;
+    const float largest = std::max(extent.x, std::max(extent.y, extent.z));
+    const float scale = largest > 0.f ? 330.f / largest : 1.f;
+    const glm::vec3 offset = glm::vec3(278.f, 0.f, 278.f) - scale * glm::vec3(0.5f * (lo.x + hi.x), lo.y, 0.5f * (lo.z + hi.z));
+    for (mesh_data& mesh : meshes)
+        mesh.transform(scale, offset);
+}
+
+// Cornell box walls and light around meshes, with the light as the sampled shape. Emissive
+// meshes are not sampled as lights.
+void make_cornell_mesh_scene(const hittable_list& meshes, scene_description& out)
+{
+    auto red = make_shared<lambertian>(glm::vec3(.65, .05, .05));
+    auto white = make_shared<lambertian>(glm::vec3(.73, .73, .73));
+    auto green = make_shared<lambertian>(glm::vec3(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(glm::vec3(15, 15, 15));
+
+    hittable_list objects;
+    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
+    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<flip_face>(make_shared<xz_rect>(213, 343, 227, 332, 554, light)));
+    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
+    objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+    for (const auto& mesh : meshes.objects)
+        objects.add(mesh);
+
+    out.world = objects;
+    out.lights = make_light_set(out.world);
+    out.vup = glm::vec3(0, 1, 0);
+    out.lookfrom = glm::vec3(278, 278, -800);
+    out.lookat = glm::vec3(278, 278, 0);
+    out.vfov = 40;
+    out.background = glm::vec3(0, 0, 0);
+    out.animate = nullptr;
+}
+
+// The mesh in the OBJ file at path in white inside the Cornell box, its BVH built with options.
+bool make_mesh_scene(const std::string& path, scene_description& out, const bvh_build_options& options = bvh_build_options())
+{
+    std::vector<mesh_data> meshes(1);
+    if (!load_obj(path, meshes[0]))
+        return false;
+    if (meshes[0].triangle_count() == 0)
+    {
+        std::cerr << "No triangles in " << path << "\n";
+        return false;
+    }
+    fit_to_cornell_box(meshes);
+
+    hittable_list objects;
+    objects.add(make_shared<triangle_mesh>(std::move(meshes[0]), make_shared<lambertian>(glm::vec3(.73, .73, .73)), options));
+    make_cornell_mesh_scene(objects, out);
+    return true;
+}
+
+// The meshes of a scene cache written by scene_convert inside the Cornell box. They are
+// stored already placed, so nothing is moved or built here.
+bool make_cached_scene(const std::string& path, scene_description& out)
+{
+    hittable_list objects;
+    if (!load_scene_cache(path, objects))
+        return false;
+    make_cornell_mesh_scene(objects, out);
+    return true;
+}
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "thread_pool.h"
+
+// A rectangle of pixels [x0,x1) x [y0,y1) rendered as one task.
+struct alignas(64) render_tile
+{
+    int x0, y0, x1, y1;
+    int worker; // -1 when the thread waiting on the pool rendered it
+    double ms;
+};
+
+class tile_scheduler
+{
+public:
+    tile_scheduler(int image_width, int image_height, int tile_size = 32);
+
+    // Runs render_fn once per tile across the pool and records how long each tile took.
+    void render(thread_pool& pool, const std::function<void(const render_tile&)>& render_fn);
+
+    void print_timings(std::ostream& out, int slowest_count = 5) const;
+
+    const std::vector<render_tile>& get_tiles() const { return tiles; }
+    double get_total_ms() const { return total_ms; }
+
+private:
+    int width;
+    int height;
+    int tile_size;
+    double total_ms;
+    std::vector<render_tile> tiles;
+};
+
+tile_scheduler::tile_scheduler(int image_width, int image_height, int tile_size)
+    : width(image_width), height(image_height), tile_size(std::max(1, tile_size)), total_ms(0.0)
+{
+    for (int y = 0; y < height; y += this->tile_size)
+    {
+        for (int x = 0; x < width; x += this->tile_size)
+        {
+            render_tile tile;
+            tile.x0 = x;
+            tile.y0 = y;
+            tile.x1 = std::min(x + this->tile_size, width);
+            tile.y1 = std::min(y + this->tile_size, height);
+            tile.worker = -1;
+            tile.ms = 0.0;
+            tiles.push_back(tile);
+        }
+    }
+}
+
+void tile_scheduler::render(thread_pool& pool, const std::function<void(const render_tile&)>& render_fn)
+{
+    using clock = std::chrono::steady_clock;
+    auto frame_start = clock::now();
+
+    for (auto& tile : tiles)
+    {
+        render_tile* t = &tile;
+        pool.submit([t, &pool, &render_fn]() {
+            auto tile_start = clock::now();
+            render_fn(*t);
+            t->ms = std::chrono::duration<double, std::milli>(clock::now() - tile_start).count();
+            t->worker = pool.worker_index();
+        });
+    }
+    pool.wait();
+
+    total_ms = std::chrono::duration<double, std::milli>(clock::now() - frame_start).count();
+}
+
+void tile_scheduler::print_timings(std::ostream& out, int slowest_count) const
+{
+    if (tiles.empty()) return;
+
+    double sum = 0.0;
+    double min_ms = tiles[0].ms;
+    double max_ms = tiles[0].ms;
+    for (const auto& tile : tiles)
+    {
+        sum += tile.ms;
+        min_ms = std::min(min_ms, tile.ms);
+        max_ms = std::max(max_ms, tile.ms);
+    }
+
+    out << "Rendered " << tiles.size() << " tiles (" << tile_size << "x" << tile_size << ") in " << total_ms << " ms\n"
+        << "  tile ms: min " << min_ms << ", avg " << sum / tiles.size() << ", max " << max_ms << "\n"
+        << "  average busy threads: " << (total_ms > 0.0 ? sum / total_ms : 0.0) << "\n";
+
+    std::vector<const render_tile*> sorted;
+    for (const auto& tile : tiles)
+        sorted.push_back(&tile);
+    std::sort(sorted.begin(), sorted.end(), [](const render_tile* a, const render_tile* b) { return a->ms > b->ms; });
+
+    for (int i = 0; i < slowest_count && i < static_cast<int>(sorted.size()); ++i)
+    {
+        const render_tile& tile = *sorted[i];
+        out << "  slow tile [" << tile.x0 << "," << tile.y0 << " - " << tile.x1 << "," << tile.y1 << "] "
+            << tile.ms << " ms on worker " << tile.worker << "\n";
+    }
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Instruction set selection for the vectorized traversal kernels.
+// Kernels are compiled per function with target attributes and picked at runtime, so the
+// binary still runs (on the scalar path) on CPUs without the extensions.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RT_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define RT_TARGET_SSE2
+#define RT_TARGET_AVX
+#else
+#define RT_TARGET_SSE2 __attribute__((target("sse2")))
+#define RT_TARGET_AVX __attribute__((target("avx")))
+#endif
+#endif
+
+enum class simd_level
+{
+    scalar,
+    sse,
+    avx
+};
+
+inline const char* simd_level_name(simd_level level)
+{
+    switch (level)
+    {
+    case simd_level::sse: return "SSE";
+    case simd_level::avx: return "AVX";
+    default: return "scalar";
+    }
+}
+
+// Widest instruction set both the CPU and the OS (for the YMM registers) support.
+inline simd_level detect_simd_level()
+{
+#if defined(RT_X86)
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (osxsave && avx && (_xgetbv(0) & 0x6) == 0x6)
+        return simd_level::avx;
+    if (info[3] & (1 << 26))
+        return simd_level::sse;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+        return simd_level::avx;
+    if (__builtin_cpu_supports("sse2"))
+        return simd_level::sse;
+#endif
+#endif
+    return simd_level::scalar;
+}
+
+#endif
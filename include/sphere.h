@@ -11,10 +11,21 @@ public:
     sphere(glm::vec3 cen, float r, shared_ptr<material> m) : center(cen), radius(r), mat_ptr(m) {};
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual void resolve_hit(const ray& r, hit_record& rec) const override;
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
     float pdf_value(const glm::vec3& o, const glm::vec3& v) const override;
     glm::vec3 random(const glm::vec3& o) const override;
 
+    virtual bool emitter(emitter_surface& out) const override
+    {
+        bounding_box(0, 1, out.box);
+        out.mat_ptr = mat_ptr.get();
+        out.area = 4 * pi * radius * radius;
+        out.axis = glm::vec3(0, 1, 0);
+        out.cos_theta = -1;
+        return true;
+    }
+
 
 public:
     glm::vec3 center;
@@ -41,8 +52,9 @@ private:
 
 inline glm::vec3 random_to_sphere(float radius, float distance_squared)
 {
-    auto r1 = random_float();
-    auto r2 = random_float();
+    const glm::vec2 r = sample_2d();
+    auto r1 = r.x;
+    auto r2 = r.y;
     auto z = 1 + r2 * (sqrt(1 - radius * radius / distance_squared) - 1);
 
     auto phi = 2 * pi * r1;
@@ -72,13 +84,17 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
     }
 
     rec.t = root;
+    rec.object = this;
+    return true;
+}
+
+void sphere::resolve_hit(const ray& r, hit_record& rec) const
+{
     rec.p = r.at(rec.t);
     glm::vec3 outward_normal = (rec.p - center) / radius;
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mat_ptr;
+    rec.mat_ptr = mat_ptr.get();
     get_sphere_uv(outward_normal, rec.u, rec.v);
-
-    return true;
 }
 
 bool sphere::bounding_box(float time0, float time1, aabb& output_box) const
@@ -90,8 +106,8 @@ bool sphere::bounding_box(float time0, float time1, aabb& output_box) const
 }
 
 float sphere::pdf_value(const glm::vec3& o, const glm::vec3& v) const {
-    hit_record rec;
-    if (!this->hit(ray(o, v), 0.001, infinity, rec))
+    // Directions that miss the sphere have no density.
+    if (!this->occluded(ray(o, v), 0.001, infinity))
         return 0;
 
     glm::vec3 direction = center - o;
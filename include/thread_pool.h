@@ -0,0 +1,240 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed pool of worker threads, one task deque per worker.
+// A worker pops its own deque from the back and steals from the front of the others
+// when it runs dry, so uneven tasks (e.g. tiles covering the glass sphere) balance out.
+class thread_pool
+{
+public:
+    explicit thread_pool(unsigned int thread_count = 0);
+    ~thread_pool();
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    void submit(std::function<void()> task);
+    void wait();
+
+    unsigned int size() const { return static_cast<unsigned int>(workers.size()); }
+
+    // Index of this pool's worker running the calling thread, -1 for any other thread.
+    int worker_index() const { return current_worker(); }
+
+private:
+    struct alignas(64) task_queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<task_queue>> queues;
+
+    std::atomic<int> queued;
+    std::atomic<int> pending;
+    std::atomic<unsigned int> next_queue;
+    bool stopping;
+
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    struct worker_slot
+    {
+        const thread_pool* pool = nullptr;
+        int index = -1;
+    };
+
+    static worker_slot& current_slot()
+    {
+        static thread_local worker_slot slot;
+        return slot;
+    }
+
+    int current_worker() const { return current_slot().pool == this ? current_slot().index : -1; }
+
+    void worker_loop(int index);
+    bool pop_task(int index, std::function<void()>& task);
+    void run_task(std::function<void()>& task);
+};
+
+thread_pool::thread_pool(unsigned int thread_count)
+    : queued(0), pending(0), next_queue(0), stopping(false)
+{
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned int i = 0; i < thread_count; ++i)
+        queues.push_back(std::make_unique<task_queue>());
+
+    for (unsigned int i = 0; i < thread_count; ++i)
+        workers.emplace_back(&thread_pool::worker_loop, this, static_cast<int>(i));
+}
+
+thread_pool::~thread_pool()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void thread_pool::submit(std::function<void()> task)
+{
+    // Tasks spawned by a worker stay on its own deque, everything else is dealt out round-robin.
+    int index = current_worker();
+    if (index < 0)
+        index = static_cast<int>(next_queue++ % queues.size());
+
+    pending++;
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    queued++;
+
+    // Taking the wake mutex orders this with a worker that is about to sleep.
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+    }
+    wake.notify_one();
+}
+
+void thread_pool::wait()
+{
+    // The calling thread helps out instead of idling until the pool drains.
+    std::function<void()> task;
+    while (pending > 0)
+    {
+        if (pop_task(current_worker(), task))
+        {
+            run_task(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        done.wait(lock, [this] { return pending == 0 || queued > 0; });
+    }
+}
+
+bool thread_pool::pop_task(int index, std::function<void()>& task)
+{
+    if (index >= 0)
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        if (!queues[index]->tasks.empty())
+        {
+            task = std::move(queues[index]->tasks.back());
+            queues[index]->tasks.pop_back();
+            queued--;
+            return true;
+        }
+    }
+
+    const int count = static_cast<int>(queues.size());
+    const int start = index >= 0 ? index + 1 : 0;
+    for (int i = 0; i < count; ++i)
+    {
+        int victim = (start + i) % count;
+        if (victim == index)
+            continue;
+
+        std::lock_guard<std::mutex> lock(queues[victim]->mutex);
+        if (!queues[victim]->tasks.empty())
+        {
+            task = std::move(queues[victim]->tasks.front());
+            queues[victim]->tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void thread_pool::run_task(std::function<void()>& task)
+{
+    task();
+    task = nullptr;
+
+    if (--pending == 0)
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        done.notify_all();
+    }
+}
+
+void thread_pool::worker_loop(int index)
+{
+    current_slot().pool = this;
+    current_slot().index = index;
+
+    std::function<void()> task;
+    while (true)
+    {
+        if (pop_task(index, task))
+        {
+            run_task(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0)
+            return;
+    }
+}
+
+inline size_t parallel_chunk_count(size_t begin, size_t end, size_t grain)
+{
+    return end > begin ? (end - begin + grain - 1) / grain : 0;
+}
+
+// Runs body(chunk, first, last) for consecutive chunks of grain indices covering [begin, end)
+// on the pool and returns when they are done. Chunks only depend on grain, not on the thread
+// count, so results kept per chunk and merged in chunk order are the same on any pool. Waits
+// for the whole pool, so call it from outside the pool's tasks.
+template <class chunk_fn>
+void parallel_for(thread_pool& pool, size_t begin, size_t end, size_t grain, chunk_fn&& body)
+{
+    const size_t chunks = parallel_chunk_count(begin, end, grain);
+    for (size_t chunk = 0; chunk < chunks; ++chunk)
+    {
+        const size_t first = begin + chunk * grain;
+        const size_t last = std::min(end, first + grain);
+        pool.submit([&body, chunk, first, last] { body(chunk, first, last); });
+    }
+    pool.wait();
+}
+
+// As above, without a pool the chunks run in order on the calling thread.
+template <class chunk_fn>
+void parallel_for(thread_pool* pool, size_t begin, size_t end, size_t grain, chunk_fn&& body)
+{
+    if (pool)
+    {
+        parallel_for(*pool, begin, end, grain, body);
+        return;
+    }
+    const size_t chunks = parallel_chunk_count(begin, end, grain);
+    for (size_t chunk = 0; chunk < chunks; ++chunk)
+        body(chunk, begin + chunk * grain, std::min(end, begin + (chunk + 1) * grain));
+}
+
+#endif
@@ -0,0 +1,377 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "common.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "mapped_file.h"
+
+// Read only view of the arrays of a mesh: a mesh_data, or a mesh mapped from a scene cache.
+struct mesh_view
+{
+    const float* px, * py, * pz;
+    const float* nx, * ny, * nz;
+    const float* tu, * tv;
+    const uint32_t* position_indices;
+    const uint32_t* normal_indices; // null without normals
+    const uint32_t* uv_indices;     // null without texture coordinates
+
+    uint32_t vertex_count;
+    uint32_t normal_count;
+    uint32_t uv_count;
+    uint32_t triangle_count;
+
+    glm::vec3 position(uint32_t i) const { return glm::vec3(px[i], py[i], pz[i]); }
+    glm::vec3 normal(uint32_t i) const { return glm::vec3(nx[i], ny[i], nz[i]); }
+};
+
+// Vertex attributes of a mesh, one array per component, and its triangles as three indices
+// each into them. Positions, normals and texture coordinates are indexed separately like
+// in OBJ files; the normal and uv index arrays are empty when the mesh has no such data.
+struct mesh_data
+{
+    std::vector<float> px, py, pz;
+    std::vector<float> nx, ny, nz;
+    std::vector<float> tu, tv;
+
+    std::vector<uint32_t> position_indices;
+    std::vector<uint32_t> normal_indices;
+    std::vector<uint32_t> uv_indices;
+
+    size_t vertex_count() const { return px.size(); }
+    size_t triangle_count() const { return position_indices.size() / 3; }
+
+    glm::vec3 position(uint32_t i) const { return glm::vec3(px[i], py[i], pz[i]); }
+    glm::vec3 normal(uint32_t i) const { return glm::vec3(nx[i], ny[i], nz[i]); }
+
+    void add_position(const glm::vec3& p) { px.push_back(p.x); py.push_back(p.y); pz.push_back(p.z); }
+    void add_normal(const glm::vec3& n) { nx.push_back(n.x); ny.push_back(n.y); nz.push_back(n.z); }
+    void add_uv(float u, float v) { tu.push_back(u); tv.push_back(v); }
+
+    // Scales every position by scale and then moves it by offset.
+    void transform(float scale, const glm::vec3& offset);
+
+    mesh_view view() const;
+};
+
+void mesh_data::transform(float scale, const glm::vec3& offset)
+{
+    for (size_t i = 0; i < px.size(); ++i)
+    {
+        px[i] = px[i] * scale + offset.x;
+        py[i] = py[i] * scale + offset.y;
+        pz[i] = pz[i] * scale + offset.z;
+    }
+}
+
+mesh_view mesh_data::view() const
+{
+    mesh_view v;
+    v.px = px.data(); v.py = py.data(); v.pz = pz.data();
+    v.nx = nx.data(); v.ny = ny.data(); v.nz = nz.data();
+    v.tu = tu.data(); v.tv = tv.data();
+    v.position_indices = position_indices.data();
+    v.normal_indices = normal_indices.empty() ? nullptr : normal_indices.data();
+    v.uv_indices = uv_indices.empty() ? nullptr : uv_indices.data();
+    v.vertex_count = static_cast<uint32_t>(px.size());
+    v.normal_count = static_cast<uint32_t>(nx.size());
+    v.uv_count = static_cast<uint32_t>(tu.size());
+    v.triangle_count = static_cast<uint32_t>(triangle_count());
+    return v;
+}
+
+// A ray prepared for the watertight triangle test of Woop, Benthin and Wald, "Watertight
+// Ray/Triangle Intersection" (JCGT 2013): axes are permuted so the direction is largest
+// along z, then triangles are sheared into ray space. Rays passing exactly through a
+// shared edge or vertex hit one of the triangles, never neither.
+struct watertight_ray
+{
+    watertight_ray(const ray& r)
+    {
+        const glm::vec3 d = r.direction();
+        const glm::vec3 a(fabs(d.x), fabs(d.y), fabs(d.z));
+        kz = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+        kx = kz == 2 ? 0 : kz + 1;
+        ky = kx == 2 ? 0 : kx + 1;
+        if (d[kz] < 0.f) std::swap(kx, ky); // keep the winding
+
+        sx = d[kx] / d[kz];
+        sy = d[ky] / d[kz];
+        sz = 1.f / d[kz];
+        origin = r.origin();
+    }
+
+    // Distance and barycentrics of v1 and v2 if the triangle is hit within (t_min, t_max).
+    bool intersect(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, float t_min, float t_max,
+        float& t, float& b1, float& b2) const
+    {
+        const glm::vec3 a = v0 - origin;
+        const glm::vec3 b = v1 - origin;
+        const glm::vec3 c = v2 - origin;
+
+        const float ax = a[kx] - sx * a[kz];
+        const float ay = a[ky] - sy * a[kz];
+        const float bx = b[kx] - sx * b[kz];
+        const float by = b[ky] - sy * b[kz];
+        const float cx = c[kx] - sx * c[kz];
+        const float cy = c[ky] - sy * c[kz];
+
+        float u = cx * by - cy * bx;
+        float v = ax * cy - ay * cx;
+        float w = bx * ay - by * ax;
+
+        // On an edge in single precision, decide it in double so neighbours agree.
+        if (u == 0.f || v == 0.f || w == 0.f)
+        {
+            u = static_cast<float>(double(cx) * by - double(cy) * bx);
+            v = static_cast<float>(double(ax) * cy - double(ay) * cx);
+            w = static_cast<float>(double(bx) * ay - double(by) * ax);
+        }
+
+        if ((u < 0.f || v < 0.f || w < 0.f) && (u > 0.f || v > 0.f || w > 0.f))
+            return false;
+
+        const float det = u + v + w;
+        if (det == 0.f)
+            return false;
+
+        const float dist = u * sz * a[kz] + v * sz * b[kz] + w * sz * c[kz];
+        const float inv_det = 1.f / det;
+        t = dist * inv_det;
+        if (!(t > t_min && t < t_max))
+            return false;
+
+        b1 = v * inv_det;
+        b2 = w * inv_det;
+        return true;
+    }
+
+    glm::vec3 origin;
+    int kx, ky, kz;
+    float sx, sy, sz;
+};
+
+// Indexed triangles with one material, over a BVH of their own. The triangles are
+// reordered to match the BVH leaves, which refer to them by index, so a mesh of any size
+// is a single hittable to the scene. Rendering only goes through view and nodes, which
+// point into the mesh's own storage or into a mapped scene cache.
+class triangle_mesh : public hittable
+{
+public:
+    triangle_mesh(mesh_data data, shared_ptr<material> m, const bvh_build_options& options = bvh_build_options());
+
+    // Uses arrays and a flattened tree prepared by the constructor above in place, kept
+    // alive by storage.
+    triangle_mesh(const mesh_view& v, const linear_bvh_node* tree, uint32_t tree_size, const aabb& bounds,
+        shared_ptr<material> m, shared_ptr<const mapped_file> storage)
+        : view(v), nodes(tree), node_count(tree_size), mat_ptr(m), box(bounds), mapping(storage)
+    {}
+
+    // view and nodes may point into the object itself.
+    triangle_mesh(const triangle_mesh&) = delete;
+    triangle_mesh& operator=(const triangle_mesh&) = delete;
+
+    virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual void resolve_hit(const ray& r, hit_record& rec) const override;
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override;
+    virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
+
+    void triangle(uint32_t i, glm::vec3& v0, glm::vec3& v1, glm::vec3& v2) const
+    {
+        const uint32_t* idx = &view.position_indices[3 * static_cast<size_t>(i)];
+        v0 = view.position(idx[0]);
+        v1 = view.position(idx[1]);
+        v2 = view.position(idx[2]);
+    }
+
+public:
+    mesh_view view;
+    const linear_bvh_node* nodes;
+    uint32_t node_count;
+    shared_ptr<material> mat_ptr;
+    aabb box;
+
+    // Storage behind view and nodes, empty when they are mapped.
+    mesh_data mesh;
+    std::vector<linear_bvh_node> tree_nodes;
+    shared_ptr<const mapped_file> mapping;
+};
+
+triangle_mesh::triangle_mesh(mesh_data data, shared_ptr<material> m, const bvh_build_options& options)
+    : nodes(nullptr), node_count(0), mat_ptr(m), box(empty_box()), mesh(std::move(data))
+{
+    const size_t count = mesh.triangle_count();
+    view = mesh.view();
+
+    std::vector<bvh_primitive> prims(count);
+    auto bound_triangles = [&](size_t first, size_t last, aabb& bounds)
+    {
+        for (size_t i = first; i < last; ++i)
+        {
+            glm::vec3 v0, v1, v2;
+            triangle(static_cast<uint32_t>(i), v0, v1, v2);
+
+            aabb& b = prims[i].box;
+            b = aabb(v0, v0);
+            b.expand(v1);
+            b.expand(v2);
+
+            // Pad the bounds like the rectangles do: boxes of axis aligned triangles are flat,
+            // which the slab test never enters, and rounding can miss rays along the edges.
+            const glm::vec3 extent = glm::max(glm::abs(b.minimum), glm::abs(b.maximum));
+            const float pad = 1e-5f * (1.f + std::max(extent.x, std::max(extent.y, extent.z)));
+            b = aabb(b.minimum - glm::vec3(pad, pad, pad), b.maximum + glm::vec3(pad, pad, pad));
+
+            prims[i].centroid = b.centroid();
+            prims[i].index = static_cast<uint32_t>(i);
+            bounds.expand(b);
+        }
+    };
+
+    // Large meshes are prepared and reordered on the build pool as well.
+    const bool parallel = options.pool && count >= bvh_parallel_prims;
+    if (parallel)
+    {
+        std::vector<aabb> chunks(parallel_chunk_count(0, count, bvh_parallel_grain), empty_box());
+        parallel_for(*options.pool, 0, count, bvh_parallel_grain, [&](size_t chunk, size_t first, size_t last) {
+            bound_triangles(first, last, chunks[chunk]);
+        });
+        for (const aabb& chunk : chunks)
+            box.expand(chunk);
+    }
+    else
+        bound_triangles(0, count, box);
+
+    if (count > 0)
+    {
+        bvh_node root;
+        root.build(prims, 0, count, options, nullptr);
+        tree_nodes = linear_bvh(root).nodes;
+    }
+
+    // Store the triangles in leaf order.
+    auto reorder = [&](std::vector<uint32_t>& indices)
+    {
+        if (indices.empty()) return;
+        std::vector<uint32_t> ordered(indices.size());
+        auto copy_triangles = [&](size_t, size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; ++i)
+                std::copy_n(&indices[3 * static_cast<size_t>(prims[i].index)], 3, &ordered[3 * i]);
+        };
+        if (parallel)
+            parallel_for(*options.pool, 0, count, bvh_parallel_grain, copy_triangles);
+        else
+            copy_triangles(0, 0, count);
+        indices.swap(ordered);
+    };
+    reorder(mesh.position_indices);
+    reorder(mesh.normal_indices);
+    reorder(mesh.uv_indices);
+
+    view = mesh.view();
+    nodes = tree_nodes.data();
+    node_count = static_cast<uint32_t>(tree_nodes.size());
+}
+
+bool triangle_mesh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    const watertight_ray wr(r);
+    return traverse_linear_bvh<false>(nodes, node_count, r, t_min, t_max, [&](uint32_t first, uint32_t count, float& t_closest)
+    {
+        bool hit_leaf = false;
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            glm::vec3 v0, v1, v2;
+            triangle(i, v0, v1, v2);
+
+            float t, b1, b2;
+            if (wr.intersect(v0, v1, v2, t_min, t_closest, t, b1, b2))
+            {
+                rec.t = t;
+                rec.object = this;
+                rec.primitive = i;
+                rec.b0 = b1;
+                rec.b1 = b2;
+                t_closest = t;
+                hit_leaf = true;
+            }
+        }
+        return hit_leaf;
+    });
+}
+
+bool triangle_mesh::occluded(const ray& r, float t_min, float t_max) const
+{
+    const watertight_ray wr(r);
+    return traverse_linear_bvh<true>(nodes, node_count, r, t_min, t_max, [&](uint32_t first, uint32_t count, float& t_closest)
+    {
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            glm::vec3 v0, v1, v2;
+            triangle(i, v0, v1, v2);
+
+            float t, b1, b2;
+            if (wr.intersect(v0, v1, v2, t_min, t_closest, t, b1, b2))
+                return true;
+        }
+        return false;
+    });
+}
+
+void triangle_mesh::resolve_hit(const ray& r, hit_record& rec) const
+{
+    const size_t base = 3 * static_cast<size_t>(rec.primitive);
+    const float b1 = rec.b0;
+    const float b2 = rec.b1;
+    const float b0 = 1.f - b1 - b2;
+
+    glm::vec3 v0, v1, v2;
+    triangle(rec.primitive, v0, v1, v2);
+
+    // Interpolating the vertices keeps the point on the triangle, r.at(t) can end up
+    // slightly behind it.
+    rec.p = b0 * v0 + b1 * v1 + b2 * v2;
+    rec.set_face_normal(r, glm::normalize(glm::cross(v1 - v0, v2 - v0)));
+
+    if (view.normal_indices)
+    {
+        const uint32_t* idx = &view.normal_indices[base];
+        const glm::vec3 n = b0 * view.normal(idx[0]) + b1 * view.normal(idx[1]) + b2 * view.normal(idx[2]);
+        const float length = glm::length(n);
+        if (length > 0.f)
+            rec.normal = (rec.front_face ? 1.f : -1.f) * (n / length);
+    }
+
+    if (view.uv_indices)
+    {
+        const uint32_t* idx = &view.uv_indices[base];
+        rec.u = b0 * view.tu[idx[0]] + b1 * view.tu[idx[1]] + b2 * view.tu[idx[2]];
+        rec.v = b0 * view.tv[idx[0]] + b1 * view.tv[idx[1]] + b2 * view.tv[idx[2]];
+    }
+    else
+    {
+        rec.u = b1;
+        rec.v = b2;
+    }
+
+    rec.mat_ptr = mat_ptr.get();
+}
+
+bool triangle_mesh::bounding_box(float time0, float time1, aabb& output_box) const
+{
+    if (view.triangle_count == 0)
+        return false;
+    output_box = box;
+    return true;
+}
+
+#endif
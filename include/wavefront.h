@@ -0,0 +1,280 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "light_set.h"
+#include "material.h"
+#include "morton.h"
+#include "ray_packet.h"
+
+// How the renderer follows the paths of its camera rays: one at a time to the end, or as a
+// wavefront of many paths that advance a bounce at a time.
+enum class integrator_type
+{
+    path,
+    wavefront
+};
+
+const char* const integrator_type_names[] = { "path", "wavefront" };
+
+inline bool parse_integrator_type(const std::string& name, integrator_type& type)
+{
+    for (int i = 0; i < 2; ++i)
+    {
+        if (name == integrator_type_names[i])
+        {
+            type = static_cast<integrator_type>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Path state a wavefront queue holds by default, half of a common 1 MB L2 cache so the rays,
+// hits and shading state of a bounce are still cached from one stage to the next.
+const size_t default_wavefront_queue_bytes = 512 * 1024;
+
+// Paths in flight for the wavefront integrator. Rather than following one path through
+// traversal, materials, textures and lights in turn, every stage of a bounce runs over all
+// queued paths before the next one starts: closest hits for all rays, then shading, then
+// shadow rays for all light samples, traced in packets. Each stage reads only the arrays
+// it needs, and the shading stage takes the hits grouped by material type, so one
+// material's code runs over a batch of hits with its virtual calls made direct.
+//
+// Bounce rays leave their hits in every direction, so traced in the order their paths were
+// queued, neighbours in the queue share few BVH nodes and each ray finds the nodes of the
+// last one evicted from the cache. With sort_rays the queue traces them along a Z-order
+// curve of their origins, and rays from the same cell by the octant of their direction, so
+// rays one after another start near each other, mostly heading the same way, and walk the
+// same nodes. Sorting by octant first instead would sweep the scene eight times per bounce
+// and, in scenes larger than the cache, bring every node back eight times.
+//
+// A path carries its own random number generator and sampler between stages and does the
+// same work in the same order as shade_hit, so both integrators give the same image.
+class wavefront_queue
+{
+public:
+    wavefront_queue() : sort_rays(true), capacity(0), count(0) {}
+
+    // Paths whose state fits in bytes, at least one.
+    static size_t capacity_for(size_t bytes);
+
+    // Empties the queue and makes room for capacity paths.
+    void reset(size_t capacity);
+
+    size_t size() const { return count; }
+    bool full() const { return count >= capacity; }
+
+    // Queues a path starting with the camera ray r. The calling thread's generator and
+    // sampler hold the path's random sequence, where generating the ray left it.
+    void push(const ray& r);
+
+    // Follows every queued path to its end. radiance(i) is then what the i-th pushed path
+    // brought back, until the next reset.
+    void run(const hittable& world, const light_set* lights, const glm::vec3& background, int depth, int roulette_depth);
+
+    const glm::vec3& radiance(size_t i) const { return paths[i].radiance; }
+
+public:
+    bool sort_rays;
+
+    // One entry per path, in the order they were pushed.
+    std::vector<ray> rays;
+    std::vector<hit_record> hits;
+    std::vector<path_state> paths;
+    std::vector<pcg32> rngs;
+    std::vector<sampler> samplers;
+
+private:
+    // Orders active by the Morton code of the rays' origins within bounds, then by the octant
+    // of their directions.
+    void sort_active(const aabb& bounds);
+
+    template <class M>
+    void shade(const std::vector<uint32_t>& batch, const light_set* lights, int depth, int roulette_depth);
+
+    size_t capacity;
+    size_t count;
+
+    // Paths at each stage of a bounce, as indices into the arrays above.
+    std::vector<uint32_t> active;
+    std::vector<morton_key> keys;
+    radix_sort_buffers sort_buffers;
+    std::vector<uint32_t> by_material[material_type_count];
+    std::vector<uint32_t> continuing;
+    std::vector<uint32_t> shadow_paths;
+    std::vector<shadow_ray> shadows;
+};
+
+size_t wavefront_queue::capacity_for(size_t bytes)
+{
+    // Every path has an entry in each array, is in one index list per stage, may have a
+    // shadow ray and has a sort key, which takes twice its size while it is sorted.
+    const size_t path_bytes = sizeof(ray) + sizeof(hit_record) + sizeof(path_state) + sizeof(pcg32) + sizeof(sampler)
+        + 3 * sizeof(uint32_t) + sizeof(shadow_ray) + 2 * sizeof(morton_key);
+    return std::max<size_t>(1, bytes / path_bytes);
+}
+
+void wavefront_queue::reset(size_t new_capacity)
+{
+    count = 0;
+    if (new_capacity == capacity)
+        return;
+
+    capacity = new_capacity;
+    rays.resize(capacity);
+    hits.resize(capacity);
+    paths.resize(capacity);
+    rngs.resize(capacity);
+    samplers.resize(capacity);
+    active.reserve(capacity);
+    keys.reserve(capacity);
+    sort_buffers.sorted.reserve(capacity);
+    sort_buffers.offsets.reserve(256 * parallel_chunk_count(0, capacity, radix_sort_grain));
+    for (auto& batch : by_material)
+        batch.reserve(capacity);
+    continuing.reserve(capacity);
+    shadow_paths.reserve(capacity);
+    shadows.reserve(capacity);
+}
+
+void wavefront_queue::push(const ray& r)
+{
+    rays[count] = r;
+    paths[count] = path_state();
+    rngs[count] = thread_rng();
+    samplers[count] = thread_sampler();
+    ++count;
+}
+
+void wavefront_queue::sort_active(const aabb& bounds)
+{
+    const glm::vec3 extent = bounds.maximum - bounds.minimum;
+    const glm::vec3 scale(extent.x > 0.f ? 1.f / extent.x : 0.f, extent.y > 0.f ? 1.f / extent.y : 0.f,
+        extent.z > 0.f ? 1.f / extent.z : 0.f);
+
+    keys.resize(active.size());
+    for (size_t k = 0; k < active.size(); ++k)
+    {
+        const ray& r = rays[active[k]];
+        const glm::vec3 d = r.direction();
+        const uint64_t octant = (d.x < 0.f ? 4 : 0) | (d.y < 0.f ? 2 : 0) | (d.z < 0.f ? 1 : 0);
+        keys[k].code = (morton_code((r.origin() - bounds.minimum) * scale, 30) << 3) | octant;
+        keys[k].index = active[k];
+    }
+    radix_sort(keys, 33, nullptr, sort_buffers);
+    for (size_t k = 0; k < active.size(); ++k)
+        active[k] = keys[k].index;
+}
+
+template <class M>
+void wavefront_queue::shade(const std::vector<uint32_t>& batch, const light_set* lights, int depth, int roulette_depth)
+{
+    for (uint32_t i : batch)
+    {
+        thread_rng() = rngs[i];
+        thread_sampler() = samplers[i];
+
+        ray next;
+        shadow_ray shadow;
+        const bool more = shade_bounce<M>(paths[i], rays[i], hits[i], lights, depth, roulette_depth, next, shadow);
+
+        rngs[i] = thread_rng();
+        samplers[i] = thread_sampler();
+        if (shadow.active)
+        {
+            shadow_paths.push_back(i);
+            shadows.push_back(shadow);
+        }
+        if (more)
+        {
+            rays[i] = next;
+            continuing.push_back(i);
+        }
+    }
+}
+
+void wavefront_queue::run(const hittable& world, const light_set* lights, const glm::vec3& background, int depth, int roulette_depth)
+{
+    active.clear();
+    for (size_t i = 0; i < count; ++i)
+        active.push_back(static_cast<uint32_t>(i));
+
+    aabb bounds;
+    if (!world.bounding_box(0.f, 1.f, bounds))
+        bounds = aabb(glm::vec3(0.f, 0.f, 0.f), glm::vec3(0.f, 0.f, 0.f));
+
+    // Camera rays were queued pixel by pixel and are coherent already.
+    for (bool camera_rays = true; !active.empty(); camera_rays = false)
+    {
+        if (sort_rays && !camera_rays)
+            sort_active(bounds);
+
+        // Closest hits, resolved so their materials are known and sorted into a batch per
+        // material type. Paths that miss end here.
+        for (auto& batch : by_material)
+            batch.clear();
+        for (uint32_t i : active)
+        {
+            if (!world.hit(rays[i], 0.001f, infinity, hits[i]))
+            {
+                escape_path(paths[i], rays[i], background, lights);
+                continue;
+            }
+            hits[i].resolve(rays[i]);
+            by_material[static_cast<int>(hits[i].mat_ptr->type())].push_back(i);
+        }
+
+        continuing.clear();
+        shadow_paths.clear();
+        shadows.clear();
+        shade<lambertian>(by_material[static_cast<int>(material_type::lambertian)], lights, depth, roulette_depth);
+        shade<metal>(by_material[static_cast<int>(material_type::metal)], lights, depth, roulette_depth);
+        shade<dielectric>(by_material[static_cast<int>(material_type::dielectric)], lights, depth, roulette_depth);
+        shade<diffuse_light>(by_material[static_cast<int>(material_type::diffuse_light)], lights, depth, roulette_depth);
+        shade<material>(by_material[static_cast<int>(material_type::other)], lights, depth, roulette_depth);
+
+        // The light samples of the bounce, added before the next bounce adds what it finds.
+        // Shadow rays of paths next to each other in the queue start near each other, so
+        // they are traced as packets.
+        for (size_t k = 0; k < shadows.size(); k += ray_packet_size)
+        {
+            const int lanes = static_cast<int>(std::min<size_t>(ray_packet_size, shadows.size() - k));
+            ray_packet packet;
+            packet.active = 0;
+            for (int lane = 0; lane < lanes; ++lane)
+            {
+                packet.rays[lane] = shadows[k + lane].r;
+                packet.t_max[lane] = shadows[k + lane].t_max;
+                packet.active |= 1u << lane;
+            }
+
+            const uint32_t blocked = world.occluded_packet(packet, 0.001f);
+            for (int lane = 0; lane < lanes; ++lane)
+            {
+                if (!(blocked & (1u << lane)))
+                    paths[shadow_paths[k + lane]].radiance += shadows[k + lane].contribution;
+            }
+        }
+
+        active.swap(continuing);
+    }
+}
+
+// Queue of the calling thread, reused from tile to tile.
+inline wavefront_queue& thread_wavefront_queue()
+{
+    static thread_local wavefront_queue queue;
+    return queue;
+}
+
+#endif
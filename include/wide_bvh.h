@@ -0,0 +1,958 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "common.h"
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "bvh.h"
+#include "node_cache.h"
+#include "simd.h"
+
+// Node of an N-wide BVH. Child boxes are stored as structure of arrays so one SSE (N = 4)
+// or AVX (N = 8) slab test covers every child at once. Nodes start on a cache line, so
+// reading one never touches more lines than its size needs.
+template <int N>
+struct alignas(64) wide_bvh_node
+{
+    float min_x[N], min_y[N], min_z[N];
+    float max_x[N], max_y[N], max_z[N];
+    uint32_t child[N];  // node index, or first object of a leaf
+    uint32_t count[N];  // objects in a leaf child, 0 for interior or empty slots
+};
+
+// A ray prepared once per traversal.
+struct wide_ray
+{
+    glm::vec3 origin;
+    glm::vec3 inv_dir;
+    int dir_is_neg[3];
+};
+
+const uint32_t wide_bvh_empty_slot = 0xffffffffu;
+// Cosine of the widest angle between lanes that occluded_packet still traces as a packet.
+const float packet_occlusion_cone = 0.9f;
+// Entries the traversal stack holds before it moves to the heap.
+const int wide_bvh_stack_size = 512;
+
+// Child box tests, returning a bit per child hit and the entry distance of each child.
+// The near/far planes are picked by direction sign and the running interval is only replaced
+// by a strictly better value, which is the same arithmetic as aabb::hit and slab_hit, so all
+// variants report the same hits.
+
+template <int N>
+int wide_children_hit_scalar(const wide_bvh_node<N>& node, const wide_ray& r, float t_min, float t_max, float* t_near)
+{
+    const float* near_x = r.dir_is_neg[0] ? node.max_x : node.min_x;
+    const float* far_x = r.dir_is_neg[0] ? node.min_x : node.max_x;
+    const float* near_y = r.dir_is_neg[1] ? node.max_y : node.min_y;
+    const float* far_y = r.dir_is_neg[1] ? node.min_y : node.max_y;
+    const float* near_z = r.dir_is_neg[2] ? node.max_z : node.min_z;
+    const float* far_z = r.dir_is_neg[2] ? node.min_z : node.max_z;
+
+    int mask = 0;
+    for (int i = 0; i < N; ++i)
+    {
+        float t0 = t_min;
+        float t1 = t_max;
+
+        float a = (near_x[i] - r.origin.x) * r.inv_dir.x;
+        float b = (far_x[i] - r.origin.x) * r.inv_dir.x;
+        t0 = a > t0 ? a : t0;
+        t1 = b < t1 ? b : t1;
+
+        a = (near_y[i] - r.origin.y) * r.inv_dir.y;
+        b = (far_y[i] - r.origin.y) * r.inv_dir.y;
+        t0 = a > t0 ? a : t0;
+        t1 = b < t1 ? b : t1;
+
+        a = (near_z[i] - r.origin.z) * r.inv_dir.z;
+        b = (far_z[i] - r.origin.z) * r.inv_dir.z;
+        t0 = a > t0 ? a : t0;
+        t1 = b < t1 ? b : t1;
+
+        t_near[i] = t0;
+        if (t0 < t1)
+            mask |= 1 << i;
+    }
+    return mask;
+}
+
+#if defined(RT_X86)
+
+// _mm_max_ps(a, b) is exactly (a > b ? a : b), including returning b when a is NaN.
+RT_TARGET_SSE2 inline int wide_children_hit_sse(const wide_bvh_node<4>& node, const wide_ray& r, float t_min, float t_max, float* t_near)
+{
+    __m128 t0 = _mm_set1_ps(t_min);
+    __m128 t1 = _mm_set1_ps(t_max);
+
+    const __m128 ox = _mm_set1_ps(r.origin.x), oy = _mm_set1_ps(r.origin.y), oz = _mm_set1_ps(r.origin.z);
+    const __m128 ix = _mm_set1_ps(r.inv_dir.x), iy = _mm_set1_ps(r.inv_dir.y), iz = _mm_set1_ps(r.inv_dir.z);
+
+    __m128 a = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(r.dir_is_neg[0] ? node.max_x : node.min_x), ox), ix);
+    __m128 b = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(r.dir_is_neg[0] ? node.min_x : node.max_x), ox), ix);
+    t0 = _mm_max_ps(a, t0);
+    t1 = _mm_min_ps(b, t1);
+
+    a = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(r.dir_is_neg[1] ? node.max_y : node.min_y), oy), iy);
+    b = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(r.dir_is_neg[1] ? node.min_y : node.max_y), oy), iy);
+    t0 = _mm_max_ps(a, t0);
+    t1 = _mm_min_ps(b, t1);
+
+    a = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(r.dir_is_neg[2] ? node.max_z : node.min_z), oz), iz);
+    b = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(r.dir_is_neg[2] ? node.min_z : node.max_z), oz), iz);
+    t0 = _mm_max_ps(a, t0);
+    t1 = _mm_min_ps(b, t1);
+
+    _mm_storeu_ps(t_near, t0);
+    return _mm_movemask_ps(_mm_cmplt_ps(t0, t1));
+}
+
+RT_TARGET_AVX inline int wide_children_hit_avx(const wide_bvh_node<8>& node, const wide_ray& r, float t_min, float t_max, float* t_near)
+{
+    __m256 t0 = _mm256_set1_ps(t_min);
+    __m256 t1 = _mm256_set1_ps(t_max);
+
+    const __m256 ox = _mm256_set1_ps(r.origin.x), oy = _mm256_set1_ps(r.origin.y), oz = _mm256_set1_ps(r.origin.z);
+    const __m256 ix = _mm256_set1_ps(r.inv_dir.x), iy = _mm256_set1_ps(r.inv_dir.y), iz = _mm256_set1_ps(r.inv_dir.z);
+
+    __m256 a = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(r.dir_is_neg[0] ? node.max_x : node.min_x), ox), ix);
+    __m256 b = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(r.dir_is_neg[0] ? node.min_x : node.max_x), ox), ix);
+    t0 = _mm256_max_ps(a, t0);
+    t1 = _mm256_min_ps(b, t1);
+
+    a = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(r.dir_is_neg[1] ? node.max_y : node.min_y), oy), iy);
+    b = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(r.dir_is_neg[1] ? node.min_y : node.max_y), oy), iy);
+    t0 = _mm256_max_ps(a, t0);
+    t1 = _mm256_min_ps(b, t1);
+
+    a = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(r.dir_is_neg[2] ? node.max_z : node.min_z), oz), iz);
+    b = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(r.dir_is_neg[2] ? node.min_z : node.max_z), oz), iz);
+    t0 = _mm256_max_ps(a, t0);
+    t1 = _mm256_min_ps(b, t1);
+
+    _mm256_storeu_ps(t_near, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LT_OQ));
+}
+
+#endif
+
+// A coherent ray packet laid out so one box can be tested against every lane at once.
+// All active lanes share direction signs, so the near and far planes are the same for the
+// whole packet and the per-lane arithmetic is again exactly that of slab_hit.
+struct alignas(32) packet_rays
+{
+    float origin_x[ray_packet_size], origin_y[ray_packet_size], origin_z[ray_packet_size];
+    float inv_dir_x[ray_packet_size], inv_dir_y[ray_packet_size], inv_dir_z[ray_packet_size];
+    float t_max[ray_packet_size];
+    int dir_is_neg[3];
+};
+
+// Lays out the lanes of packet in active, which all share the direction signs dir_is_neg.
+inline void load_packet_rays(const ray_packet& packet, uint32_t active_lanes, const int* dir_is_neg, packet_rays& rays)
+{
+    rays.dir_is_neg[0] = dir_is_neg[0];
+    rays.dir_is_neg[1] = dir_is_neg[1];
+    rays.dir_is_neg[2] = dir_is_neg[2];
+    for (int lane = 0; lane < ray_packet_size; ++lane)
+    {
+        const ray& r = packet.rays[lane];
+        const bool active = (active_lanes & (1u << lane)) != 0;
+        const glm::vec3 inv_dir = active ? 1.f / r.direction() : glm::vec3(1.f, 1.f, 1.f);
+        rays.origin_x[lane] = active ? r.origin().x : 0.f;
+        rays.origin_y[lane] = active ? r.origin().y : 0.f;
+        rays.origin_z[lane] = active ? r.origin().z : 0.f;
+        rays.inv_dir_x[lane] = inv_dir.x;
+        rays.inv_dir_y[lane] = inv_dir.y;
+        rays.inv_dir_z[lane] = inv_dir.z;
+        // Inactive lanes never enter a box.
+        rays.t_max[lane] = active ? packet.t_max[lane] : -infinity;
+    }
+}
+
+// Packet against one child box, returning a bit per lane that enters it and the nearest
+// entry distance among those lanes.
+
+template <int N>
+uint32_t packet_child_hit_scalar(const wide_bvh_node<N>& node, int i, const packet_rays& p, float t_min, float& t_near)
+{
+    const float near_x = p.dir_is_neg[0] ? node.max_x[i] : node.min_x[i];
+    const float far_x = p.dir_is_neg[0] ? node.min_x[i] : node.max_x[i];
+    const float near_y = p.dir_is_neg[1] ? node.max_y[i] : node.min_y[i];
+    const float far_y = p.dir_is_neg[1] ? node.min_y[i] : node.max_y[i];
+    const float near_z = p.dir_is_neg[2] ? node.max_z[i] : node.min_z[i];
+    const float far_z = p.dir_is_neg[2] ? node.min_z[i] : node.max_z[i];
+
+    uint32_t mask = 0;
+    t_near = infinity;
+    for (int lane = 0; lane < ray_packet_size; ++lane)
+    {
+        float t0 = t_min;
+        float t1 = p.t_max[lane];
+
+        float a = (near_x - p.origin_x[lane]) * p.inv_dir_x[lane];
+        float b = (far_x - p.origin_x[lane]) * p.inv_dir_x[lane];
+        t0 = a > t0 ? a : t0;
+        t1 = b < t1 ? b : t1;
+
+        a = (near_y - p.origin_y[lane]) * p.inv_dir_y[lane];
+        b = (far_y - p.origin_y[lane]) * p.inv_dir_y[lane];
+        t0 = a > t0 ? a : t0;
+        t1 = b < t1 ? b : t1;
+
+        a = (near_z - p.origin_z[lane]) * p.inv_dir_z[lane];
+        b = (far_z - p.origin_z[lane]) * p.inv_dir_z[lane];
+        t0 = a > t0 ? a : t0;
+        t1 = b < t1 ? b : t1;
+
+        if (t0 < t1)
+        {
+            mask |= 1u << lane;
+            t_near = t0 < t_near ? t0 : t_near;
+        }
+    }
+    return mask;
+}
+
+#if defined(RT_X86)
+
+// Two halves of four lanes.
+template <int N>
+RT_TARGET_SSE2 uint32_t packet_child_hit_sse(const wide_bvh_node<N>& node, int i, const packet_rays& p, float t_min, float& t_near)
+{
+    const __m128 near_x = _mm_set1_ps(p.dir_is_neg[0] ? node.max_x[i] : node.min_x[i]);
+    const __m128 far_x = _mm_set1_ps(p.dir_is_neg[0] ? node.min_x[i] : node.max_x[i]);
+    const __m128 near_y = _mm_set1_ps(p.dir_is_neg[1] ? node.max_y[i] : node.min_y[i]);
+    const __m128 far_y = _mm_set1_ps(p.dir_is_neg[1] ? node.min_y[i] : node.max_y[i]);
+    const __m128 near_z = _mm_set1_ps(p.dir_is_neg[2] ? node.max_z[i] : node.min_z[i]);
+    const __m128 far_z = _mm_set1_ps(p.dir_is_neg[2] ? node.min_z[i] : node.max_z[i]);
+    const __m128 inf = _mm_set1_ps(infinity);
+
+    uint32_t mask = 0;
+    __m128 nearest = inf;
+    for (int half = 0; half < ray_packet_size; half += 4)
+    {
+        __m128 t0 = _mm_set1_ps(t_min);
+        __m128 t1 = _mm_load_ps(p.t_max + half);
+
+        __m128 o = _mm_load_ps(p.origin_x + half), inv = _mm_load_ps(p.inv_dir_x + half);
+        t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(near_x, o), inv), t0);
+        t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(far_x, o), inv), t1);
+
+        o = _mm_load_ps(p.origin_y + half);
+        inv = _mm_load_ps(p.inv_dir_y + half);
+        t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(near_y, o), inv), t0);
+        t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(far_y, o), inv), t1);
+
+        o = _mm_load_ps(p.origin_z + half);
+        inv = _mm_load_ps(p.inv_dir_z + half);
+        t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(near_z, o), inv), t0);
+        t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(far_z, o), inv), t1);
+
+        const __m128 entered = _mm_cmplt_ps(t0, t1);
+        mask |= static_cast<uint32_t>(_mm_movemask_ps(entered)) << half;
+        nearest = _mm_min_ps(nearest, _mm_or_ps(_mm_and_ps(entered, t0), _mm_andnot_ps(entered, inf)));
+    }
+
+    nearest = _mm_min_ps(nearest, _mm_movehl_ps(nearest, nearest));
+    nearest = _mm_min_ss(nearest, _mm_shuffle_ps(nearest, nearest, 1));
+    t_near = _mm_cvtss_f32(nearest);
+    return mask;
+}
+
+template <int N>
+RT_TARGET_AVX uint32_t packet_child_hit_avx(const wide_bvh_node<N>& node, int i, const packet_rays& p, float t_min, float& t_near)
+{
+    static_assert(ray_packet_size == 8, "the AVX packet kernel covers eight lanes");
+
+    __m256 t0 = _mm256_set1_ps(t_min);
+    __m256 t1 = _mm256_load_ps(p.t_max);
+
+    __m256 o = _mm256_load_ps(p.origin_x), inv = _mm256_load_ps(p.inv_dir_x);
+    t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(p.dir_is_neg[0] ? node.max_x[i] : node.min_x[i]), o), inv), t0);
+    t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(p.dir_is_neg[0] ? node.min_x[i] : node.max_x[i]), o), inv), t1);
+
+    o = _mm256_load_ps(p.origin_y);
+    inv = _mm256_load_ps(p.inv_dir_y);
+    t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(p.dir_is_neg[1] ? node.max_y[i] : node.min_y[i]), o), inv), t0);
+    t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(p.dir_is_neg[1] ? node.min_y[i] : node.max_y[i]), o), inv), t1);
+
+    o = _mm256_load_ps(p.origin_z);
+    inv = _mm256_load_ps(p.inv_dir_z);
+    t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(p.dir_is_neg[2] ? node.max_z[i] : node.min_z[i]), o), inv), t0);
+    t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(p.dir_is_neg[2] ? node.min_z[i] : node.max_z[i]), o), inv), t1);
+
+    const __m256 entered = _mm256_cmp_ps(t0, t1, _CMP_LT_OQ);
+    const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(entered));
+    if (mask == 0)
+        return 0;
+
+    const __m256 entry = _mm256_or_ps(_mm256_and_ps(entered, t0), _mm256_andnot_ps(entered, _mm256_set1_ps(infinity)));
+    __m128 nearest = _mm_min_ps(_mm256_castps256_ps128(entry), _mm256_extractf128_ps(entry, 1));
+    nearest = _mm_min_ps(nearest, _mm_movehl_ps(nearest, nearest));
+    nearest = _mm_min_ss(nearest, _mm_shuffle_ps(nearest, nearest, 1));
+    t_near = _mm_cvtss_f32(nearest);
+    return mask;
+}
+
+#endif
+
+// Packet against every child of a node for any-hit traversal, setting lanes[i] to the lanes
+// that enter child i. Any-hit traversal has no use for entry distances, so one call covers
+// the node instead of one per child.
+
+template <int N>
+void packet_children_hit_scalar(const wide_bvh_node<N>& node, const packet_rays& p, float t_min, uint32_t* lanes)
+{
+    for (int i = 0; i < N; ++i)
+    {
+        float t_near;
+        lanes[i] = packet_child_hit_scalar(node, i, p, t_min, t_near);
+    }
+}
+
+#if defined(RT_X86)
+
+template <int N>
+RT_TARGET_SSE2 void packet_children_hit_sse(const wide_bvh_node<N>& node, const packet_rays& p, float t_min, uint32_t* lanes)
+{
+    const float* near_x = p.dir_is_neg[0] ? node.max_x : node.min_x;
+    const float* far_x = p.dir_is_neg[0] ? node.min_x : node.max_x;
+    const float* near_y = p.dir_is_neg[1] ? node.max_y : node.min_y;
+    const float* far_y = p.dir_is_neg[1] ? node.min_y : node.max_y;
+    const float* near_z = p.dir_is_neg[2] ? node.max_z : node.min_z;
+    const float* far_z = p.dir_is_neg[2] ? node.min_z : node.max_z;
+
+    for (int i = 0; i < N; ++i)
+        lanes[i] = 0;
+    for (int half = 0; half < ray_packet_size; half += 4)
+    {
+        const __m128 ox = _mm_load_ps(p.origin_x + half), oy = _mm_load_ps(p.origin_y + half), oz = _mm_load_ps(p.origin_z + half);
+        const __m128 ix = _mm_load_ps(p.inv_dir_x + half), iy = _mm_load_ps(p.inv_dir_y + half), iz = _mm_load_ps(p.inv_dir_z + half);
+        const __m128 lo = _mm_set1_ps(t_min), hi = _mm_load_ps(p.t_max + half);
+        for (int i = 0; i < N; ++i)
+        {
+            __m128 t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(near_x[i]), ox), ix), lo);
+            __m128 t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(far_x[i]), ox), ix), hi);
+            t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(near_y[i]), oy), iy), t0);
+            t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(far_y[i]), oy), iy), t1);
+            t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(near_z[i]), oz), iz), t0);
+            t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(far_z[i]), oz), iz), t1);
+            lanes[i] |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmplt_ps(t0, t1))) << half;
+        }
+    }
+}
+
+template <int N>
+RT_TARGET_AVX void packet_children_hit_avx(const wide_bvh_node<N>& node, const packet_rays& p, float t_min, uint32_t* lanes)
+{
+    const float* near_x = p.dir_is_neg[0] ? node.max_x : node.min_x;
+    const float* far_x = p.dir_is_neg[0] ? node.min_x : node.max_x;
+    const float* near_y = p.dir_is_neg[1] ? node.max_y : node.min_y;
+    const float* far_y = p.dir_is_neg[1] ? node.min_y : node.max_y;
+    const float* near_z = p.dir_is_neg[2] ? node.max_z : node.min_z;
+    const float* far_z = p.dir_is_neg[2] ? node.min_z : node.max_z;
+
+    const __m256 ox = _mm256_load_ps(p.origin_x), oy = _mm256_load_ps(p.origin_y), oz = _mm256_load_ps(p.origin_z);
+    const __m256 ix = _mm256_load_ps(p.inv_dir_x), iy = _mm256_load_ps(p.inv_dir_y), iz = _mm256_load_ps(p.inv_dir_z);
+    const __m256 lo = _mm256_set1_ps(t_min), hi = _mm256_load_ps(p.t_max);
+    for (int i = 0; i < N; ++i)
+    {
+        __m256 t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(near_x[i]), ox), ix), lo);
+        __m256 t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(far_x[i]), ox), ix), hi);
+        t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(near_y[i]), oy), iy), t0);
+        t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(far_y[i]), oy), iy), t1);
+        t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(near_z[i]), oz), iz), t0);
+        t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(far_z[i]), oz), iz), t1);
+        lanes[i] = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LT_OQ)));
+    }
+}
+
+#endif
+
+template <int N>
+class wide_bvh : public hittable
+{
+public:
+    typedef int (*children_hit_fn)(const wide_bvh_node<N>&, const wide_ray&, float, float, float*);
+    typedef uint32_t (*packet_child_hit_fn)(const wide_bvh_node<N>&, int, const packet_rays&, float, float&);
+    typedef void (*packet_children_hit_fn)(const wide_bvh_node<N>&, const packet_rays&, float, uint32_t*);
+
+    wide_bvh()
+        : level(simd_level::scalar), children_hit(&wide_children_hit_scalar<N>), packet_child_hit(&packet_child_hit_scalar<N>),
+        packet_children_hit(&packet_children_hit_scalar<N>)
+    {}
+    wide_bvh(const bvh_node& root, simd_level requested = detect_simd_level());
+
+    virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
+    virtual uint32_t hit_packet(const ray_packet& packet, float t_min, hit_record* recs) const override;
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override;
+    virtual uint32_t occluded_packet(const ray_packet& packet, float t_min) const override;
+
+    // Picks the child test kernel, falling back to scalar when the CPU or width does not allow the request.
+    void set_simd_level(simd_level requested);
+    simd_level get_simd_level() const { return level; }
+
+    // Recomputes the child boxes from the current object bounds after objects moved, keeping
+    // the tree's shape. One pass over the nodes: children always come after their parent.
+    void refit(float time0, float time1);
+
+public:
+    std::vector<wide_bvh_node<N>> nodes;
+    shared_ptr<const std::vector<shared_ptr<hittable>>> objects;
+    aabb box;
+
+private:
+    simd_level level;
+    children_hit_fn children_hit;
+    packet_child_hit_fn packet_child_hit;
+    packet_children_hit_fn packet_children_hit;
+
+    uint32_t collapse(const bvh_node& node);
+
+    // occluded_packet for the lanes in group, which share the direction signs dir_is_neg.
+    uint32_t occluded_group(const ray_packet& packet, uint32_t group, const int* dir_is_neg, float t_min) const;
+};
+
+template <int N>
+wide_bvh<N>::wide_bvh(const bvh_node& root, simd_level requested)
+    : objects(root.objects), box(root.box)
+{
+    set_simd_level(requested);
+
+    if (root.is_leaf() && root.object_count == 0)
+        return;
+
+    if (root.is_leaf())
+    {
+        // A single leaf still needs a node above it to hold its box.
+        bvh_node parent;
+        parent.left = make_shared<bvh_node>(root);
+        parent.box = root.box;
+        collapse(parent);
+        return;
+    }
+
+    collapse(root);
+}
+
+template <int N>
+void wide_bvh<N>::set_simd_level(simd_level requested)
+{
+    level = simd_level::scalar;
+    children_hit = &wide_children_hit_scalar<N>;
+    packet_child_hit = &packet_child_hit_scalar<N>;
+    packet_children_hit = &packet_children_hit_scalar<N>;
+
+    const simd_level available = detect_simd_level();
+    if (static_cast<int>(requested) > static_cast<int>(available))
+        requested = available;
+
+#if defined(RT_X86)
+    // Packet kernels run across lanes rather than children, so they do not depend on N.
+    if (requested == simd_level::avx)
+    {
+        packet_child_hit = &packet_child_hit_avx<N>;
+        packet_children_hit = &packet_children_hit_avx<N>;
+    }
+    else if (requested == simd_level::sse)
+    {
+        packet_child_hit = &packet_child_hit_sse<N>;
+        packet_children_hit = &packet_children_hit_sse<N>;
+    }
+
+    if constexpr (N == 4)
+    {
+        if (requested >= simd_level::sse)
+        {
+            level = simd_level::sse;
+            children_hit = &wide_children_hit_sse;
+        }
+    }
+    else if constexpr (N == 8)
+    {
+        if (requested >= simd_level::avx)
+        {
+            level = simd_level::avx;
+            children_hit = &wide_children_hit_avx;
+        }
+    }
+#endif
+}
+
+template <int N>
+uint32_t wide_bvh<N>::collapse(const bvh_node& node)
+{
+    // Open up the largest interior child until the node has N children, pulling grandchildren
+    // up one level. Large boxes are hit most often, so flattening them saves the most node visits.
+    const bvh_node* children[N];
+    int child_count = 0;
+    children[child_count++] = node.left.get();
+    if (node.right)
+        children[child_count++] = node.right.get();
+
+    while (child_count < N)
+    {
+        int best = -1;
+        float best_area = -1.f;
+        for (int i = 0; i < child_count; ++i)
+        {
+            if (!children[i]->is_leaf() && children[i]->box.surface_area() > best_area)
+            {
+                best = i;
+                best_area = children[i]->box.surface_area();
+            }
+        }
+        if (best < 0)
+            break;
+
+        const bvh_node* opened = children[best];
+        children[best] = opened->left.get();
+        children[child_count++] = opened->right.get();
+    }
+
+    const uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    for (int i = 0; i < N; ++i)
+    {
+        wide_bvh_node<N>& n = nodes[index];
+        if (i >= child_count)
+        {
+            // Inverted box, no ray ever enters it.
+            n.min_x[i] = n.min_y[i] = n.min_z[i] = infinity;
+            n.max_x[i] = n.max_y[i] = n.max_z[i] = -infinity;
+            n.child[i] = wide_bvh_empty_slot;
+            n.count[i] = 0;
+            continue;
+        }
+
+        const aabb& b = children[i]->box;
+        n.min_x[i] = b.minimum.x;
+        n.min_y[i] = b.minimum.y;
+        n.min_z[i] = b.minimum.z;
+        n.max_x[i] = b.maximum.x;
+        n.max_y[i] = b.maximum.y;
+        n.max_z[i] = b.maximum.z;
+
+        if (children[i]->is_leaf())
+        {
+            n.child[i] = children[i]->first_object;
+            n.count[i] = children[i]->object_count;
+        }
+        else
+        {
+            uint32_t child_index = collapse(*children[i]);
+            nodes[index].child[i] = child_index;
+            nodes[index].count[i] = 0;
+        }
+    }
+
+    return index;
+}
+
+template <int N>
+void wide_bvh<N>::refit(float time0, float time1)
+{
+    for (size_t index = nodes.size(); index-- > 0;)
+    {
+        wide_bvh_node<N>& n = nodes[index];
+        for (int i = 0; i < N; ++i)
+        {
+            if (n.child[i] == wide_bvh_empty_slot)
+                continue;
+
+            aabb b = empty_box();
+            if (n.count[i] > 0)
+            {
+                for (uint32_t k = n.child[i]; k < n.child[i] + n.count[i]; ++k)
+                {
+                    aabb object_box;
+                    if ((*objects)[k]->bounding_box(time0, time1, object_box))
+                        b.expand(object_box);
+                }
+            }
+            else
+            {
+                const wide_bvh_node<N>& c = nodes[n.child[i]];
+                for (int j = 0; j < N; ++j)
+                {
+                    if (c.child[j] != wide_bvh_empty_slot)
+                        b.expand(aabb(glm::vec3(c.min_x[j], c.min_y[j], c.min_z[j]), glm::vec3(c.max_x[j], c.max_y[j], c.max_z[j])));
+                }
+            }
+
+            n.min_x[i] = b.minimum.x;
+            n.min_y[i] = b.minimum.y;
+            n.min_z[i] = b.minimum.z;
+            n.max_x[i] = b.maximum.x;
+            n.max_y[i] = b.maximum.y;
+            n.max_z[i] = b.maximum.z;
+        }
+    }
+
+    box = empty_box();
+    if (nodes.empty())
+        return;
+    const wide_bvh_node<N>& root = nodes[0];
+    for (int i = 0; i < N; ++i)
+    {
+        if (root.child[i] != wide_bvh_empty_slot)
+            box.expand(aabb(glm::vec3(root.min_x[i], root.min_y[i], root.min_z[i]), glm::vec3(root.max_x[i], root.max_y[i], root.max_z[i])));
+    }
+}
+
+template <int N>
+bool wide_bvh<N>::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    if (nodes.empty())
+        return false;
+
+    wide_ray wr;
+    wr.origin = r.origin();
+    wr.inv_dir = 1.f / r.direction();
+    wr.dir_is_neg[0] = wr.inv_dir.x < 0.f;
+    wr.dir_is_neg[1] = wr.inv_dir.y < 0.f;
+    wr.dir_is_neg[2] = wr.inv_dir.z < 0.f;
+
+    struct stack_entry
+    {
+        uint32_t child;
+        uint32_t count;
+        float t_near;
+    };
+
+    traversal_stack<stack_entry, wide_bvh_stack_size> stack;
+    stack.push({ 0, 0, t_min });
+
+    bool hit_anything = false;
+    alignas(32) float t_near[N];
+
+    while (!stack.empty())
+    {
+        const stack_entry entry = stack.pop();
+        if (entry.t_near >= t_max)
+            continue;
+
+        if (entry.count > 0)
+        {
+            for (uint32_t i = entry.child; i < entry.child + entry.count; ++i)
+            {
+                if ((*objects)[i]->hit(r, t_min, t_max, rec))
+                {
+                    hit_anything = true;
+                    t_max = rec.t;
+                }
+            }
+            continue;
+        }
+
+        const wide_bvh_node<N>& node = nodes[entry.child];
+        count_node_fetch(&node, sizeof(node));
+        int mask = children_hit(node, wr, t_min, t_max, t_near);
+
+        // Push hit children far to near so the nearest is popped first.
+        const int first = stack.size;
+        while (mask)
+        {
+            int i = 0;
+            while (!(mask & (1 << i))) ++i;
+            mask &= mask - 1;
+
+            stack_entry e = { node.child[i], node.count[i], t_near[i] };
+            stack.push(e);
+            int j = stack.size - 1;
+            while (j > first && stack[j - 1].t_near < e.t_near)
+            {
+                stack[j] = stack[j - 1];
+                --j;
+            }
+            stack[j] = e;
+        }
+    }
+
+    return hit_anything;
+}
+
+template <int N>
+bool wide_bvh<N>::occluded(const ray& r, float t_min, float t_max) const
+{
+    if (nodes.empty())
+        return false;
+
+    wide_ray wr;
+    wr.origin = r.origin();
+    wr.inv_dir = 1.f / r.direction();
+    wr.dir_is_neg[0] = wr.inv_dir.x < 0.f;
+    wr.dir_is_neg[1] = wr.inv_dir.y < 0.f;
+    wr.dir_is_neg[2] = wr.inv_dir.z < 0.f;
+
+    // Any hit ends the query, so there is no point in sorting children by distance.
+    struct stack_entry
+    {
+        uint32_t child;
+        uint32_t count;
+    };
+
+    traversal_stack<stack_entry, wide_bvh_stack_size> stack;
+    stack.push({ 0, 0 });
+
+    alignas(32) float t_near[N];
+
+    while (!stack.empty())
+    {
+        const stack_entry entry = stack.pop();
+        if (entry.count > 0)
+        {
+            for (uint32_t i = entry.child; i < entry.child + entry.count; ++i)
+            {
+                if ((*objects)[i]->occluded(r, t_min, t_max))
+                    return true;
+            }
+            continue;
+        }
+
+        const wide_bvh_node<N>& node = nodes[entry.child];
+        count_node_fetch(&node, sizeof(node));
+        int mask = children_hit(node, wr, t_min, t_max, t_near);
+        while (mask)
+        {
+            int i = 0;
+            while (!(mask & (1 << i))) ++i;
+            mask &= mask - 1;
+            stack.push({ node.child[i], node.count[i] });
+        }
+    }
+
+    return false;
+}
+
+template <int N>
+uint32_t wide_bvh<N>::hit_packet(const ray_packet& packet, float t_min, hit_record* recs) const
+{
+    if (nodes.empty() || packet.active == 0)
+        return 0;
+
+    // Rays that do not share direction signs, such as bounce rays, rarely enter the same
+    // nodes; tracing them one by one is cheaper than carrying mostly idle lanes.
+    const packet_frustum frustum(packet);
+    if (!frustum.valid)
+        return hittable::hit_packet(packet, t_min, recs);
+
+    packet_rays rays;
+    load_packet_rays(packet, packet.active, frustum.dir_is_neg, rays);
+
+    // Each entry carries the lanes that entered it and the nearest of their entry distances.
+    struct stack_entry
+    {
+        uint32_t child;
+        uint32_t count;
+        uint32_t lanes;
+        float t_near;
+    };
+
+    traversal_stack<stack_entry, wide_bvh_stack_size> stack;
+    stack.push({ 0, 0, packet.active, t_min });
+
+    uint32_t hits = 0;
+    const bool cull_with_frustum = packet_child_hit == &packet_child_hit_scalar<N>;
+
+    while (!stack.empty())
+    {
+        const stack_entry entry = stack.pop();
+
+        if (entry.count > 0)
+        {
+            for (int lane = 0; lane < ray_packet_size; ++lane)
+            {
+                if (!(entry.lanes & (1u << lane)) || entry.t_near >= rays.t_max[lane]) continue;
+
+                for (uint32_t i = entry.child; i < entry.child + entry.count; ++i)
+                {
+                    if ((*objects)[i]->hit(packet.rays[lane], t_min, rays.t_max[lane], recs[lane]))
+                    {
+                        hits |= 1u << lane;
+                        rays.t_max[lane] = recs[lane].t;
+                    }
+                }
+            }
+            continue;
+        }
+
+        const wide_bvh_node<N>& node = nodes[entry.child];
+        count_node_fetch(&node, sizeof(node));
+
+        // Without vector units one conservative test for the whole packet is cheaper than a
+        // test per lane, and it rejects most boxes the packet misses.
+        float frustum_t_max = t_min;
+        if (cull_with_frustum)
+        {
+            for (int lane = 0; lane < ray_packet_size; ++lane)
+                frustum_t_max = rays.t_max[lane] > frustum_t_max ? rays.t_max[lane] : frustum_t_max;
+        }
+
+        // Push far to near, as in the single ray traversal.
+        const int first = stack.size;
+        for (int i = 0; i < N; ++i)
+        {
+            if (node.child[i] == wide_bvh_empty_slot) continue;
+
+            if (cull_with_frustum)
+            {
+                if (!frustum.may_hit(glm::vec3(node.min_x[i], node.min_y[i], node.min_z[i]),
+                    glm::vec3(node.max_x[i], node.max_y[i], node.max_z[i]), t_min, frustum_t_max))
+                    continue;
+            }
+
+            float t_near;
+            const uint32_t lanes = packet_child_hit(node, i, rays, t_min, t_near);
+            if (lanes == 0) continue;
+
+            stack_entry e = { node.child[i], node.count[i], lanes, t_near };
+            stack.push(e);
+            int j = stack.size - 1;
+            while (j > first && stack[j - 1].t_near < e.t_near)
+            {
+                stack[j] = stack[j - 1];
+                --j;
+            }
+            stack[j] = e;
+        }
+    }
+
+    return hits;
+}
+
+template <int N>
+uint32_t wide_bvh<N>::occluded_packet(const ray_packet& packet, float t_min) const
+{
+    if (nodes.empty() || packet.active == 0)
+        return 0;
+
+    // Shadow rays from neighbouring points towards one light walk mostly the same nodes, but
+    // rays towards different lights share few, and the packet kernels test every lane against
+    // every child a packet enters. So the lanes heading the way of the first one, into the
+    // same octant and within a narrow cone, are traced together if they fill at least half
+    // the packet. The other lanes are traced alone.
+    int first = 0;
+    while (!(packet.active & (1u << first))) ++first;
+    const glm::vec3 lead = packet.rays[first].direction();
+    const float lead_length2 = glm::dot(lead, lead);
+    // Sign bits decide the planes just as a negative 1 / d does, also for zero components.
+    const int dir_is_neg[3] = { std::signbit(lead.x), std::signbit(lead.y), std::signbit(lead.z) };
+    const int lead_octant = dir_is_neg[0] | dir_is_neg[1] << 1 | dir_is_neg[2] << 2;
+
+    // Same signs make the dot product positive, so comparing squares needs no roots.
+    uint32_t group = 0;
+    int group_size = 0;
+    for (int lane = first; lane < ray_packet_size; ++lane)
+    {
+        const glm::vec3 d = packet.rays[lane].direction();
+        const float cosine = glm::dot(d, lead);
+        const int octant = std::signbit(d.x) | std::signbit(d.y) << 1 | std::signbit(d.z) << 2;
+        const bool joins = ((packet.active >> lane) & 1u) & (octant == lead_octant)
+            & (cosine * cosine >= packet_occlusion_cone * packet_occlusion_cone * glm::dot(d, d) * lead_length2);
+        group |= uint32_t(joins) << lane;
+        group_size += joins;
+    }
+    if (group_size < ray_packet_size / 2)
+        group = 0;
+
+    uint32_t blocked = group ? occluded_group(packet, group, dir_is_neg, t_min) : 0;
+    for (int lane = first; lane < ray_packet_size; ++lane)
+    {
+        const uint32_t bit = 1u << lane;
+        if ((packet.active & ~group & bit) && wide_bvh<N>::occluded(packet.rays[lane], t_min, packet.t_max[lane]))
+            blocked |= bit;
+    }
+    return blocked;
+}
+
+template <int N>
+uint32_t wide_bvh<N>::occluded_group(const ray_packet& packet, uint32_t group, const int* dir_is_neg, float t_min) const
+{
+    packet_rays rays;
+    load_packet_rays(packet, group, dir_is_neg, rays);
+
+    // Any hit ends a lane, so children are not sorted by distance. A blocked lane's t_max
+    // becomes -infinity, after which it enters no box and drops out of the lane masks.
+    struct stack_entry
+    {
+        uint32_t child;
+        uint32_t count;
+        uint32_t lanes;
+    };
+
+    traversal_stack<stack_entry, wide_bvh_stack_size> stack;
+    stack.push({ 0, 0, group });
+
+    uint32_t blocked = 0;
+    uint32_t child_lanes[N];
+
+    while (!stack.empty())
+    {
+        const stack_entry entry = stack.pop();
+        const uint32_t lanes = entry.lanes & ~blocked;
+        if (lanes == 0) continue;
+
+        if (entry.count > 0)
+        {
+            for (int lane = 0; lane < ray_packet_size; ++lane)
+            {
+                if (!(lanes & (1u << lane))) continue;
+
+                for (uint32_t i = entry.child; i < entry.child + entry.count; ++i)
+                {
+                    if ((*objects)[i]->occluded(packet.rays[lane], t_min, packet.t_max[lane]))
+                    {
+                        blocked |= 1u << lane;
+                        rays.t_max[lane] = -infinity;
+                        break;
+                    }
+                }
+            }
+            if (blocked == group)
+                break;
+            continue;
+        }
+
+        const wide_bvh_node<N>& node = nodes[entry.child];
+        count_node_fetch(&node, sizeof(node));
+        packet_children_hit(node, rays, t_min, child_lanes);
+        for (int i = 0; i < N; ++i)
+        {
+            if (child_lanes[i] != 0)
+                stack.push({ node.child[i], node.count[i], child_lanes[i] });
+        }
+    }
+
+    return blocked;
+}
+
+template <int N>
+bool wide_bvh<N>::bounding_box(float time0, float time1, aabb& output_box) const
+{
+    if (nodes.empty()) return false;
+    output_box = box;
+    return true;
+}
+
+typedef wide_bvh<4> bvh4;
+typedef wide_bvh<8> bvh8;
+
+// Widest BVH the CPU can test in one instruction: BVH8 with AVX, otherwise BVH4 with SSE or scalar code.
+inline shared_ptr<hittable> make_wide_bvh(const bvh_node& root, simd_level requested = detect_simd_level())
+{
+    if (static_cast<int>(requested) > static_cast<int>(detect_simd_level()))
+        requested = detect_simd_level();
+
+    if (requested == simd_level::avx)
+        return make_shared<bvh8>(root, requested);
+    return make_shared<bvh4>(root, requested);
+}
+
+#endif
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "camera.h"
+#include "renderer.h"
+#include "scenes.h"
+#include "scheduler.h"
+#include "thread_pool.h"
+#include "wide_bvh.h"
+
+// Checks that tracing samples allocates nothing: every global operator new is counted, and
+// once the scene is built and a few samples have warmed up the thread's generator and
+// sampler, rendering more samples of cornell_box through ray_color must leave the count at 0.
+// Then the same for render_pass on a scheduler and buffer made up front, with packets and
+// with the wavefront integrator: a pass may allocate its tile buffers, but a pass of four
+// samples per pixel must allocate no more than a pass of one.
+
+static std::atomic<uint64_t> allocations(0);
+
+// The replacements are kept out of line. Inlined into a caller, GCC sees the std::free in
+// operator delete paired with the builtin operator new, or std::malloc paired with the
+// builtin delete, and warns with -Wmismatched-new-delete although each pair matches.
+#if defined(_MSC_VER)
+#define COUNTED_ALLOCATION __declspec(noinline)
+#else
+#define COUNTED_ALLOCATION __attribute__((noinline))
+#endif
+
+COUNTED_ALLOCATION void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+COUNTED_ALLOCATION void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+COUNTED_ALLOCATION void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+COUNTED_ALLOCATION void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    ++allocations;
+    const std::size_t a = static_cast<std::size_t>(alignment);
+#if defined(_MSC_VER)
+    if (void* p = _aligned_malloc(size ? size : 1, a))
+        return p;
+#else
+    if (void* p = std::aligned_alloc(a, (size + a - 1) / a * a))
+        return p;
+#endif
+    throw std::bad_alloc();
+}
+
+COUNTED_ALLOCATION void operator delete(void* p, std::align_val_t) noexcept
+{
+#if defined(_MSC_VER)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+COUNTED_ALLOCATION void operator delete(void* p, std::size_t, std::align_val_t alignment) noexcept
+{
+    operator delete(p, alignment);
+}
+
+int main()
+{
+    const int width = 64;
+    const int height = 48;
+    const int samples = 4;
+    const int depth = 10;
+
+    scene_description scene;
+    make_scene("cornell_box", scene);
+    shared_ptr<hittable> world = make_wide_bvh(bvh_node(scene.world, 0.f, 1.f));
+    Camera camera(scene.lookfrom, scene.lookat, scene.vup, scene.vfov, float(width) / float(height));
+
+    glm::vec3 sum(0.f, 0.f, 0.f);
+    auto render = [&](int first_sample, int last_sample)
+    {
+        for (int j = 0; j < height; ++j)
+        {
+            for (int i = 0; i < width; ++i)
+            {
+                const size_t pixel = i + static_cast<size_t>(j) * width;
+                for (int s = first_sample; s < last_sample; ++s)
+                {
+                    seed_sample_rng(0, pixel, s);
+                    thread_sampler().start_sample(sampler_type::random, 0, i, j, pixel, s, last_sample);
+                    const glm::vec2 jitter = sample_2d();
+                    const ray r = camera.GetRay((i + jitter.x) / (width - 1), (j + jitter.y) / (height - 1));
+                    sum += ray_color(r, scene.background, *world, scene.lights.get(), depth);
+                }
+            }
+        }
+    };
+
+    render(0, 1);
+    allocations = 0;
+    render(1, 1 + samples);
+    const uint64_t counted = allocations;
+
+    std::cout << width * height * samples << " samples of cornell_box, " << counted << " allocations, mean luminance "
+        << luminance(sum) / (width * height * (1 + samples)) << "\n";
+    int failures = 0;
+    if (counted != 0)
+    {
+        std::cerr << "Tracing samples allocated memory\n";
+        ++failures;
+    }
+
+    // render_pass: the packet path saves and restores every lane's generator and sampler
+    // around shading, so it runs with a sampler that has state of its own as well.
+    thread_pool pool(2);
+    struct variant
+    {
+        const char* name;
+        integrator_type integrator;
+        sampler_type sampler;
+    };
+    const variant variants[] = {
+        { "packets", integrator_type::path, sampler_type::random },
+        { "packets with the sobol sampler", integrator_type::path, sampler_type::sobol },
+        { "wavefront", integrator_type::wavefront, sampler_type::random },
+    };
+    for (const variant& v : variants)
+    {
+        render_settings settings;
+        settings.width = width;
+        settings.height = height;
+        settings.tile_size = width;
+        settings.samples_per_pixel = 1000;
+        settings.max_depth = depth;
+        settings.integrator = v.integrator;
+        settings.sampler = v.sampler;
+        tile_scheduler scheduler(width, height, settings.tile_size);
+        accumulation_buffer accum(width, height);
+
+        auto count_pass = [&](int sample_count)
+        {
+            allocations = 0;
+            render_pass(settings, *world, scene.lights.get(), camera, scene.background, pool, scheduler, accum, sample_count);
+            return static_cast<uint64_t>(allocations);
+        };
+        // The image is one tile, and the fewest allocations of a few passes are compared: with
+        // more tiles the pool's task deques allocate a block now and then, depending on which
+        // end workers take tiles from, and the first pass on a thread sizes its queues.
+        for (int warm_up = 0; warm_up < 3; ++warm_up)
+            count_pass(1);
+        uint64_t one = UINT64_MAX, four = UINT64_MAX;
+        for (int pass = 0; pass < 5; ++pass)
+        {
+            one = std::min(one, count_pass(1));
+            four = std::min(four, count_pass(samples));
+        }
+
+        std::cout << "render_pass with " << v.name << ": " << one << " allocations for 1 sample per pixel, " << four
+            << " for " << samples << "\n";
+        if (four > one)
+        {
+            std::cerr << "render_pass with " << v.name << " allocates per sample\n";
+            ++failures;
+        }
+    }
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,96 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "bvh.h"
+#include "material.h"
+#include "rng.h"
+#include "scenes.h"
+#include "thread_pool.h"
+#include "triangle_mesh.h"
+
+// Checks the promise of bvh_build_options::pool: a mesh large enough for the parallel build
+// gets the same tree on any number of threads as without a pool, node for node and with its
+// triangles in the same order, for every builder.
+
+template <class T>
+bool same_bytes(const std::vector<T>& a, const std::vector<T>& b)
+{
+    return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+int main()
+{
+    // A warped torus with half its vertices jittered, so the top of the tree is not symmetric
+    // and centroids are neither all distinct nor all on a grid. It has several times
+    // bvh_parallel_prims triangles, so the levels below the root are split in parallel too.
+    mesh_data source = torus_mesh(2.f, 0.6f, 512, 192);
+    pcg32 rng;
+    rng.seed(3, 17);
+    for (size_t i = 0; i < source.vertex_count(); ++i)
+    {
+        source.px[i] *= 1.f + 0.3f * std::sin(2.f * source.pz[i]);
+        if (rng.next_float() < 0.5f) continue;
+        source.px[i] += 0.002f * (rng.next_float() - 0.5f);
+        source.py[i] += 0.002f * (rng.next_float() - 0.5f);
+        source.pz[i] += 0.002f * (rng.next_float() - 0.5f);
+    }
+    if (source.triangle_count() < bvh_parallel_prims)
+    {
+        std::cerr << "Test mesh is too small for the parallel build\n";
+        return 1;
+    }
+
+    auto mat = make_shared<lambertian>(glm::vec3(0.5f, 0.5f, 0.5f));
+
+    struct variant
+    {
+        const char* name;
+        bvh_builder builder;
+        int treelet_rounds;
+    };
+    const variant variants[] = {
+        { "sah", bvh_builder::sah, 0 },
+        { "lbvh", bvh_builder::lbvh, 0 },
+        { "lbvh with treelets", bvh_builder::lbvh, 2 },
+    };
+
+    int failures = 0;
+    for (const variant& v : variants)
+    {
+        bvh_build_options options;
+        options.builder = v.builder;
+        options.treelet_rounds = v.treelet_rounds;
+        const triangle_mesh expected(source, mat, options);
+
+        for (unsigned int threads : { 1u, 2u, 4u })
+        {
+            thread_pool pool(threads);
+            options.pool = &pool;
+            const triangle_mesh mesh(source, mat, options);
+
+            const bool same_nodes = same_bytes(mesh.tree_nodes, expected.tree_nodes);
+            const bool same_order = same_bytes(mesh.mesh.position_indices, expected.mesh.position_indices)
+                && same_bytes(mesh.mesh.normal_indices, expected.mesh.normal_indices)
+                && same_bytes(mesh.mesh.uv_indices, expected.mesh.uv_indices);
+            const bool same_box = mesh.box.minimum == expected.box.minimum && mesh.box.maximum == expected.box.maximum;
+
+            std::cout << v.name << " on " << threads << " threads: " << mesh.tree_nodes.size() << " nodes, "
+                << (same_nodes && same_order && same_box ? "same" : "different") << "\n";
+            if (!same_nodes || !same_order || !same_box)
+            {
+                std::cerr << v.name << " on " << threads << " threads differs from the build without a pool:"
+                    << (same_nodes ? "" : " nodes") << (same_order ? "" : " triangle order") << (same_box ? "" : " bounds") << "\n";
+                ++failures;
+            }
+        }
+    }
+
+    return failures > 0 ? 1 : 0;
+}
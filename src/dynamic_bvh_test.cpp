@@ -0,0 +1,114 @@
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "dynamic_bvh.h"
+#include "instance.h"
+#include "rng.h"
+#include "scenes.h"
+#include "wide_bvh.h"
+
+// Checks that dynamic_bvh stays correct while the scene moves: after every update() of the
+// animated torus field, refitted or partly rebuilt, closest hits and occlusion
+// agree with a wide BVH built from scratch for the same frame.
+
+// Compares the two trees on rays from random points in bounds towards random objects of
+// world, returns the rays that differ and counts the rays that hit something in hits.
+uint64_t compare_trees(const hittable& tree, const hittable& expected, const hittable_list& world, const aabb& bounds,
+    pcg32& rng, int& hits)
+{
+    uint64_t differing = 0;
+    hits = 0;
+    for (int k = 0; k < 20000; ++k)
+    {
+        const glm::vec3 t(rng.next_float(), rng.next_float(), rng.next_float());
+        const glm::vec3 from = bounds.minimum + t * (bounds.maximum - bounds.minimum);
+        aabb target;
+        world.objects[rng.next_uint() % world.objects.size()]->bounding_box(0.f, 1.f, target);
+        const glm::vec3 s(rng.next_float(), rng.next_float(), rng.next_float());
+        const glm::vec3 d = target.minimum + s * (target.maximum - target.minimum) - from;
+        const float distance = glm::length(d);
+        if (!(distance > 0.f))
+            continue;
+        // Every other ray stops at the target point, so some end just short of a torus.
+        const ray r(from, d / distance, 0.f);
+        const float t_max = k % 2 ? distance : infinity;
+
+        hit_record rec, expected_rec;
+        const bool hit = tree.hit(r, 0.001f, t_max, rec);
+        const bool expected_hit = expected.hit(r, 0.001f, t_max, expected_rec);
+        hits += expected_hit;
+        if (hit != expected_hit || (hit && (rec.t != expected_rec.t || rec.object != expected_rec.object)))
+            ++differing;
+        if (tree.occluded(r, 0.001f, t_max) != expected.occluded(r, 0.001f, t_max))
+            ++differing;
+    }
+    return differing;
+}
+
+int main()
+{
+    scene_description scene;
+    if (!make_scene("torus_field", scene) || !scene.animate)
+    {
+        std::cerr << "torus_field is missing or not animated\n";
+        return 1;
+    }
+
+    // Ray origins around the tori. The ground sphere's box would put most of them hundreds of
+    // units away, where tori far apart round to the same hit distance.
+    aabb bounds = empty_box();
+    for (const shared_ptr<hittable>& object : scene.world.objects)
+    {
+        aabb box;
+        if (std::dynamic_pointer_cast<instance>(object) && object->bounding_box(0.f, 1.f, box))
+            bounds.expand(box);
+    }
+    bounds = aabb(bounds.minimum - glm::vec3(4.f, 0.f, 4.f), bounds.maximum + glm::vec3(4.f, 4.f, 4.f));
+
+    // One tree that only ever refits, however far the tori move, and one whose threshold is
+    // low enough that moving tori make some subtrees, but not the whole tree, worth rebuilding.
+    dynamic_bvh refitted(scene.world);
+    refitted.rebuild_threshold = infinity;
+    dynamic_bvh rebuilt(scene.world);
+    rebuilt.rebuild_threshold = 0.05f;
+    const size_t object_count = scene.world.objects.size();
+
+    pcg32 rng;
+    rng.seed(21, 5);
+    int partial_rebuilds = 0;
+    int failures = 0;
+    for (float time : { 0.001f, 0.25f, 0.5f, 1.f, 1.5f, 2.5f, 4.f })
+    {
+        scene.animate(time);
+        const size_t refitted_objects = refitted.update();
+        const size_t rebuilt_objects = rebuilt.update();
+        if (rebuilt_objects > 0 && rebuilt_objects < object_count)
+            ++partial_rebuilds;
+
+        const shared_ptr<hittable> expected = make_wide_bvh(bvh_node(scene.world, 0.f, 1.f));
+        int hits;
+        const uint64_t refitted_differing = compare_trees(refitted, *expected, scene.world, bounds, rng, hits);
+        const uint64_t rebuilt_differing = compare_trees(rebuilt, *expected, scene.world, bounds, rng, hits);
+        std::cout << "t = " << time << ": " << hits << " of 20000 rays hit, " << refitted_differing
+            << " differ after a refit and " << rebuilt_differing << " after rebuilding " << rebuilt_objects << " of "
+            << object_count << " objects\n";
+        if (refitted_objects != 0 || refitted_differing > 0 || rebuilt_differing > 0)
+            ++failures;
+    }
+
+    if (partial_rebuilds == 0)
+    {
+        std::cerr << "No frame rebuilt part of the tree\n";
+        ++failures;
+    }
+    if (failures > 0)
+    {
+        std::cerr << "dynamic_bvh does not match a fresh build\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "bvh.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "rng.h"
+#include "triangle_mesh.h"
+
+// Checks that the lbvh builder, with 30 and 63 bit Morton codes and with and without treelet
+// restructuring, finds the same closest hits as the SAH builder and as testing every triangle.
+// Runs both for the BVH inside a triangle mesh and for a scene BVH over one mesh per triangle.
+// A tight cluster of small triangles puts long runs of equal 30 bit codes into the sort.
+
+// The cluster is about half a cell of the 30 bit codes wide, 20 / 1024, so its centroids
+// share one or a few of those codes but spread over many cells of the 63 bit ones.
+const glm::vec3 cluster_corner(2.f, 2.f, 2.f);
+const float cluster_size = 0.01f;
+
+// Random triangles: most spread over a cube, a quarter packed into the cluster.
+mesh_data random_triangles(size_t count, pcg32& rng)
+{
+    mesh_data mesh;
+    auto random_vec = [&]() { return glm::vec3(rng.next_float(), rng.next_float(), rng.next_float()); };
+    for (size_t i = 0; i < count; ++i)
+    {
+        const bool clustered = i % 4 == 0;
+        const glm::vec3 center = clustered ? cluster_corner + cluster_size * random_vec() : 20.f * random_vec();
+        const float size = clustered ? 0.2f * cluster_size : 0.5f;
+        for (int k = 0; k < 3; ++k)
+        {
+            mesh.add_position(center + size * (random_vec() - glm::vec3(0.5f)));
+            mesh.position_indices.push_back(static_cast<uint32_t>(3 * i + k));
+        }
+    }
+    return mesh;
+}
+
+struct test_ray
+{
+    ray r;
+    float t_max;
+    bool hit; // what testing every triangle found
+    float t;
+};
+
+// Rays from around the cube through the cube or the cluster, some stopping halfway.
+std::vector<test_ray> random_rays(int count, const hittable& brute_force, pcg32& rng)
+{
+    auto random_vec = [&]() { return glm::vec3(rng.next_float(), rng.next_float(), rng.next_float()); };
+    std::vector<test_ray> rays;
+    for (int k = 0; k < count; ++k)
+    {
+        const glm::vec3 from = glm::vec3(-5.f) + 30.f * random_vec();
+        const glm::vec3 to = k % 2 ? cluster_corner + cluster_size * random_vec() : 20.f * random_vec();
+        if (from == to)
+            continue;
+        test_ray tr;
+        tr.r = ray(from, glm::normalize(to - from), 0.f);
+        tr.t_max = k % 3 == 0 ? 0.5f * glm::length(to - from) : infinity;
+        hit_record rec;
+        tr.hit = brute_force.hit(tr.r, 0.001f, tr.t_max, rec);
+        tr.t = tr.hit ? rec.t : 0.f;
+        rays.push_back(tr);
+    }
+    return rays;
+}
+
+// Returns the rays on which tree disagrees with testing every triangle. Only the distance
+// of a hit is compared: in the cluster two triangles can be hit at the same float distance,
+// and then either is right.
+int compare(const hittable& tree, const std::vector<test_ray>& rays)
+{
+    int differing = 0;
+    for (const test_ray& tr : rays)
+    {
+        hit_record rec;
+        const bool hit = tree.hit(tr.r, 0.001f, tr.t_max, rec);
+        if (hit != tr.hit || (hit && rec.t != tr.t) || tree.occluded(tr.r, 0.001f, tr.t_max) != tr.hit)
+            ++differing;
+    }
+    return differing;
+}
+
+int main()
+{
+    pcg32 rng;
+    rng.seed(13, 7);
+    const mesh_data triangles = random_triangles(8000, rng);
+
+    // The brute force reference: every triangle a mesh of its own, all tested in turn.
+    hittable_list list;
+    for (size_t i = 0; i < triangles.triangle_count(); ++i)
+    {
+        mesh_data one;
+        for (int k = 0; k < 3; ++k)
+        {
+            one.add_position(triangles.position(triangles.position_indices[3 * i + k]));
+            one.position_indices.push_back(k);
+        }
+        list.add(make_shared<triangle_mesh>(std::move(one), nullptr));
+    }
+    const std::vector<test_ray> rays = random_rays(4000, list, rng);
+    int hits = 0;
+    for (const test_ray& tr : rays)
+        hits += tr.hit;
+    std::cout << hits << " of " << rays.size() << " rays hit\n";
+
+    struct variant
+    {
+        const char* name;
+        bvh_builder builder;
+        int morton_bits;
+        int treelet_rounds;
+    };
+    const variant variants[] = {
+        { "sah", bvh_builder::sah, 30, 0 },
+        { "lbvh 30 bit", bvh_builder::lbvh, 30, 0 },
+        { "lbvh 63 bit", bvh_builder::lbvh, 63, 0 },
+        { "lbvh 30 bit with treelets", bvh_builder::lbvh, 30, 2 },
+        { "lbvh 63 bit with treelets", bvh_builder::lbvh, 63, 2 },
+    };
+
+    int failures = 0;
+    for (const variant& v : variants)
+    {
+        bvh_build_options options;
+        options.builder = v.builder;
+        options.morton_bits = v.morton_bits;
+        options.treelet_rounds = v.treelet_rounds;
+
+        const triangle_mesh mesh(triangles, nullptr, options);
+        const bvh_node scene(list, 0.f, 1.f, options);
+        const int mesh_differing = compare(mesh, rays);
+        const int scene_differing = compare(scene, rays);
+
+        std::cout << v.name << ": " << mesh_differing << " rays differ in the mesh BVH and " << scene_differing
+            << " in the scene BVH\n";
+        if (mesh_differing > 0 || scene_differing > 0)
+            ++failures;
+    }
+
+    if (failures > 0)
+    {
+        std::cerr << "BVH builds do not agree with testing every triangle\n";
+        return 1;
+    }
+    return 0;
+}
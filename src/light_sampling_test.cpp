@@ -0,0 +1,295 @@
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "alias_table.h"
+#include "environment.h"
+#include "light_set.h"
+#include "rng.h"
+#include "sampler.h"
+#include "scenes.h"
+
+// Checks that the light sampling probabilities agree with each other: the alias table picks
+// entries as often as pmf() says, every way light_set picks lights adds up to one and picks
+// them as often as pick_pmf() says, and the densities sample() reports are the ones pdf()
+// and pdf_value() compute for the same direction, as multiple importance sampling needs.
+// The same for an environment map: sample() lands in the texel its tables picked with the
+// density pdf() gives, that density integrates to one over the sphere, and a light set with
+// the map weighs it by environment_probability everywhere.
+
+int failures = 0;
+
+void check(bool ok, const std::string& what)
+{
+    if (!ok)
+    {
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+bool close(float a, float b, float tolerance)
+{
+    return std::abs(a - b) <= tolerance * std::max(std::abs(a), std::abs(b));
+}
+
+// Draws count picks and checks every frequency is within five standard deviations of pmfs.
+template <class pick_fn>
+void check_frequencies(const std::vector<float>& pmfs, int count, pick_fn&& pick, const std::string& what)
+{
+    std::vector<int> picks(pmfs.size(), 0);
+    for (int k = 0; k < count; ++k)
+        picks[pick()]++;
+
+    int outliers = 0;
+    for (size_t i = 0; i < pmfs.size(); ++i)
+    {
+        const double expected = double(pmfs[i]) * count;
+        const double sigma = std::sqrt(std::max(expected * (1.0 - pmfs[i]), 1.0));
+        if (std::abs(picks[i] - expected) > 5.0 * sigma)
+            ++outliers;
+    }
+    check(outliers == 0, what + ": pick frequencies match the pmf");
+}
+
+void check_alias_table()
+{
+    const std::vector<float> weights = { 0.f, 1.f, 2.f, 5.f, 0.5f, 3.f, 0.f, 8.5f };
+    alias_table table(weights);
+    float sum = 0.f;
+    for (float w : weights)
+        sum += w;
+    for (size_t i = 0; i < weights.size(); ++i)
+        check(close(table.pmf(static_cast<uint32_t>(i)), weights[i] / sum, 1e-6f), "alias table pmf is weight over total");
+
+    pcg32 rng;
+    rng.seed(7, 1);
+    bool consistent = true;
+    std::vector<float> pmfs(weights.size());
+    for (size_t i = 0; i < weights.size(); ++i)
+        pmfs[i] = table.pmf(static_cast<uint32_t>(i));
+    check_frequencies(pmfs, 1000000, [&]()
+    {
+        float pmf, remapped;
+        const uint32_t i = table.sample(rng.next_float(), pmf, remapped);
+        consistent = consistent && pmf == table.pmf(i) && remapped >= 0.f && remapped < 1.f;
+        return i;
+    }, "alias table");
+    check(consistent, "alias table samples report their pmf and a remapped number in [0, 1)");
+
+    alias_table zeros(std::vector<float>(4, 0.f));
+    check(zeros.pmf(2) == 0.25f, "alias table over zero weights picks uniformly");
+}
+
+void check_light_set(const std::string& scene_name)
+{
+    scene_description scene;
+    make_scene(scene_name, scene);
+    light_set& lights = *scene.lights;
+
+    pcg32 rng;
+    rng.seed(11, 3);
+    // Shading points around the lights; far from them the solid angle of a small sphere light
+    // rounds to nothing in floats and every density is infinite.
+    aabb bounds;
+    for (size_t i = 0; i < lights.lights.size(); ++i)
+    {
+        aabb box;
+        lights.lights[i].object->bounding_box(0.f, 1.f, box);
+        bounds = i == 0 ? box : surrounding_box(bounds, box);
+    }
+
+    for (int mode = 0; mode < 3; ++mode)
+    {
+        lights.sampling = static_cast<light_sampling>(mode);
+        const std::string what = scene_name + " " + light_sampling_names[mode];
+
+        for (int point = 0; point < 4; ++point)
+        {
+            const glm::vec3 t(rng.next_float(), rng.next_float(), rng.next_float());
+            const glm::vec3 p = bounds.minimum + t * (bounds.maximum - bounds.minimum);
+
+            std::vector<float> pmfs(lights.lights.size());
+            double total = 0.0;
+            for (size_t i = 0; i < pmfs.size(); ++i)
+            {
+                pmfs[i] = lights.pick_pmf(p, static_cast<uint32_t>(i));
+                total += pmfs[i];
+            }
+            check(std::abs(total - 1.0) < 1e-4, what + ": pick_pmf adds up to one");
+
+            bool consistent = true;
+            check_frequencies(pmfs, 200000, [&]()
+            {
+                float pmf;
+                const uint32_t i = lights.pick(p, rng.next_float(), pmf);
+                consistent = consistent && close(pmf, pmfs[i], 1e-4f);
+                return i;
+            }, what);
+            check(consistent, what + ": pick reports pick_pmf");
+
+            // Densities of sampled directions, also the one the integrator's MIS weights use.
+            int mismatches = 0;
+            for (int k = 0; k < 1000; ++k)
+            {
+                seed_sample_rng(point, k, mode);
+                thread_sampler().start_sample(sampler_type::random, 0, 0, 0, k, 0, 1);
+                light_sample ls;
+                if (!lights.sample(p, ls) || ls.light >= lights.lights.size())
+                    continue;
+                const hittable* object = lights.lights[ls.light].object.get();
+                if (!close(ls.pdf, lights.pdf(p, object, ls.direction), 1e-3f))
+                    ++mismatches;
+                // Lights behind the sampled one add their density along the same direction.
+                if (lights.pdf_value(p, ls.direction) < ls.pdf * (1.f - 1e-3f))
+                    ++mismatches;
+            }
+            check(mismatches == 0, what + ": sample() densities match pdf() and pdf_value()");
+        }
+    }
+}
+
+// A small map whose texels all differ: a gradient over rows and columns with one texel far
+// brighter than the rest, which most samples go to.
+shared_ptr<environment_light> synthetic_environment(int width, int height, int bright_i, int bright_j)
+{
+    std::vector<float> pixels;
+    for (int j = 0; j < height; ++j)
+    {
+        for (int i = 0; i < width; ++i)
+        {
+            const float value = i == bright_i && j == bright_j ? 500.f : 0.1f + 0.05f * i + 0.7f * j;
+            pixels.push_back(value);
+            pixels.push_back(0.5f * value);
+            pixels.push_back(0.25f * value);
+        }
+    }
+    return make_shared<environment_light>(width, height, std::move(pixels), 0.02f);
+}
+
+void check_environment()
+{
+    const int width = 16, height = 8;
+    const shared_ptr<environment_light> map = synthetic_environment(width, height, 11, 2);
+    const environment_light& env = *map;
+
+    pcg32 rng;
+    rng.seed(5, 9);
+    int pdf_mismatches = 0;
+    int texel_mismatches = 0;
+    int bright = 0;
+    int tested = 0;
+    for (int k = 0; k < 100000; ++k)
+    {
+        const glm::vec2 u(rng.next_float(), rng.next_float());
+        glm::vec3 direction;
+        float pdf;
+        if (!env.sample(u, direction, pdf))
+            continue;
+
+        // The texel sample() picked, found by sampling its tables the same way.
+        float pmf, row_offset, column_offset;
+        const uint32_t j = env.row_table.sample(u.y, pmf, row_offset);
+        const uint32_t i = env.column_tables[j].sample(u.x, pmf, column_offset);
+        // Right on a texel edge rounding may put the direction in the neighbour.
+        auto near_edge = [](float offset) { return offset < 1e-3f || offset > 1.f - 1e-3f; };
+        if (near_edge(row_offset) || near_edge(column_offset))
+            continue;
+        ++tested;
+        bright += i == 11 && j == 2;
+
+        if (!close(pdf, env.pdf(direction), 1e-3f))
+            ++pdf_mismatches;
+        const float* p = &env.pixels[3 * (static_cast<size_t>(j) * width + i)];
+        if (env.radiance(direction) != env.scale * glm::vec3(p[0], p[1], p[2]))
+            ++texel_mismatches;
+    }
+    check(tested > 90000 && bright > tested / 2, "environment: samples mostly go to the bright texel");
+    check(pdf_mismatches == 0, "environment: sample() densities match pdf()");
+    check(texel_mismatches == 0, "environment: sampled directions look up the texel that was sampled");
+
+    // Uniform directions over the sphere, one jittered in each cell of an equal area grid in
+    // z and phi so the bright texel gets its share: the mean of pdf() is 1 / (4 pi).
+    double integral = 0.0;
+    const int cells = 1000;
+    for (int a = 0; a < cells; ++a)
+    {
+        for (int b = 0; b < cells; ++b)
+        {
+            const float z = 1.f - 2.f * (a + rng.next_float()) / cells;
+            const float r = std::sqrt(std::max(0.f, 1.f - z * z));
+            const float phi = 2.f * pi * (b + rng.next_float()) / cells;
+            integral += env.pdf(glm::vec3(r * std::cos(phi), r * std::sin(phi), z));
+        }
+    }
+    integral *= 4.0 * pi / (double(cells) * cells);
+    std::cout << "environment pdf integrates to " << integral << "\n";
+    check(std::abs(integral - 1.0) < 2e-3, "environment: pdf() integrates to one over the sphere");
+
+    // Alone the map is the only light; with the Cornell box lights it is picked with
+    // environment_probability, and light samples give up the rest.
+    const glm::vec3 p(278.f, 278.f, 278.f);
+    const light_set alone(hittable_list(), map);
+    check(alone.environment_probability == 1.f, "environment alone: picked every time");
+
+    scene_description scene;
+    make_scene("cornell_box", scene);
+    const light_set lights(scene.world, map);
+    std::cout << "environment probability next to the Cornell box lights: " << lights.environment_probability << "\n";
+    check(lights.environment_probability > 0.f && lights.environment_probability < 1.f,
+        "environment with lights: picked with a probability between zero and one");
+
+    for (const light_set* set : { &alone, &lights })
+    {
+        const std::string what = set == &alone ? "environment alone" : "environment with lights";
+        int environment_samples = 0;
+        int mismatches = 0;
+        const int samples = 20000;
+        for (int k = 0; k < samples; ++k)
+        {
+            seed_sample_rng(0, k, 0);
+            thread_sampler().start_sample(sampler_type::random, 0, 0, 0, k, 0, 1);
+            light_sample ls;
+            if (!set->sample(p, ls))
+                continue;
+            if (ls.light == light_set::environment_index)
+            {
+                ++environment_samples;
+                if (!close(set->environment_pdf(ls.direction), set->environment_probability * env.pdf(ls.direction), 1e-6f)
+                    || !close(ls.pdf, set->environment_pdf(ls.direction), 1e-3f))
+                    ++mismatches;
+            }
+            else if (!close(ls.pdf, set->pdf(p, set->lights[ls.light].object.get(), ls.direction), 1e-3f))
+                ++mismatches;
+            // The environment and the lights both add their density along the direction.
+            if (set->pdf_value(p, ls.direction) < ls.pdf * (1.f - 1e-3f))
+                ++mismatches;
+        }
+        check(mismatches == 0, what + ": sample() densities match environment_pdf(), pdf() and pdf_value()");
+
+        const double expected = double(set->environment_probability) * samples;
+        const double sigma = std::sqrt(std::max(expected * (1.0 - set->environment_probability), 1.0));
+        check(std::abs(environment_samples - expected) <= 5.0 * sigma, what + ": picked as often as environment_probability");
+    }
+}
+
+int main()
+{
+    check_alias_table();
+    check_light_set("cornell_box");
+    check_light_set("many_lights");
+    check_environment();
+
+    if (failures > 0)
+    {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "Light sampling probabilities agree\n";
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "obj_loader.h"
+
+// Checks what load_obj makes of small OBJ files: polygons as fans, negative indices, corners
+// with only normals or only texture coordinates, faces that drop them for the whole mesh,
+// CRLF line ends, texture coordinates without v, lines cut by the end of a read chunk or
+// longer than one, and files with indices that have to be rejected.
+
+int failures = 0;
+
+void check(bool ok, const std::string& what)
+{
+    if (!ok)
+    {
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+// Loads text as an OBJ file into mesh, returns what load_obj does.
+bool load_text(const std::string& text, mesh_data& mesh)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "obj_loader_test.obj").string();
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file || std::fwrite(text.data(), 1, text.size(), file) != text.size())
+    {
+        std::cerr << "Could not write " << path << "\n";
+        if (file) std::fclose(file);
+        return false;
+    }
+    std::fclose(file);
+
+    const bool ok = load_obj(path, mesh);
+    std::remove(path.c_str());
+    return ok;
+}
+
+void check_fans()
+{
+    mesh_data mesh;
+    check(load_text("v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv 0.5 1.5 0\n"
+        "f 1 2 3 4\n"
+        "f 1 2 3 4 5\n", mesh), "fans: loads");
+    check(mesh.position_indices == std::vector<uint32_t>{ 0, 1, 2, 0, 2, 3, 0, 1, 2, 0, 2, 3, 0, 3, 4 },
+        "fans: a quad is two triangles and a pentagon three, all around the first corner");
+    check(mesh.normal_indices.empty() && mesh.uv_indices.empty(), "fans: no normals or texture coordinates");
+}
+
+void check_negative_indices()
+{
+    mesh_data mesh;
+    check(load_text("v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0 0\nvt 1 0\nvt 0 1\nvn 0 0 1\n"
+        "f -3/-3/-1 -2/-2/-1 -1/-1/-1\n"
+        "v 1 1 0\nvn 0 0 -1\n"
+        "f -1/1/-1 -2/2/-1 -3/3/-2\n", mesh), "negative indices: load");
+    check(mesh.position_indices == std::vector<uint32_t>{ 0, 1, 2, 3, 2, 1 }, "negative indices: count back from the latest vertex");
+    check(mesh.uv_indices == std::vector<uint32_t>{ 0, 1, 2, 0, 1, 2 }, "negative indices: texture coordinates");
+    check(mesh.normal_indices == std::vector<uint32_t>{ 0, 0, 0, 1, 1, 0 }, "negative indices: normals");
+}
+
+void check_partial_corners()
+{
+    mesh_data normals_only;
+    check(load_text("v 0 0 0\nv 1 0 0\nv 0 1 0\nvn 0 0 1\nvn 0 1 0\nf 1//2 2//1 3//2\n", normals_only), "v//vn: loads");
+    check(normals_only.position_indices == std::vector<uint32_t>{ 0, 1, 2 }, "v//vn: positions");
+    check(normals_only.normal_indices == std::vector<uint32_t>{ 1, 0, 1 }, "v//vn: normals");
+    check(normals_only.uv_indices.empty(), "v//vn: no texture coordinates");
+
+    mesh_data uvs_only;
+    check(load_text("v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0 0\nvt 1 0\nf 1/2 2/1 3/2\n", uvs_only), "v/vt: loads");
+    check(uvs_only.uv_indices == std::vector<uint32_t>{ 1, 0, 1 }, "v/vt: texture coordinates");
+    check(uvs_only.normal_indices.empty(), "v/vt: no normals");
+
+    // The second face has no normals, so the first one loses its normals too.
+    mesh_data dropped;
+    check(load_text("v 0 0 0\nv 1 0 0\nv 0 1 0\nv 1 1 0\nvt 0 0\nvn 0 0 1\n"
+        "f 1/1/1 2/1/1 3/1/1\n"
+        "f 2/1 4/1 3/1\n"
+        "f 1/1/1 2/1/1 4/1/1\n", dropped), "missing normals: loads");
+    check(dropped.position_indices == std::vector<uint32_t>{ 0, 1, 2, 1, 3, 2, 0, 1, 3 }, "missing normals: every face is kept");
+    check(dropped.normal_indices.empty(), "missing normals: normals are dropped for the whole mesh");
+    check(dropped.uv_indices.size() == 9, "missing normals: texture coordinates are kept");
+}
+
+void check_line_formats()
+{
+    mesh_data mesh;
+    check(load_text("# CRLF line ends\r\nv 1.5 -2 3e-1\r\nv 0 0 0\r\nv 0 1 0\r\nvt 0.25\r\nvt 0.5 0.75\r\n"
+        "vn 0 0 1\r\nf 1/1/1 2/2/1 3/1/1\r\n", mesh), "CRLF: loads");
+    check(mesh.vertex_count() == 3 && mesh.px[0] == 1.5f && mesh.py[0] == -2.f && mesh.pz[0] == 0.3f,
+        "CRLF: positions parse up to the carriage return");
+    check(mesh.tu.size() == 2 && mesh.tu[0] == 0.25f && mesh.tv[0] == 0.f, "vt with only u: v is zero");
+    check(mesh.tv.size() == 2 && mesh.tv[1] == 0.75f, "vt with u and v");
+    check(mesh.position_indices == std::vector<uint32_t>{ 0, 1, 2 } && mesh.normal_indices == std::vector<uint32_t>{ 0, 0, 0 },
+        "CRLF: the face keeps its normals");
+}
+
+// load_obj reads 4 MB at a time. A vertex line is placed across the end of the first chunk,
+// and a comment longer than a whole chunk follows, which makes the reader grow its buffer.
+void check_chunk_boundary()
+{
+    const size_t chunk_size = 1 << 22;
+    std::string text = "v 0 0 0\nv 1 0 0\n";
+    const std::string comment = "# padding to move the next line across the end of the first read\n";
+    const std::string straddling = "v 0.125 0.5 -0.75\n";
+    while (text.size() + comment.size() < chunk_size - straddling.size() / 2)
+        text += comment;
+    text.append(chunk_size - straddling.size() / 2 - text.size() - 1, ' ');
+    text += "\n";
+    const size_t straddle_start = text.size();
+    text += straddling;
+    text += "#" + std::string(chunk_size + chunk_size / 2, 'x') + "\n";
+    text += "v 2 3 4\nf 1 2 3\nf 2 3 4\n";
+
+    mesh_data mesh;
+    check(straddle_start < chunk_size && straddle_start + straddling.size() > chunk_size, "chunk boundary: the line straddles it");
+    check(load_text(text, mesh), "chunk boundary: loads");
+    check(mesh.vertex_count() == 4 && mesh.px[2] == 0.125f && mesh.py[2] == 0.5f && mesh.pz[2] == -0.75f,
+        "chunk boundary: the vertex across it is read whole");
+    check(mesh.vertex_count() == 4 && mesh.px[3] == 2.f && mesh.py[3] == 3.f && mesh.pz[3] == 4.f,
+        "chunk boundary: the vertex after a line longer than a chunk");
+    check(mesh.position_indices == std::vector<uint32_t>{ 0, 1, 2, 1, 2, 3 }, "chunk boundary: faces");
+}
+
+void check_bad_indices()
+{
+    const std::string vertices = "v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0 0\nvn 0 0 1\n";
+    const struct
+    {
+        const char* face;
+        const char* what;
+    } bad[] = {
+        { "f 0 1 2\n", "vertex index 0" },
+        { "f 1 2 4\n", "vertex index past the last vertex" },
+        { "f -4 1 2\n", "negative vertex index before the first vertex" },
+        { "f 1/2 2/1 3/1\n", "texture coordinate index past the last one" },
+        { "f 1//0 2//1 3//1\n", "normal index 0" },
+        { "f 1//1 2//1 3//2\n", "normal index past the last normal" },
+        { "f 1 2\n", "face with two corners" },
+    };
+    std::cerr << "Expecting " << sizeof(bad) / sizeof(bad[0]) << " OBJ errors:\n";
+    for (const auto& b : bad)
+    {
+        mesh_data mesh;
+        check(!load_text(vertices + b.face, mesh), std::string("rejects ") + b.what);
+    }
+}
+
+int main()
+{
+    check_fans();
+    check_negative_indices();
+    check_partial_corners();
+    check_line_formats();
+    check_chunk_boundary();
+    check_bad_indices();
+
+    if (failures > 0)
+    {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "OBJ files load as expected\n";
+    return 0;
+}
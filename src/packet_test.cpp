@@ -0,0 +1,144 @@
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "camera.h"
+#include "rng.h"
+#include "scenes.h"
+#include "wide_bvh.h"
+
+// Checks that packet traversal finds what single rays find: hit_packet the same closest hit
+// for every lane and occluded_packet the same lanes blocked, for camera ray packets and for
+// shadow ray packets from their hits, both towards one small region and towards anywhere.
+// Runs every wide BVH at every SIMD level the CPU has.
+
+// Compares one tree's packet queries with its single ray ones, returns the lanes that differ.
+uint64_t check_tree(const hittable& tree, const scene_description& scene, const aabb& bounds)
+{
+    const int width = 64;
+    const int height = 48;
+    Camera camera(scene.lookfrom, scene.lookat, scene.vup, scene.vfov, float(width) / float(height));
+    pcg32 rng;
+    rng.seed(5, 9);
+    auto random_point = [&]()
+    {
+        const glm::vec3 t(rng.next_float(), rng.next_float(), rng.next_float());
+        return bounds.minimum + t * (bounds.maximum - bounds.minimum);
+    };
+
+    uint64_t differing = 0;
+    auto compare = [&](const ray_packet& packet)
+    {
+        hit_record packet_recs[ray_packet_size];
+        const uint32_t hits = tree.hit_packet(packet, 0.001f, packet_recs);
+        const uint32_t blocked = tree.occluded_packet(packet, 0.001f);
+        for (int lane = 0; lane < ray_packet_size; ++lane)
+        {
+            const uint32_t bit = 1u << lane;
+            if (!(packet.active & bit))
+            {
+                if ((hits | blocked) & bit)
+                    ++differing;
+                continue;
+            }
+
+            hit_record rec;
+            const bool hit = tree.hit(packet.rays[lane], 0.001f, packet.t_max[lane], rec);
+            const bool occluded = tree.occluded(packet.rays[lane], 0.001f, packet.t_max[lane]);
+            if (hit != ((hits & bit) != 0) || occluded != ((blocked & bit) != 0)
+                || (hit && (rec.t != packet_recs[lane].t || rec.object != packet_recs[lane].object)))
+                ++differing;
+        }
+    };
+
+    for (int y = 0; y < height; y += 2)
+    {
+        for (int x = 0; x < width; x += 4)
+        {
+            // Camera rays, some lanes off and some cut short.
+            ray_packet packet;
+            packet.active = rng.next_uint() | 0x81u;
+            packet.active &= 0xffu;
+            for (int lane = 0; lane < ray_packet_size; ++lane)
+            {
+                const float u = (x + lane % 4 + rng.next_float()) / (width - 1);
+                const float v = (y + lane / 4 + rng.next_float()) / (height - 1);
+                packet.rays[lane] = camera.GetRay(u, v);
+                packet.t_max[lane] = rng.next_float() < 0.25f ? 5.f + 50.f * rng.next_float() : infinity;
+            }
+            compare(packet);
+
+            // Shadow rays from where the camera rays hit, to a small region and to anywhere.
+            ray_packet coherent;
+            ray_packet scattered;
+            coherent.active = scattered.active = 0;
+            const glm::vec3 light = random_point();
+            const glm::vec3 light_size = 0.02f * (bounds.maximum - bounds.minimum);
+            for (int lane = 0; lane < ray_packet_size; ++lane)
+            {
+                hit_record rec;
+                if (!tree.hit(packet.rays[lane], 0.001f, infinity, rec))
+                    continue;
+                const glm::vec3 p = packet.rays[lane].at(rec.t);
+                const glm::vec3 targets[2] = {
+                    light + light_size * glm::vec3(rng.next_float(), rng.next_float(), rng.next_float()),
+                    random_point() };
+                ray_packet* packets[2] = { &coherent, &scattered };
+                for (int k = 0; k < 2; ++k)
+                {
+                    const glm::vec3 d = targets[k] - p;
+                    const float distance = glm::length(d);
+                    if (!(distance > 0.f))
+                        continue;
+                    packets[k]->rays[lane] = ray(p, d / distance, 0.f);
+                    packets[k]->t_max[lane] = distance * 0.999f;
+                    packets[k]->active |= 1u << lane;
+                }
+            }
+            compare(coherent);
+            compare(scattered);
+        }
+    }
+    return differing;
+}
+
+int main()
+{
+    const simd_level available = detect_simd_level();
+    int failures = 0;
+    for (const char* scene_name : { "cornell_box", "torus_field", "many_lights" })
+    {
+        scene_description scene;
+        if (!make_scene(scene_name, scene))
+        {
+            std::cerr << "Unknown scene " << scene_name << "\n";
+            return 1;
+        }
+        const bvh_node root(scene.world, 0.f, 1.f);
+        aabb bounds;
+        scene.world.bounding_box(0.f, 1.f, bounds);
+
+        for (int level = 0; level <= static_cast<int>(available); ++level)
+        {
+            const simd_level requested = static_cast<simd_level>(level);
+            bvh4 tree4(root, requested);
+            bvh8 tree8(root, requested);
+            const uint64_t differing4 = check_tree(tree4, scene, bounds);
+            const uint64_t differing8 = check_tree(tree8, scene, bounds);
+            std::cout << scene_name << ", " << simd_level_name(requested) << ": " << differing4 << " BVH4 and "
+                << differing8 << " BVH8 lanes differ\n";
+            if (differing4 > 0 || differing8 > 0)
+                ++failures;
+        }
+    }
+
+    if (failures > 0)
+    {
+        std::cerr << "Packet traversal does not match single rays\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,506 @@
+﻿#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "camera.h"
+#include "dynamic_bvh.h"
+#include "image_io.h"
+#include "renderer.h"
+#include "scenes.h"
+#include "thread_pool.h"
+#include "wide_bvh.h"
+
+// Offline renderer for machines without a display: renders a named scene to an image file.
+
+void print_usage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [options]\n"
+        << "  --scene NAME        scene to render (default cornell_box)\n"
+        << "  --obj FILE          render the mesh in a Wavefront OBJ file inside the Cornell box\n"
+        << "  --scene-cache FILE  render the meshes of a scene_convert cache inside the Cornell box\n"
+        << "  --output FILE       .png, .jpg, .bmp or .ppm (default render.png)\n"
+        << "  --width N           image width in pixels (default 800)\n"
+        << "  --height N          image height in pixels (default 600)\n"
+        << "  --spp N             samples per pixel (default 10)\n"
+        << "  --max-depth N       hits per path at most (default 10)\n"
+        << "  --roulette-depth N  bounces before Russian roulette (default " << default_roulette_depth << ")\n"
+        << "  --threads N         worker threads, 0 for one per core (default 0)\n"
+        << "  --bvh NAME          BVH builder, sah for the best trees or lbvh for the fastest\n"
+        << "                      builds (default sah)\n"
+        << "  --treelet-rounds N  restructure the BVH's treelets N times after building it,\n"
+        << "                      improves lbvh trees (default 0)\n"
+        << "  --environment FILE  light the scene with an equirectangular HDR map instead of its\n"
+        << "                      background\n"
+        << "  --environment-scale S\n"
+        << "                      multiplies the environment map (default 1)\n"
+        << "  --light-sampler NAME\n"
+        << "                      how diffuse bounces pick a light: uniform, power or bvh\n"
+        << "                      (default bvh)\n"
+        << "  --integrator NAME   path, or wavefront to shade queues of paths sorted by material\n"
+        << "                      (default path)\n"
+        << "  --queue-kb N        path state per wavefront queue in KB, best kept within the L2\n"
+        << "                      cache (default " << default_wavefront_queue_bytes / 1024 << ")\n"
+        << "  --no-ray-sort       trace wavefront bounce rays in queue order instead of sorted\n"
+        << "                      by origin and direction\n";
+#if defined(RAYTRACE_NODE_CACHE_MODEL)
+    std::cerr << "  --node-cache-kb N   count BVH node reads against a simulated N KB cache per thread\n"
+        << "                      and print the hit rate (default off)\n";
+#endif
+    std::cerr << "  --seed N            sample seed (default 0)\n"
+        << "  --tile-size N       tile edge in pixels (default 32)\n"
+        << "  --sampler NAME      random, stratified, sobol or blue_noise (default random)\n"
+        << "  --time-budget S     stop after the last pass that fits in S seconds (default none)\n"
+        << "  --pass-spp N        samples per pixel added by each pass (default 1)\n"
+        << "  --progressive       rewrite the output after every pass\n"
+        << "  --adaptive E        stop sampling pixels once their relative error is below E,\n"
+        << "                      spending --spp on average (default off)\n"
+        << "  --min-spp N         samples before a pixel may stop with --adaptive (default 8)\n"
+        << "  --max-spp N         samples per pixel at most with --adaptive (default 4 x spp)\n"
+        << "  --heatmap FILE      also write the samples each pixel received as an image\n"
+        << "  --frames N          render N frames of an animated scene (torus_field), numbering\n"
+        << "                      the output files\n"
+        << "  --fps F             frames per second of scene time with --frames (default 24)\n"
+        << "  --benchmark-samplers\n"
+        << "                      print the RMSE of every sampler at 1, 2, 4 ... up to --spp\n"
+        << "  --reference-spp N   samples per pixel of the benchmark reference (default 1024)\n"
+        << "  --list-scenes       print the scene names and exit\n";
+}
+
+// Parses a non-negative real number argument, reporting the option on failure.
+bool parse_number(const char* option, const char* text, double& value)
+{
+    char* end = nullptr;
+    const double parsed = std::strtod(text, &end);
+    if (*text == '\0' || *end != '\0' || !(parsed >= 0.0))
+    {
+        std::cerr << "Invalid value '" << text << "' for " << option << "\n";
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+// Parses a non-negative integer argument, reporting the option on failure.
+bool parse_count(const char* option, const char* text, uint64_t& value)
+{
+    char* end = nullptr;
+    const unsigned long long parsed = std::strtoull(text, &end, 10);
+    if (*text == '\0' || *text == '-' || *end != '\0')
+    {
+        std::cerr << "Invalid value '" << text << "' for " << option << "\n";
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+// Root mean square error of the linear radiance of image against reference. Pixels with a
+// NaN sample in either are left out.
+double image_rmse(const accumulation_buffer& image, const accumulation_buffer& reference)
+{
+    double error = 0.0;
+    size_t count = 0;
+    for (size_t i = 0; i < image.pixel_count(); ++i)
+    {
+        const glm::vec3 a = image.sum[i] / float(std::max(1, image.samples[i]));
+        const glm::vec3 b = reference.sum[i] / float(std::max(1, reference.samples[i]));
+        const glm::vec3 d = a - b;
+        const double e = double(d.x) * d.x + double(d.y) * d.y + double(d.z) * d.z;
+        if (e != e) continue;
+
+        error += e / 3.0;
+        ++count;
+    }
+    return count ? sqrt(error / count) : 0.0;
+}
+
+// Renders a reference with the random sampler, then renders the scene with every sampler at
+// 1, 2, 4 ... up to settings.samples_per_pixel and prints the error against the reference.
+void benchmark_samplers(render_settings settings, const hittable& world, const light_set* lights,
+    const Camera& camera, const glm::vec3& background, thread_pool& pool, int reference_spp)
+{
+    settings.adaptive = false;
+    tile_scheduler scheduler(settings.width, settings.height, settings.tile_size);
+
+    // Another seed, so the random sampler doesn't share its first samples with the reference.
+    render_settings reference_settings = settings;
+    reference_settings.sampler = sampler_type::random;
+    reference_settings.samples_per_pixel = reference_spp;
+    reference_settings.seed = settings.seed + 1;
+
+    accumulation_buffer reference(settings.width, settings.height);
+    render_pass(reference_settings, world, lights, camera, background, pool, scheduler, reference, reference_spp);
+    std::cout << "Reference: " << reference_spp << " spp in " << scheduler.get_total_ms() << " ms\n";
+
+    std::cout << "spp";
+    for (const char* name : sampler_names)
+        std::cout << "\t" << name;
+    std::cout << "\n";
+
+    for (int spp = 1; spp <= settings.samples_per_pixel; spp *= 2)
+    {
+        std::cout << spp;
+        for (int type = 0; type < 4; ++type)
+        {
+            // A fresh render for every count, as the stratified sampler needs to know it.
+            render_settings sampler_settings = settings;
+            sampler_settings.sampler = static_cast<sampler_type>(type);
+            sampler_settings.samples_per_pixel = spp;
+
+            accumulation_buffer image(settings.width, settings.height);
+            render_pass(sampler_settings, world, lights, camera, background, pool, scheduler, image, spp);
+            std::cout << "\t" << image_rmse(image, reference);
+        }
+        std::cout << std::endl;
+    }
+}
+
+// Output file of one animation frame, render.png becomes render_0007.png.
+std::string frame_path(const std::string& path, int frame)
+{
+    char number[16];
+    std::snprintf(number, sizeof(number), "_%04d", frame);
+    const size_t dot = path.find_last_of('.');
+    return path.substr(0, dot) + number + path.substr(dot);
+}
+
+// Renders the frames of an animated scene, bringing the scene BVH up to date before each.
+bool render_frames(const render_settings& settings, const scene_description& scene, dynamic_bvh& world,
+    const Camera& camera, thread_pool& pool, int frames, double fps, const std::string& output)
+{
+    std::vector<unsigned char> rgb(static_cast<size_t>(settings.width) * settings.height * 3);
+
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        scene.animate(static_cast<float>(frame / fps));
+        const auto update_start = std::chrono::steady_clock::now();
+        const size_t rebuilt = world.update();
+        const double update_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - update_start).count();
+
+        progressive_render progress(settings, world, scene.lights.get(), camera, scene.background, pool);
+        while (progress.step())
+            ;
+
+        const std::string path = frame_path(output, frame);
+        progress.get_buffer().resolve(rgb.data());
+        if (!write_image(path, settings.width, settings.height, rgb.data()))
+            return false;
+
+        std::cout << "frame " << frame << ": ";
+        if (rebuilt > 0)
+            std::cout << "rebuilt " << rebuilt << " objects";
+        else
+            std::cout << "refit";
+        std::cout << " in " << update_ms << " ms, " << progress.get_buffer().average_samples() << " spp in "
+            << progress.get_elapsed_ms() << " ms, wrote " << path << "\n";
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    render_settings settings;
+    std::string scene_name = "cornell_box";
+    std::string obj_path;
+    std::string cache_path;
+    std::string output = "render.png";
+    std::string heatmap;
+    std::string environment_path;
+    double environment_scale = 1.0;
+    int thread_count = 0;
+    bool write_every_pass = false;
+    bool run_benchmark = false;
+    int reference_spp = 1024;
+    int frames = 0;
+    double fps = 24.0;
+    bvh_build_options build_options;
+    light_sampling light_sampler = light_sampling::bvh;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+
+        if (arg == "--help" || arg == "-h")
+        {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (arg == "--progressive")
+        {
+            write_every_pass = true;
+            continue;
+        }
+        if (arg == "--no-ray-sort")
+        {
+            settings.sort_rays = false;
+            continue;
+        }
+        if (arg == "--benchmark-samplers")
+        {
+            run_benchmark = true;
+            continue;
+        }
+        if (arg == "--list-scenes")
+        {
+            for (const char* name : scene_names)
+                std::cout << name << "\n";
+            return 0;
+        }
+
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << arg << "\n";
+            print_usage(argv[0]);
+            return 1;
+        }
+        const char* value = argv[++i];
+
+        uint64_t number = 0;
+        if (arg == "--scene")
+            scene_name = value;
+        else if (arg == "--obj")
+            obj_path = value;
+        else if (arg == "--scene-cache")
+            cache_path = value;
+        else if (arg == "--output" || arg == "-o")
+            output = value;
+        else if (arg == "--sampler")
+        {
+            if (!parse_sampler_type(value, settings.sampler))
+            {
+                std::cerr << "Unknown sampler " << value << ", use random, stratified, sobol or blue_noise\n";
+                return 1;
+            }
+        }
+        else if (arg == "--bvh")
+        {
+            if (!parse_bvh_builder(value, build_options.builder))
+            {
+                std::cerr << "Unknown BVH builder " << value << ", use sah or lbvh\n";
+                return 1;
+            }
+        }
+        else if (arg == "--integrator")
+        {
+            if (!parse_integrator_type(value, settings.integrator))
+            {
+                std::cerr << "Unknown integrator " << value << ", use path or wavefront\n";
+                return 1;
+            }
+        }
+        else if (arg == "--light-sampler")
+        {
+            if (!parse_light_sampling(value, light_sampler))
+            {
+                std::cerr << "Unknown light sampler " << value << ", use uniform, power or bvh\n";
+                return 1;
+            }
+        }
+        else if (arg == "--heatmap")
+            heatmap = value;
+        else if (arg == "--environment")
+            environment_path = value;
+        else if (arg == "--environment-scale")
+        {
+            if (!parse_number(arg.c_str(), value, environment_scale)) return 1;
+        }
+        else if (arg == "--adaptive")
+        {
+            double threshold = 0.0;
+            if (!parse_number(arg.c_str(), value, threshold)) return 1;
+            settings.adaptive = true;
+            settings.adaptive_threshold = static_cast<float>(threshold);
+        }
+        else if (arg == "--fps")
+        {
+            if (!parse_number(arg.c_str(), value, fps)) return 1;
+        }
+        else if (arg == "--time-budget")
+        {
+            double seconds = 0.0;
+            if (!parse_number(arg.c_str(), value, seconds)) return 1;
+            settings.time_budget_ms = seconds * 1000.0;
+        }
+#if defined(RAYTRACE_NODE_CACHE_MODEL)
+        else if (arg == "--node-cache-kb")
+        {
+            if (!parse_count(arg.c_str(), value, number)) return 1;
+            enable_node_cache_model(static_cast<size_t>(number) * 1024);
+        }
+#endif
+        else if (arg == "--seed")
+        {
+            if (!parse_count(arg.c_str(), value, settings.seed)) return 1;
+        }
+        else if (arg == "--width" || arg == "--height" || arg == "--spp" || arg == "--max-depth"
+            || arg == "--roulette-depth" || arg == "--tile-size" || arg == "--threads" || arg == "--pass-spp"
+            || arg == "--min-spp" || arg == "--max-spp" || arg == "--reference-spp" || arg == "--frames"
+            || arg == "--treelet-rounds" || arg == "--queue-kb")
+        {
+            if (!parse_count(arg.c_str(), value, number)) return 1;
+            if (number > 1u << 20)
+            {
+                std::cerr << "Value for " << arg << " is too large\n";
+                return 1;
+            }
+
+            const int n = static_cast<int>(number);
+            if (arg == "--width") settings.width = n;
+            else if (arg == "--height") settings.height = n;
+            else if (arg == "--spp") settings.samples_per_pixel = n;
+            else if (arg == "--max-depth") settings.max_depth = n;
+            else if (arg == "--roulette-depth") settings.roulette_depth = n;
+            else if (arg == "--tile-size") settings.tile_size = n;
+            else if (arg == "--pass-spp") settings.samples_per_pass = n;
+            else if (arg == "--min-spp") settings.adaptive_min_samples = n;
+            else if (arg == "--max-spp") settings.adaptive_max_samples = n;
+            else if (arg == "--reference-spp") reference_spp = n;
+            else if (arg == "--frames") frames = n;
+            else if (arg == "--treelet-rounds") build_options.treelet_rounds = n;
+            else if (arg == "--queue-kb") settings.wavefront_queue_bytes = static_cast<size_t>(n) * 1024;
+            else thread_count = n;
+        }
+        else
+        {
+            std::cerr << "Unknown option " << arg << "\n";
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (settings.width < 2 || settings.height < 2 || settings.samples_per_pixel < 1 || settings.tile_size < 1
+        || settings.samples_per_pass < 1 || reference_spp < 1 || !(fps > 0.0))
+    {
+        std::cerr << "Width and height must be at least 2, spp, pass spp, reference spp and tile size at least 1, fps above 0\n";
+        return 1;
+    }
+
+    // Started before loading, large BVHs are built on it too.
+    thread_pool pool(static_cast<unsigned int>(thread_count));
+    build_options.pool = &pool;
+
+    const auto load_start = std::chrono::steady_clock::now();
+    scene_description scene;
+    if (!cache_path.empty())
+    {
+        if (!make_cached_scene(cache_path, scene))
+            return 1;
+        scene_name = cache_path;
+    }
+    else if (!obj_path.empty())
+    {
+        if (!make_mesh_scene(obj_path, scene, build_options))
+            return 1;
+        scene_name = obj_path;
+    }
+    else if (!make_scene(scene_name, scene))
+    {
+        std::cerr << "Unknown scene " << scene_name << ", --list-scenes prints the available ones\n";
+        return 1;
+    }
+
+    if (!environment_path.empty())
+    {
+        shared_ptr<environment_light> environment;
+        if (!load_environment(environment_path, static_cast<float>(environment_scale), environment))
+            return 1;
+        scene.lights = make_light_set(scene.world, environment);
+    }
+    if (scene.lights)
+        scene.lights->sampling = light_sampler;
+
+    if (frames > 0 && !scene.animate)
+    {
+        std::cerr << "Scene " << scene_name << " is not animated\n";
+        return 1;
+    }
+
+    for (const std::string& path : { output, heatmap })
+    {
+        if (!path.empty() && !image_format_supported(path))
+        {
+            std::cerr << "Unknown image format for " << path << ", use .png, .jpg, .bmp or .ppm\n";
+            return 1;
+        }
+    }
+
+    // Animated scenes move their objects every frame, their BVH is refitted instead of rebuilt.
+    shared_ptr<dynamic_bvh> animated_bvh;
+    shared_ptr<hittable> world_bvh;
+    if (frames > 0)
+        world_bvh = animated_bvh = make_shared<dynamic_bvh>(scene.world, build_options);
+    else
+        world_bvh = make_wide_bvh(bvh_node(scene.world, 0.f, 1.f, build_options), detect_simd_level());
+    const double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count();
+
+    const float aspect_ratio = float(settings.width) / float(settings.height);
+    Camera camera(scene.lookfrom, scene.lookat, scene.vup, scene.vfov, aspect_ratio);
+
+    std::vector<unsigned char> rgb(static_cast<size_t>(settings.width) * settings.height * 3);
+
+    if (run_benchmark)
+    {
+        std::cout << "Benchmarking samplers on " << scene_name << " at " << settings.width << "x" << settings.height
+            << " on " << pool.size() << " threads\n";
+        benchmark_samplers(settings, *world_bvh, scene.lights.get(), camera, scene.background, pool, reference_spp);
+        return 0;
+    }
+
+    if (animated_bvh)
+    {
+        std::cout << "Rendering " << frames << " frames of " << scene_name << " at " << settings.width << "x" << settings.height
+            << ", " << settings.samples_per_pixel << " spp on " << pool.size() << " threads, scene ready in " << load_ms << " ms\n";
+        return render_frames(settings, scene, *animated_bvh, camera, pool, frames, fps, output) ? 0 : 1;
+    }
+
+    progressive_render progress(settings, *world_bvh, scene.lights.get(), camera, scene.background, pool);
+
+    std::cout << "Rendering " << scene_name << " at " << settings.width << "x" << settings.height
+        << ", " << settings.samples_per_pixel << " spp on " << pool.size() << " threads, scene ready in " << load_ms << " ms\n";
+
+    while (progress.step())
+    {
+        std::cout << "pass " << progress.get_pass_count() << ": " << progress.get_buffer().average_samples() << " spp, "
+            << progress.get_active_pixels() << " pixels, " << progress.get_scheduler().get_total_ms() << " ms\n";
+
+        if (write_every_pass && !progress.finished())
+        {
+            progress.get_buffer().resolve(rgb.data());
+            if (!write_image(output, settings.width, settings.height, rgb.data()))
+                return 1;
+        }
+    }
+
+    std::cout << progress.get_buffer().average_samples() << " spp in " << progress.get_elapsed_ms() << " ms, last pass:\n";
+    progress.get_scheduler().print_timings(std::cout);
+
+    uint64_t node_fetches, node_misses;
+    node_cache_totals(node_fetches, node_misses);
+    if (node_fetches > 0)
+    {
+        std::cout << "BVH node reads: " << node_fetches << " cache lines, "
+            << 100.0 * (node_fetches - node_misses) / node_fetches << "% hit in a " << node_cache_model_bytes() / 1024
+            << " KB cache per thread\n";
+    }
+
+    progress.get_buffer().resolve(rgb.data());
+    if (!write_image(output, settings.width, settings.height, rgb.data()))
+        return 1;
+
+    std::cout << "Wrote " << output << "\n";
+
+    if (!heatmap.empty())
+    {
+        progress.get_buffer().resolve_sample_heatmap(rgb.data());
+        if (!write_image(heatmap, settings.width, settings.height, rgb.data()))
+            return 1;
+        std::cout << "Wrote " << heatmap << ", red is " << progress.get_buffer().max_samples << " spp\n";
+    }
+    return 0;
+}
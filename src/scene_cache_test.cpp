@@ -0,0 +1,198 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "rng.h"
+#include "scene_cache.h"
+#include "scenes.h"
+
+// Checks that a scene cache gives back what went into it: the mesh arrays, BVH nodes, bounds
+// and materials of a mesh with normals and texture coordinates and of one without, and the
+// same hits on random rays. Then damages the file in a few ways that load_scene_cache has to
+// refuse: one flipped payload byte, another version and a truncated file.
+
+int failures = 0;
+
+void check(bool ok, const std::string& what)
+{
+    if (!ok)
+    {
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+template <class T>
+bool same_array(const T* a, const T* b, size_t count)
+{
+    return count == 0 || (a && b && std::memcmp(a, b, count * sizeof(T)) == 0);
+}
+
+void check_mesh(const triangle_mesh& loaded, const triangle_mesh& source, const std::string& what)
+{
+    const mesh_view& a = loaded.view;
+    const mesh_view& b = source.view;
+    check(a.vertex_count == b.vertex_count && a.normal_count == b.normal_count && a.uv_count == b.uv_count
+        && a.triangle_count == b.triangle_count, what + ": array sizes");
+    check(same_array(a.px, b.px, b.vertex_count) && same_array(a.py, b.py, b.vertex_count) && same_array(a.pz, b.pz, b.vertex_count),
+        what + ": positions");
+    check(same_array(a.nx, b.nx, b.normal_count) && same_array(a.ny, b.ny, b.normal_count) && same_array(a.nz, b.nz, b.normal_count),
+        what + ": normals");
+    check(same_array(a.tu, b.tu, b.uv_count) && same_array(a.tv, b.tv, b.uv_count), what + ": texture coordinates");
+
+    const size_t indices = 3 * static_cast<size_t>(b.triangle_count);
+    check(same_array(a.position_indices, b.position_indices, indices), what + ": position indices");
+    check((a.normal_indices == nullptr) == (b.normal_indices == nullptr)
+        && (!b.normal_indices || same_array(a.normal_indices, b.normal_indices, indices)), what + ": normal indices");
+    check((a.uv_indices == nullptr) == (b.uv_indices == nullptr)
+        && (!b.uv_indices || same_array(a.uv_indices, b.uv_indices, indices)), what + ": uv indices");
+
+    check(loaded.node_count == source.node_count && same_array(loaded.nodes, source.nodes, source.node_count), what + ": BVH nodes");
+    check(loaded.box.minimum == source.box.minimum && loaded.box.maximum == source.box.maximum, what + ": bounds");
+
+    pcg32 rng;
+    rng.seed(4, 2);
+    int differing = 0;
+    int hits = 0;
+    for (int k = 0; k < 2000; ++k)
+    {
+        const glm::vec3 t(rng.next_float(), rng.next_float(), rng.next_float());
+        const glm::vec3 from = source.box.minimum - glm::vec3(1.f) + t * (source.box.maximum - source.box.minimum + glm::vec3(2.f));
+        // Towards a vertex, so most rays hit.
+        const glm::vec3 jitter(rng.next_float(), rng.next_float(), rng.next_float());
+        const glm::vec3 to = b.position(rng.next_uint() % b.vertex_count) + 0.05f * jitter;
+        if (from == to)
+            continue;
+        const ray r(from, glm::normalize(to - from), 0.f);
+
+        hit_record loaded_rec, source_rec;
+        const bool loaded_hit = loaded.hit(r, 0.001f, infinity, loaded_rec);
+        const bool source_hit = source.hit(r, 0.001f, infinity, source_rec);
+        hits += source_hit;
+        if (loaded_hit != source_hit || (loaded_hit && (loaded_rec.t != source_rec.t || loaded_rec.primitive != source_rec.primitive)))
+            ++differing;
+    }
+    check(differing == 0 && hits > 1000, what + ": hits on random rays");
+}
+
+std::vector<char> read_file(const std::string& path)
+{
+    std::vector<char> bytes;
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return bytes;
+    char buffer[1 << 16];
+    size_t read;
+    while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+        bytes.insert(bytes.end(), buffer, buffer + read);
+    std::fclose(file);
+    return bytes;
+}
+
+bool write_file(const std::string& path, const std::vector<char>& bytes)
+{
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    const bool ok = std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+int main()
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "scene_cache_test.rtscene").string();
+
+    // One mesh with every attribute, one with positions only.
+    mesh_data plain = torus_mesh(1.f, 0.25f, 12, 8);
+    plain.nx.clear(); plain.ny.clear(); plain.nz.clear();
+    plain.tu.clear(); plain.tv.clear();
+    plain.normal_indices.clear();
+    plain.uv_indices.clear();
+    plain.transform(0.5f, glm::vec3(3.f, 0.f, 0.f));
+
+    const triangle_mesh full(torus_mesh(2.f, 0.5f, 40, 16), nullptr);
+    const triangle_mesh positions_only(plain, nullptr);
+
+    std::vector<scene_cache_source> sources(2);
+    sources[0].mesh = &full;
+    sources[0].material = { static_cast<uint32_t>(scene_cache_material_type::metal), { 0.8f, 0.6f, 0.2f }, 0.3f, 0 };
+    sources[1].mesh = &positions_only;
+    sources[1].material = { static_cast<uint32_t>(scene_cache_material_type::lambertian), { 0.1f, 0.2f, 0.3f }, 0.f, 0 };
+
+    if (!write_scene_cache(path, sources))
+    {
+        std::cerr << "Could not write the scene cache\n";
+        return 1;
+    }
+
+    {
+        hittable_list loaded;
+        check(load_scene_cache(path, loaded), "the cache loads");
+        check(loaded.objects.size() == 2, "both meshes load");
+        if (loaded.objects.size() == 2)
+        {
+            const auto* loaded_full = dynamic_cast<const triangle_mesh*>(loaded.objects[0].get());
+            const auto* loaded_plain = dynamic_cast<const triangle_mesh*>(loaded.objects[1].get());
+            check(loaded_full && loaded_plain, "meshes load as triangle meshes");
+            if (loaded_full && loaded_plain)
+            {
+                check_mesh(*loaded_full, full, "mesh with normals and uvs");
+                check_mesh(*loaded_plain, positions_only, "mesh with positions only");
+
+                const auto* m = dynamic_cast<const metal*>(loaded_full->mat_ptr.get());
+                check(m && m->albedo == glm::vec3(0.8f, 0.6f, 0.2f) && m->fuzz == 0.3f, "metal keeps its albedo and fuzz");
+                const auto* l = dynamic_cast<const lambertian*>(loaded_plain->mat_ptr.get());
+                check(l && l->albedo->value(0.f, 0.f, glm::vec3(0.f)) == glm::vec3(0.1f, 0.2f, 0.3f), "lambertian keeps its albedo");
+            }
+        }
+    }
+
+    // Damaged copies, each of which has to be refused.
+    const std::vector<char> bytes = read_file(path);
+    check(bytes.size() > sizeof(scene_cache_header), "the cache reads back");
+    if (bytes.size() > sizeof(scene_cache_header))
+    {
+        std::vector<char> flipped = bytes;
+        flipped[sizeof(scene_cache_header) + (bytes.size() - sizeof(scene_cache_header)) / 2] ^= 0x10;
+
+        std::vector<char> versioned = bytes;
+        const uint32_t version = scene_cache_version + 1;
+        std::memcpy(versioned.data() + offsetof(scene_cache_header, version), &version, sizeof(version));
+
+        std::vector<char> truncated(bytes.begin(), bytes.end() - bytes.size() / 3);
+
+        const struct
+        {
+            const std::vector<char>* bytes;
+            const char* what;
+        } damaged[] = {
+            { &flipped, "a flipped payload byte" },
+            { &versioned, "another version" },
+            { &truncated, "a truncated file" },
+        };
+        std::cerr << "Expecting 3 scene cache errors:\n";
+        for (const auto& d : damaged)
+        {
+            hittable_list loaded;
+            check(write_file(path, *d.bytes) && !load_scene_cache(path, loaded) && loaded.objects.empty(),
+                std::string("refuses ") + d.what);
+        }
+    }
+
+    std::remove(path.c_str());
+    if (failures > 0)
+    {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "Scene caches round-trip\n";
+    return 0;
+}
@@ -0,0 +1,201 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "obj_loader.h"
+#include "scene_cache.h"
+#include "scenes.h"
+#include "thread_pool.h"
+#include "triangle_mesh.h"
+
+// Converts OBJ files into a scene cache that raytrace_cli --scene-cache maps and renders
+// without parsing or building anything, and checks existing caches.
+
+void print_usage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [options] OUTPUT INPUT.obj [[options] INPUT.obj ...]\n"
+        << "       " << program << " --check FILE\n"
+        << "Material options apply to the OBJ files after them:\n"
+        << "  --diffuse R G B     lambertian with this albedo (default .73 .73 .73)\n"
+        << "  --texture FILE      lambertian with this image as albedo\n"
+        << "  --metal R G B FUZZ  metal\n"
+        << "  --glass IOR         dielectric with this index of refraction\n"
+        << "  --light R G B       emits this radiance\n"
+        << "  --no-fit            keep the OBJ coordinates instead of fitting the meshes into\n"
+        << "                      the Cornell box like raytrace_cli --obj\n"
+        << "  --check FILE        verify a cache and print its meshes\n";
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+// Parses count floats following argv[i], advancing i past them.
+bool parse_floats(int argc, char** argv, int& i, int count, float* values)
+{
+    if (i + count >= argc)
+    {
+        std::cerr << "Missing values for " << argv[i] << "\n";
+        return false;
+    }
+    const char* option = argv[i];
+    for (int k = 0; k < count; ++k)
+    {
+        const char* text = argv[++i];
+        char* end = nullptr;
+        values[k] = std::strtof(text, &end);
+        if (*text == '\0' || *end != '\0')
+        {
+            std::cerr << "Invalid value '" << text << "' for " << option << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int check_cache(const std::string& path)
+{
+    const auto start = std::chrono::steady_clock::now();
+    hittable_list objects;
+    if (!load_scene_cache(path, objects))
+        return 1;
+
+    std::cout << path << ": version " << scene_cache_version << ", checksum ok in " << elapsed_ms(start) << " ms\n";
+    for (size_t i = 0; i < objects.objects.size(); ++i)
+    {
+        const auto* mesh = static_cast<const triangle_mesh*>(objects.objects[i].get());
+        std::cout << "  mesh " << i << ": " << mesh->view.triangle_count << " triangles, "
+            << mesh->view.vertex_count << " vertices, " << mesh->node_count << " BVH nodes"
+            << (mesh->view.normal_indices ? ", normals" : "") << (mesh->view.uv_indices ? ", uvs" : "") << "\n";
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 3 && std::string(argv[1]) == "--check")
+        return check_cache(argv[2]);
+
+    scene_cache_material current = {};
+    current.type = static_cast<uint32_t>(scene_cache_material_type::lambertian);
+    current.color[0] = current.color[1] = current.color[2] = .73f;
+    std::string current_texture;
+    bool fit = true;
+
+    std::string output;
+    std::vector<std::string> inputs;
+    std::vector<scene_cache_material> materials;
+    std::vector<std::string> textures;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            print_usage(argv[0]);
+            return 0;
+        }
+
+        scene_cache_material next = {};
+        next.texture = scene_cache_no_texture;
+        if (arg == "--diffuse" || arg == "--light")
+        {
+            if (!parse_floats(argc, argv, i, 3, next.color)) return 1;
+            next.type = static_cast<uint32_t>(arg == "--light" ? scene_cache_material_type::diffuse_light
+                : scene_cache_material_type::lambertian);
+            current = next;
+            current_texture.clear();
+        }
+        else if (arg == "--metal")
+        {
+            float values[4];
+            if (!parse_floats(argc, argv, i, 4, values)) return 1;
+            next.type = static_cast<uint32_t>(scene_cache_material_type::metal);
+            next.color[0] = values[0]; next.color[1] = values[1]; next.color[2] = values[2];
+            next.parameter = values[3];
+            current = next;
+            current_texture.clear();
+        }
+        else if (arg == "--glass")
+        {
+            if (!parse_floats(argc, argv, i, 1, &next.parameter)) return 1;
+            next.type = static_cast<uint32_t>(scene_cache_material_type::dielectric);
+            current = next;
+            current_texture.clear();
+        }
+        else if (arg == "--texture")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Missing value for " << arg << "\n";
+                return 1;
+            }
+            next.type = static_cast<uint32_t>(scene_cache_material_type::lambertian);
+            current = next;
+            current_texture = argv[++i];
+        }
+        else if (arg == "--no-fit")
+            fit = false;
+        else if (arg.size() > 2 && arg[0] == '-' && arg[1] == '-')
+        {
+            std::cerr << "Unknown option " << arg << "\n";
+            print_usage(argv[0]);
+            return 1;
+        }
+        else if (output.empty())
+            output = arg;
+        else
+        {
+            inputs.push_back(arg);
+            materials.push_back(current);
+            textures.push_back(current_texture);
+        }
+    }
+
+    if (inputs.empty())
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<mesh_data> meshes(inputs.size());
+    size_t triangles = 0;
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        if (!load_obj(inputs[i], meshes[i]))
+            return 1;
+        triangles += meshes[i].triangle_count();
+    }
+    std::cout << "Read " << triangles << " triangles in " << elapsed_ms(start) << " ms\n";
+
+    if (fit)
+        fit_to_cornell_box(meshes);
+
+    thread_pool pool;
+    bvh_build_options options;
+    options.pool = &pool;
+
+    start = std::chrono::steady_clock::now();
+    std::vector<shared_ptr<triangle_mesh>> built;
+    std::vector<scene_cache_source> sources;
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        built.push_back(make_shared<triangle_mesh>(std::move(meshes[i]), shared_ptr<material>(), options));
+        sources.push_back({ built.back().get(), materials[i], textures[i] });
+    }
+    std::cout << "Built BVHs in " << elapsed_ms(start) << " ms on " << pool.size() << " threads\n";
+
+    start = std::chrono::steady_clock::now();
+    if (!write_scene_cache(output, sources))
+        return 1;
+    std::cout << "Wrote " << output << " in " << elapsed_ms(start) << " ms\n";
+    return 0;
+}
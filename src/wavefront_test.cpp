@@ -0,0 +1,93 @@
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "camera.h"
+#include "renderer.h"
+#include "scenes.h"
+#include "thread_pool.h"
+#include "wide_bvh.h"
+
+// Checks the promise of wavefront_queue: paths carry their own random state and do the same
+// work as shade_hit, so the wavefront integrator sums up exactly the same radiance per pixel
+// as the path integrator, whatever the queue size and whether bounce rays are sorted.
+
+// Renders settings into accum, returns false for unknown scenes.
+bool render(const std::string& scene_name, const render_settings& settings, thread_pool& pool, accumulation_buffer& accum)
+{
+    scene_description scene;
+    if (!make_scene(scene_name, scene))
+        return false;
+    shared_ptr<hittable> world = make_wide_bvh(bvh_node(scene.world, 0.f, 1.f));
+    Camera camera(scene.lookfrom, scene.lookat, scene.vup, scene.vfov, float(settings.width) / float(settings.height));
+    tile_scheduler scheduler(settings.width, settings.height, settings.tile_size);
+    render_pass(settings, *world, scene.lights.get(), camera, scene.background, pool, scheduler, accum, settings.samples_per_pixel);
+    return true;
+}
+
+int main()
+{
+    thread_pool pool(2);
+
+    render_settings base;
+    base.width = 48;
+    base.height = 36;
+    base.samples_per_pixel = 4;
+    base.tile_size = 16;
+
+    struct variant
+    {
+        const char* name;
+        size_t queue_bytes;
+        bool sort_rays;
+    };
+    const variant variants[] = {
+        { "default queue", default_wavefront_queue_bytes, true },
+        { "one path queue", 1, true },
+        { "unsorted", default_wavefront_queue_bytes, false },
+    };
+
+    int failures = 0;
+    for (const char* scene_name : { "cornell_box", "first_scene", "many_lights" })
+    {
+        render_settings path_settings = base;
+        path_settings.integrator = integrator_type::path;
+        accumulation_buffer expected(base.width, base.height);
+        if (!render(scene_name, path_settings, pool, expected))
+        {
+            std::cerr << "Unknown scene " << scene_name << "\n";
+            return 1;
+        }
+
+        for (const variant& v : variants)
+        {
+            render_settings settings = base;
+            settings.integrator = integrator_type::wavefront;
+            settings.wavefront_queue_bytes = v.queue_bytes;
+            settings.sort_rays = v.sort_rays;
+            accumulation_buffer accum(base.width, base.height);
+            render(scene_name, settings, pool, accum);
+
+            size_t differing = 0;
+            for (size_t i = 0; i < accum.pixel_count(); ++i)
+            {
+                if (std::memcmp(&accum.sum[i], &expected.sum[i], sizeof(glm::vec3)) != 0 || accum.samples[i] != expected.samples[i])
+                    ++differing;
+            }
+            std::cout << scene_name << ", " << v.name << ": " << differing << " pixels differ\n";
+            if (differing > 0)
+                ++failures;
+        }
+    }
+
+    if (failures > 0)
+    {
+        std::cerr << "The wavefront integrator does not match the path integrator\n";
+        return 1;
+    }
+    return 0;
+}